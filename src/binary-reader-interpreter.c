@@ -21,6 +21,17 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#if WASM_INTERPRETER_SCHEDULER
+#include <pthread.h>
+#endif
+
+#if HAVE_SYS_MMAN_H && HAVE_UNISTD_H
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "allocator.h"
 #include "binary-reader.h"
 #include "interpreter.h"
@@ -96,9 +107,82 @@ typedef struct Label {
   uint32_t type_stack_limit;
   uint32_t offset; /* branch location in the istream */
   uint32_t fixup_offset;
+  uint32_t outer_fuel_cost; /* for loops, the enclosing code's fuel cost */
 } Label;
 WASM_DEFINE_VECTOR(label, Label);
 
+/* A call whose operand is written once every function body has been
+ * translated */
+typedef struct FuncFixup {
+  uint32_t offset;     /* of the operand in the istream */
+  uint32_t func_index; /* of the callee in the environment */
+} FuncFixup;
+WASM_DEFINE_VECTOR(func_fixup, FuncFixup);
+
+/* An instruction that was just emitted, remembered so that it can be combined
+ * with the instructions that follow it into a superinstruction. */
+typedef struct RecentInstr {
+  WasmOpcode opcode;
+  uint32_t offset;  /* istream offset of the opcode */
+  uint64_t operand; /* local depth or constant, depending on the opcode */
+} RecentInstr;
+
+/* enough for constant folding to see the operands of a few nested
+ * expressions */
+#define MAX_RECENT_INSTRS 4
+
+/* The value a local is known to hold, if |generation| is the Context's
+ * |known_local_generation|. Everything is forgotten at a branch target, since
+ * the local could have been set on the way there. */
+typedef struct KnownLocal {
+  uint32_t generation;
+  uint64_t value;
+} KnownLocal;
+WASM_DEFINE_VECTOR(known_local, KnownLocal);
+
+/* the longest replacement is a drop_keep followed by a return */
+#define MAX_PEEPHOLE_REPLACEMENT_SIZE 8
+
+/* calls to functions whose body (without its ALLOCA) is at most this many
+ * istream bytes, and that have at most this many locals, are inlined */
+#define MAX_INLINE_FUNC_SIZE 64
+#define MAX_INLINE_FUNC_LOCALS 4
+
+/* An instruction of the function that optimize_function is rewriting */
+typedef struct PeepholeInstr {
+  uint32_t offset; /* in the istream, before the rewrite */
+  uint32_t size;
+  /* where the instruction ends up, or where the next instruction that is
+   * kept does if it is removed */
+  uint32_t new_offset;
+  WasmBool is_target;
+  WasmBool removed;
+  /* what the instruction is emitted as instead, if |replacement_size| isn't
+   * 0. Replacements never branch. */
+  uint8_t replacement[MAX_PEEPHOLE_REPLACEMENT_SIZE];
+  uint32_t replacement_size;
+} PeepholeInstr;
+WASM_DEFINE_VECTOR(peephole_instr, PeepholeInstr);
+
+/* What a module read with lazy translation keeps so that each function body
+ * can be translated on its first call: a copy of the module's bytes, and the
+ * mappings that the rest of the module was translated with. */
+typedef struct WasmInterpreterLazyModule {
+  WasmAllocator* allocator;
+  void* data;
+  size_t size;
+  Uint32Vector sig_index_mapping;
+  Uint32Vector func_index_mapping;
+  Uint32Vector global_index_mapping;
+  uint32_t num_func_imports;
+  uint32_t num_global_imports;
+  WasmBool use_registers;
+  WasmBool optimize;
+  WasmBool quicken;
+  /* where each body starts in |data|, by defined function index */
+  Uint32Vector body_offsets;
+} WasmInterpreterLazyModule;
+
 typedef struct Context {
   WasmAllocator* allocator;
   WasmBinaryReader* reader;
@@ -108,12 +192,42 @@ typedef struct Context {
   WasmInterpreterModule* module;
   WasmInterpreterFunc* current_func;
   WasmTypeVector type_stack;
+  size_t max_type_stack_size;
   LabelVector label_stack;
   Uint32VectorVector func_fixups;
   Uint32VectorVector depth_fixups;
   uint32_t depth;
   WasmMemoryWriter istream_writer;
   uint32_t istream_offset;
+  WasmBool use_registers;
+  WasmBool use_huge_pages;
+  WasmBool optimize;
+  WasmBool quicken;
+  PeepholeInstrVector peephole_instrs;
+  /* the integer locals of the current body that hold a constant, by local
+   * index; only tracked when optimizing */
+  KnownLocalVector known_locals;
+  uint32_t known_local_generation;
+  /* the callees whose |func_fixups| the current body has added to */
+  Uint32Vector body_func_fixup_indexes;
+  /* set while a module is read with lazy translation */
+  WasmInterpreterLazyModule* lazy;
+  /* where each skipped body starts in the module, by defined function index */
+  Uint32Vector body_offsets;
+  /* set when other threads are translating function bodies at the same time,
+   * so the callee's offset can't be read yet: every call is added to
+   * |deferred_func_fixups| instead */
+  WasmBool defer_func_offsets;
+  FuncFixupVector deferred_func_fixups;
+  /* the last instructions emitted since the most recent branch target, oldest
+   * first. Only these may be fused, so a superinstruction never spans a
+   * label. */
+  RecentInstr recent_instrs[MAX_RECENT_INSTRS];
+  uint32_t num_recent_instrs;
+  /* the number of instructions emitted so far for the innermost enclosing
+   * loop, or the function body if there is none. Nested loops aren't counted;
+   * they charge for themselves. */
+  uint32_t fuel_cost;
   /* mappings from module index space to env index space; this won't just be a
    * translation, because imported values will be resolved as well */
   Uint32Vector sig_index_mapping;
@@ -225,8 +339,8 @@ static uint32_t translate_defined_global_index_to_env(Context* ctx,
 
 static WasmInterpreterGlobal* get_global_by_env_index(Context* ctx,
                                                       uint32_t global_index) {
-  assert(global_index < ctx->env->globals.size);
-  return &ctx->env->globals.data[global_index];
+  assert(global_index < ctx->env->instance.globals.size);
+  return &ctx->env->instance.globals.data[global_index];
 }
 
 static WasmInterpreterGlobal* get_global_by_module_index(
@@ -264,6 +378,64 @@ static uint32_t get_istream_offset(Context* ctx) {
   return ctx->istream_offset;
 }
 
+static void forget_known_locals(Context* ctx) {
+  if (++ctx->known_local_generation == 0) {
+    /* the entries from the first generation would look current again */
+    memset(ctx->known_locals.data, 0,
+           ctx->known_locals.size * sizeof(KnownLocal));
+    ctx->known_local_generation = 1;
+  }
+}
+
+static WasmBool get_known_local(Context* ctx,
+                                uint32_t local_index,
+                                uint64_t* out_value) {
+  if (local_index >= ctx->known_locals.size)
+    return WASM_FALSE;
+  KnownLocal* local = &ctx->known_locals.data[local_index];
+  if (local->generation != ctx->known_local_generation)
+    return WASM_FALSE;
+  *out_value = local->value;
+  return WASM_TRUE;
+}
+
+static void set_known_local(Context* ctx,
+                            uint32_t local_index,
+                            WasmBool is_known,
+                            uint64_t value) {
+  if (local_index >= ctx->known_locals.size)
+    return;
+  KnownLocal* local = &ctx->known_locals.data[local_index];
+  local->generation = is_known ? ctx->known_local_generation : 0;
+  local->value = value;
+}
+
+/* Like get_istream_offset, but for an offset that will be used as a branch
+ * target: code emitted after this point can't be fused with code emitted
+ * before it. */
+static uint32_t get_branch_target_offset(Context* ctx) {
+  ctx->num_recent_instrs = 0;
+  forget_known_locals(ctx);
+  return get_istream_offset(ctx);
+}
+
+/* returns the |back|th most recently emitted instruction (0 is the last one),
+ * or NULL if there isn't one that can be fused */
+static RecentInstr* get_recent_instr(Context* ctx, uint32_t back) {
+  if (back >= ctx->num_recent_instrs)
+    return NULL;
+  return &ctx->recent_instrs[ctx->num_recent_instrs - 1 - back];
+}
+
+/* drop the |count| most recently emitted instructions from the istream, so
+ * they can be replaced by a superinstruction */
+static void rewind_recent_instrs(Context* ctx, uint32_t count) {
+  assert(count <= ctx->num_recent_instrs);
+  ctx->num_recent_instrs -= count;
+  ctx->fuel_cost -= count;
+  ctx->istream_offset = ctx->recent_instrs[ctx->num_recent_instrs].offset;
+}
+
 static WasmResult emit_data_at(Context* ctx,
                                size_t offset,
                                const void* data,
@@ -279,6 +451,16 @@ static WasmResult emit_data(Context* ctx, const void* data, size_t size) {
 }
 
 static WasmResult emit_opcode(Context* ctx, WasmOpcode opcode) {
+  if (ctx->num_recent_instrs == MAX_RECENT_INSTRS) {
+    memmove(&ctx->recent_instrs[0], &ctx->recent_instrs[1],
+            (MAX_RECENT_INSTRS - 1) * sizeof(RecentInstr));
+    ctx->num_recent_instrs--;
+  }
+  RecentInstr* instr = &ctx->recent_instrs[ctx->num_recent_instrs++];
+  instr->opcode = opcode;
+  instr->offset = get_istream_offset(ctx);
+  instr->operand = 0;
+  ctx->fuel_cost++;
   return emit_data(ctx, &opcode, sizeof(uint8_t));
 }
 
@@ -298,6 +480,26 @@ static WasmResult emit_i32_at(Context* ctx, uint32_t offset, uint32_t value) {
   return emit_data_at(ctx, offset, &value, sizeof(value));
 }
 
+/* emits an i32.const or i64.const, remembering its value so that it can be
+ * folded into the instructions that use it */
+static WasmResult emit_const(Context* ctx, WasmType type, uint64_t value) {
+  if (type == WASM_TYPE_I32) {
+    CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_I32_CONST));
+    CHECK_RESULT(emit_i32(ctx, (uint32_t)value));
+  } else {
+    assert(type == WASM_TYPE_I64);
+    CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_I64_CONST));
+    CHECK_RESULT(emit_i64(ctx, value));
+  }
+  get_recent_instr(ctx, 0)->operand = value;
+  return WASM_OK;
+}
+
+static WasmBool is_const_instr(RecentInstr* instr) {
+  return instr && (instr->opcode == WASM_OPCODE_I32_CONST ||
+                   instr->opcode == WASM_OPCODE_I64_CONST);
+}
+
 static WasmResult emit_drop_keep(Context* ctx, uint32_t drop, uint8_t keep) {
   assert(drop != UINT32_MAX);
   assert(keep <= 1);
@@ -363,6 +565,40 @@ static WasmResult emit_br_table_offset(Context* ctx, uint32_t depth) {
   return WASM_OK;
 }
 
+static uint32_t get_br_unless_opcode(WasmOpcode cond_opcode) {
+  switch (cond_opcode) {
+#define V(NAME, sign, op, text) \
+  case WASM_OPCODE_##NAME:      \
+    return WASM_OPCODE_BR_UNLESS_##NAME;
+    WASM_FOREACH_BR_UNLESS_COMPARE(V)
+#undef V
+
+    /* br_unless (i32.eqz x) is br_if x */
+    case WASM_OPCODE_I32_EQZ:
+      return WASM_OPCODE_BR_IF;
+
+    default:
+      return WASM_OPCODE_BR_UNLESS;
+  }
+}
+
+/* Emit a BR_UNLESS with an unknown target, returning the offset of the target
+ * so it can be fixed up. If the condition was just computed by a comparison,
+ * the comparison and the branch are fused. */
+static WasmResult emit_br_unless(Context* ctx, uint32_t* out_fixup_offset) {
+  uint32_t opcode = WASM_OPCODE_BR_UNLESS;
+  RecentInstr* cond = get_recent_instr(ctx, 0);
+  if (cond) {
+    opcode = get_br_unless_opcode(cond->opcode);
+    if (opcode != WASM_OPCODE_BR_UNLESS)
+      rewind_recent_instrs(ctx, 1);
+  }
+  CHECK_RESULT(emit_opcode(ctx, opcode));
+  *out_fixup_offset = get_istream_offset(ctx);
+  CHECK_RESULT(emit_i32(ctx, WASM_INVALID_OFFSET));
+  return WASM_OK;
+}
+
 static WasmResult fixup_top_label(Context* ctx, uint32_t offset) {
   uint32_t top = ctx->label_stack.size - 1;
   if (top >= ctx->depth_fixups.size) {
@@ -383,10 +619,19 @@ static WasmResult fixup_top_label(Context* ctx, uint32_t offset) {
 static WasmResult emit_func_offset(Context* ctx,
                                    WasmInterpreterFunc* func,
                                    uint32_t func_index) {
+  if (ctx->defer_func_offsets) {
+    FuncFixup* fixup =
+        wasm_append_func_fixup(ctx->allocator, &ctx->deferred_func_fixups);
+    fixup->offset = get_istream_offset(ctx);
+    fixup->func_index = func - ctx->env->funcs.data;
+    return emit_i32(ctx, WASM_INVALID_OFFSET);
+  }
   if (func->defined.offset == WASM_INVALID_OFFSET) {
-    CHECK_RESULT(
-        append_fixup(ctx, &ctx->func_fixups,
-                     translate_module_func_index_to_defined(ctx, func_index)));
+    uint32_t defined_index =
+        translate_module_func_index_to_defined(ctx, func_index);
+    CHECK_RESULT(append_fixup(ctx, &ctx->func_fixups, defined_index));
+    wasm_append_uint32_value(ctx->allocator, &ctx->body_func_fixup_indexes,
+                             &defined_index);
   }
   CHECK_RESULT(emit_i32(ctx, func->defined.offset));
   return WASM_OK;
@@ -399,11 +644,6 @@ static void on_error(WasmBinaryReaderContext* ctx, const char* message) {
 static WasmResult on_signature_count(uint32_t count, void* user_data) {
   Context* ctx = user_data;
   wasm_resize_uint32_vector(ctx->allocator, &ctx->sig_index_mapping, count);
-  uint32_t i;
-  for (i = 0; i < count; ++i)
-    ctx->sig_index_mapping.data[i] = ctx->env->sigs.size + i;
-  wasm_resize_interpreter_func_signature_vector(ctx->allocator, &ctx->env->sigs,
-                                                ctx->env->sigs.size + count);
   return WASM_OK;
 }
 
@@ -414,15 +654,10 @@ static WasmResult on_signature(uint32_t index,
                                WasmType* result_types,
                                void* user_data) {
   Context* ctx = user_data;
-  WasmInterpreterFuncSignature* sig = get_signature_by_module_index(ctx, index);
-
-  wasm_reserve_types(ctx->allocator, &sig->param_types, param_count);
-  sig->param_types.size = param_count;
-  memcpy(sig->param_types.data, param_types, param_count * sizeof(WasmType));
-
-  wasm_reserve_types(ctx->allocator, &sig->result_types, result_count);
-  sig->result_types.size = result_count;
-  memcpy(sig->result_types.data, result_types, result_count * sizeof(WasmType));
+  assert(index < ctx->sig_index_mapping.size);
+  ctx->sig_index_mapping.data[index] = wasm_intern_interpreter_func_signature(
+      ctx->allocator, ctx->env, param_count, param_types, result_count,
+      result_types);
   return WASM_OK;
 }
 
@@ -550,7 +785,6 @@ static WasmResult on_import_func(uint32_t index,
   Context* ctx = user_data;
   assert(index < ctx->module->defined.imports.size);
   WasmInterpreterImport* import = &ctx->module->defined.imports.data[index];
-  assert(sig_index < ctx->env->sigs.size);
   import->func.sig_index = translate_sig_index_to_env(ctx, sig_index);
 
   uint32_t func_index;
@@ -568,7 +802,7 @@ static WasmResult on_import_func(uint32_t index,
     CHECK_RESULT(host_delegate->import_func(import, func, sig,
                                             make_print_error_callback(ctx),
                                             host_delegate->user_data));
-    assert(func->host.callback);
+    assert(func->host.callback || func->host.trampoline);
 
     func_index = ctx->env->funcs.size - 1;
     append_export(ctx, ctx->host_import_module, WASM_EXTERNAL_KIND_FUNC,
@@ -597,6 +831,7 @@ static void init_table_func_indexes(Context* ctx, WasmInterpreterTable* table) {
   size_t i;
   for (i = 0; i < table->func_indexes.size; ++i)
     table->func_indexes.data[i] = WASM_INVALID_INDEX;
+  wasm_new_interpreter_table_epoch(ctx->env, table);
 }
 
 static WasmResult on_import_table(uint32_t index,
@@ -613,8 +848,8 @@ static WasmResult on_import_table(uint32_t index,
   WasmInterpreterImport* import = &ctx->module->defined.imports.data[index];
 
   if (ctx->is_host_import) {
-    WasmInterpreterTable* table =
-        wasm_append_interpreter_table(ctx->allocator, &ctx->env->tables);
+    WasmInterpreterTable* table = wasm_append_interpreter_table(
+        ctx->allocator, &ctx->env->instance.tables);
     table->limits = *elem_limits;
     init_table_func_indexes(ctx, table);
 
@@ -626,13 +861,14 @@ static WasmResult on_import_table(uint32_t index,
 
     CHECK_RESULT(check_import_limits(ctx, elem_limits, &table->limits));
 
-    ctx->module->table_index = ctx->env->tables.size - 1;
+    ctx->module->table_index = ctx->env->instance.tables.size - 1;
     append_export(ctx, ctx->host_import_module, WASM_EXTERNAL_KIND_TABLE,
                   ctx->module->table_index, import->field_name);
   } else {
     CHECK_RESULT(check_import_kind(ctx, import, WASM_EXTERNAL_KIND_TABLE));
-    assert(ctx->import_index < ctx->env->tables.size);
-    WasmInterpreterTable* table = &ctx->env->tables.data[ctx->import_index];
+    assert(ctx->import_index < ctx->env->instance.tables.size);
+    WasmInterpreterTable* table =
+        &ctx->env->instance.tables.data[ctx->import_index];
     CHECK_RESULT(check_import_limits(ctx, elem_limits, &table->limits));
 
     import->table.limits = *elem_limits;
@@ -654,9 +890,10 @@ static WasmResult on_import_memory(uint32_t index,
   WasmInterpreterImport* import = &ctx->module->defined.imports.data[index];
 
   if (ctx->is_host_import) {
-    WasmInterpreterMemory* memory =
-        wasm_append_interpreter_memory(ctx->allocator, &ctx->env->memories);
+    WasmInterpreterMemory* memory = wasm_append_interpreter_memory(
+        ctx->allocator, &ctx->env->instance.memories);
     memory->allocator = ctx->memory_allocator;
+    memory->use_huge_pages = ctx->use_huge_pages;
 
     WasmInterpreterHostImportDelegate* host_delegate =
         &ctx->host_import_module->host.import_delegate;
@@ -667,13 +904,14 @@ static WasmResult on_import_memory(uint32_t index,
     assert(memory->data);
     CHECK_RESULT(check_import_limits(ctx, page_limits, &memory->page_limits));
 
-    ctx->module->memory_index = ctx->env->memories.size - 1;
+    ctx->module->memory_index = ctx->env->instance.memories.size - 1;
     append_export(ctx, ctx->host_import_module, WASM_EXTERNAL_KIND_MEMORY,
                   ctx->module->memory_index, import->field_name);
   } else {
     CHECK_RESULT(check_import_kind(ctx, import, WASM_EXTERNAL_KIND_MEMORY));
-    assert(ctx->import_index < ctx->env->memories.size);
-    WasmInterpreterMemory* memory = &ctx->env->memories.data[ctx->import_index];
+    assert(ctx->import_index < ctx->env->instance.memories.size);
+    WasmInterpreterMemory* memory =
+        &ctx->env->instance.memories.data[ctx->import_index];
     CHECK_RESULT(check_import_limits(ctx, page_limits, &memory->page_limits));
 
     import->memory.limits = *page_limits;
@@ -690,10 +928,10 @@ static WasmResult on_import_global(uint32_t index,
   assert(index < ctx->module->defined.imports.size);
   WasmInterpreterImport* import = &ctx->module->defined.imports.data[index];
 
-  uint32_t global_index = ctx->env->globals.size - 1;
+  uint32_t global_index = ctx->env->instance.globals.size - 1;
   if (ctx->is_host_import) {
-    WasmInterpreterGlobal* global =
-        wasm_append_interpreter_global(ctx->allocator, &ctx->env->globals);
+    WasmInterpreterGlobal* global = wasm_append_interpreter_global(
+        ctx->allocator, &ctx->env->instance.globals);
     global->typed_value.type = type;
     global->mutable_ = mutable;
 
@@ -703,7 +941,7 @@ static WasmResult on_import_global(uint32_t index,
                                               make_print_error_callback(ctx),
                                               host_delegate->user_data));
 
-    global_index = ctx->env->globals.size - 1;
+    global_index = ctx->env->instance.globals.size - 1;
     append_export(ctx, ctx->host_import_module, WASM_EXTERNAL_KIND_GLOBAL,
                   global_index, import->field_name);
   } else {
@@ -740,7 +978,9 @@ static WasmResult on_function_signature(uint32_t index,
                                         void* user_data) {
   Context* ctx = user_data;
   WasmInterpreterFunc* func = get_func_by_defined_index(ctx, index);
+  func->is_host = WASM_FALSE;
   func->defined.offset = WASM_INVALID_OFFSET;
+  func->defined.stub_offset = WASM_INVALID_OFFSET;
   func->sig_index = translate_sig_index_to_env(ctx, sig_index);
   return WASM_OK;
 }
@@ -754,11 +994,11 @@ static WasmResult on_table(uint32_t index,
     print_error(ctx, "only one table allowed");
     return WASM_ERROR;
   }
-  WasmInterpreterTable* table =
-      wasm_append_interpreter_table(ctx->allocator, &ctx->env->tables);
+  WasmInterpreterTable* table = wasm_append_interpreter_table(
+      ctx->allocator, &ctx->env->instance.tables);
   table->limits = *elem_limits;
   init_table_func_indexes(ctx, table);
-  ctx->module->table_index = ctx->env->tables.size - 1;
+  ctx->module->table_index = ctx->env->instance.tables.size - 1;
   return WASM_OK;
 }
 
@@ -770,14 +1010,17 @@ static WasmResult on_memory(uint32_t index,
     print_error(ctx, "only one memory allowed");
     return WASM_ERROR;
   }
-  WasmInterpreterMemory* memory =
-      wasm_append_interpreter_memory(ctx->allocator, &ctx->env->memories);
+  WasmInterpreterMemory* memory = wasm_append_interpreter_memory(
+      ctx->allocator, &ctx->env->instance.memories);
   memory->allocator = ctx->memory_allocator;
   memory->page_limits = *page_limits;
-  memory->byte_size = page_limits->initial * WASM_PAGE_SIZE;
-  memory->data = wasm_alloc_zero(ctx->memory_allocator, memory->byte_size,
-                                 WASM_DEFAULT_ALIGN);
-  ctx->module->memory_index = ctx->env->memories.size - 1;
+  memory->use_huge_pages = ctx->use_huge_pages;
+  if (WASM_FAILED(wasm_alloc_interpreter_memory(memory))) {
+    print_error(ctx, "unable to allocate memory of %" PRIu64 " pages",
+                page_limits->initial);
+    return WASM_ERROR;
+  }
+  ctx->module->memory_index = ctx->env->instance.memories.size - 1;
   return WASM_OK;
 }
 
@@ -788,10 +1031,11 @@ static WasmResult on_global_count(uint32_t count, void* user_data) {
   uint32_t i;
   for (i = 0; i < count; ++i) {
     ctx->global_index_mapping.data[ctx->num_global_imports + i] =
-        ctx->env->globals.size + i;
+        ctx->env->instance.globals.size + i;
   }
-  wasm_resize_interpreter_global_vector(ctx->allocator, &ctx->env->globals,
-                                        ctx->env->globals.size + count);
+  wasm_resize_interpreter_global_vector(
+      ctx->allocator, &ctx->env->instance.globals,
+      ctx->env->instance.globals.size + count);
   return WASM_OK;
 }
 
@@ -910,7 +1154,7 @@ static WasmResult on_elem_segment_function_index(uint32_t index,
   Context* ctx = user_data;
   assert(ctx->module->table_index != WASM_INVALID_INDEX);
   WasmInterpreterTable* table =
-      &ctx->env->tables.data[ctx->module->table_index];
+      &ctx->env->instance.tables.data[ctx->module->table_index];
   if (ctx->table_offset >= table->func_indexes.size) {
     print_error(ctx,
                 "elem segment offset is out of bounds: %u >= max value %" PRIzd,
@@ -918,8 +1162,14 @@ static WasmResult on_elem_segment_function_index(uint32_t index,
     return WASM_ERROR;
   }
 
-  table->func_indexes.data[ctx->table_offset++] =
-      translate_func_index_to_env(ctx, func_index);
+  WasmInterpreterElem* elem = wasm_append_interpreter_elem(
+      ctx->allocator, &ctx->env->instance_template.elems);
+  elem->table_index = ctx->module->table_index;
+  elem->offset = ctx->table_offset;
+  elem->func_index = translate_func_index_to_env(ctx, func_index);
+  table->func_indexes.data[ctx->table_offset++] = elem->func_index;
+  /* code of earlier modules may have cached the old entry */
+  wasm_new_interpreter_table_epoch(ctx->env, table);
   return WASM_OK;
 }
 
@@ -930,7 +1180,7 @@ static WasmResult on_data_segment_data(uint32_t index,
   Context* ctx = user_data;
   assert(ctx->module->memory_index != WASM_INVALID_INDEX);
   WasmInterpreterMemory* memory =
-      &ctx->env->memories.data[ctx->module->memory_index];
+      &ctx->env->instance.memories.data[ctx->module->memory_index];
   assert(ctx->init_expr_value.type == WASM_TYPE_I32);
   uint32_t address = ctx->init_expr_value.value.i32;
   uint8_t* dst_data = memory->data;
@@ -942,6 +1192,16 @@ static WasmResult on_data_segment_data(uint32_t index,
     return WASM_ERROR;
   }
   memcpy(&dst_data[address], src_data, size);
+
+  if (size > 0) {
+    WasmInterpreterDataSegment* segment = wasm_append_interpreter_data_segment(
+        ctx->allocator, &ctx->env->instance_template.data_segments);
+    segment->memory_index = ctx->module->memory_index;
+    segment->address = address;
+    segment->size = size;
+    segment->data = wasm_alloc(ctx->allocator, size, WASM_DEFAULT_ALIGN);
+    memcpy(segment->data, src_data, size);
+  }
   return WASM_OK;
 }
 
@@ -961,6 +1221,7 @@ static void push_label(Context* ctx,
   label->type_stack_limit = ctx->type_stack.size;
   label->offset = offset;
   label->fixup_offset = fixup_offset;
+  label->outer_fuel_cost = 0;
   LOGF("   : +depth %" PRIzd "\n", ctx->label_stack.size - 1);
 }
 
@@ -1086,6 +1347,8 @@ static void push_type(Context* ctx, WasmType type) {
     LOGF("%3" PRIzd "->%3" PRIzd ": push %s\n", ctx->type_stack.size,
          ctx->type_stack.size + 1, wasm_get_type_name(type));
     wasm_append_type_value(ctx->allocator, &ctx->type_stack, &type);
+    if (ctx->type_stack.size > ctx->max_type_stack_size)
+      ctx->max_type_stack_size = ctx->type_stack.size;
   }
 }
 
@@ -1155,28 +1418,43 @@ static WasmResult drop_types_for_return(Context* ctx, uint32_t arity) {
   return WASM_OK;
 }
 
+/* returns the istream offset of the |index|th operand of the ALLOCA that
+ * starts |func| */
+static uint32_t get_alloca_operand_offset(WasmInterpreterFunc* func,
+                                          uint32_t index) {
+  return func->defined.offset + sizeof(uint8_t) + index * sizeof(uint32_t);
+}
+
 static WasmResult begin_function_body(uint32_t index, void* user_data) {
   Context* ctx = user_data;
   WasmInterpreterFunc* func = get_func_by_defined_index(ctx, index);
   WasmInterpreterFuncSignature* sig =
       get_signature_by_env_index(ctx, func->sig_index);
 
-  func->is_host = WASM_FALSE;
-  func->defined.offset = get_istream_offset(ctx);
+  func->defined.offset = get_branch_target_offset(ctx);
   func->defined.local_decl_count = 0;
   func->defined.local_count = 0;
+  func->defined.max_stack_height = 0;
+  func->defined.call_count = 0;
+  func->defined.jit_code = NULL;
 
   ctx->current_func = func;
   ctx->depth_fixups.size = 0;
+  ctx->body_func_fixup_indexes.size = 0;
+  ctx->known_locals.size = 0;
   ctx->type_stack.size = 0;
   ctx->label_stack.size = 0;
   ctx->depth = 0;
+  ctx->fuel_cost = 0;
 
-  /* fixup function references */
+  /* fixup function references. There are none when translating lazily, since
+   * calls then go to the function's stub, which always exists. */
   uint32_t i;
-  Uint32Vector* fixups = &ctx->func_fixups.data[index];
-  for (i = 0; i < fixups->size; ++i)
-    CHECK_RESULT(emit_i32_at(ctx, fixups->data[i], func->defined.offset));
+  if (index < ctx->func_fixups.size) {
+    Uint32Vector* fixups = &ctx->func_fixups.data[index];
+    for (i = 0; i < fixups->size; ++i)
+      CHECK_RESULT(emit_i32_at(ctx, fixups->data[i], func->defined.offset));
+  }
 
   /* append param types */
   for (i = 0; i < sig->param_types.size; ++i) {
@@ -1185,6 +1463,21 @@ static WasmResult begin_function_body(uint32_t index, void* user_data) {
                            &type);
     wasm_append_type_value(ctx->allocator, &ctx->type_stack, &type);
   }
+  ctx->max_type_stack_size = ctx->type_stack.size;
+  /* nothing is known about the params */
+  if (ctx->optimize) {
+    wasm_resize_known_local_vector(ctx->allocator, &ctx->known_locals,
+                                   func->defined.param_and_local_types.size);
+  }
+
+  /* every function starts with an ALLOCA, which does the only value stack
+   * check for the body and charges its fuel. Its operands are fixed up once
+   * the local count, the maximum stack height and the fuel cost are known. */
+  CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_ALLOCA));
+  CHECK_RESULT(emit_i32(ctx, 0));
+  CHECK_RESULT(emit_i32(ctx, 0));
+  CHECK_RESULT(emit_i32(ctx, func - ctx->env->funcs.data));
+  CHECK_RESULT(emit_i32(ctx, 0));
 
   /* push implicit func label (equivalent to return) */
   push_label(ctx, LABEL_TYPE_FUNC, &sig->result_types, WASM_INVALID_OFFSET,
@@ -1192,6 +1485,491 @@ static WasmResult begin_function_body(uint32_t index, void* user_data) {
   return WASM_OK;
 }
 
+static WasmResult on_skipped_function_body(uint32_t index,
+                                           uint32_t offset,
+                                           void* user_data) {
+  Context* ctx = user_data;
+  wasm_append_uint32_value(ctx->allocator, &ctx->body_offsets, &offset);
+  if (!ctx->lazy) {
+    /* translated in parallel once the module has been read */
+    return WASM_OK;
+  }
+
+  WasmInterpreterFunc* func = get_func_by_defined_index(ctx, index);
+  func->defined.offset = get_branch_target_offset(ctx);
+  func->defined.stub_offset = func->defined.offset;
+  func->defined.local_decl_count = 0;
+  func->defined.local_count = 0;
+  func->defined.max_stack_height = 0;
+  func->defined.call_count = 0;
+  func->defined.jit_code = NULL;
+
+  CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_TRANSLATE));
+  CHECK_RESULT(emit_i32(ctx, func - ctx->env->funcs.data));
+  CHECK_RESULT(emit_i32(ctx, ctx->module - ctx->env->modules.data));
+  func->defined.end_offset = get_istream_offset(ctx);
+  return WASM_OK;
+}
+
+static uint32_t read_istream_u32(const uint8_t* code, uint32_t offset) {
+  uint32_t value;
+  memcpy(&value, code + offset, sizeof(value));
+  return value;
+}
+
+static WasmBool is_branch_opcode(uint8_t opcode) {
+  switch (opcode) {
+    case WASM_OPCODE_BR:
+    case WASM_OPCODE_BR_IF:
+    case WASM_OPCODE_BR_UNLESS:
+#define V(NAME, sign, op, text) case WASM_OPCODE_BR_UNLESS_##NAME:
+      WASM_FOREACH_BR_UNLESS_COMPARE(V)
+#undef V
+      return WASM_TRUE;
+
+    default:
+      return WASM_FALSE;
+  }
+}
+
+/* the bytes that |instr| will be emitted as */
+static const uint8_t* get_peephole_instr_code(const uint8_t* code,
+                                              const PeepholeInstr* instr) {
+  return instr->replacement_size ? instr->replacement : code + instr->offset;
+}
+
+static uint32_t get_peephole_instr_size(const PeepholeInstr* instr) {
+  return instr->replacement_size ? instr->replacement_size : instr->size;
+}
+
+/* finds the istream offset of the |index|th branch target operand of |instr|,
+ * or returns WASM_FALSE if it doesn't have that many. Replaced instructions
+ * have none. */
+static WasmBool get_branch_operand_offset(const uint8_t* code,
+                                          const PeepholeInstr* instr,
+                                          uint32_t index,
+                                          uint32_t* out_offset) {
+  if (instr->replacement_size)
+    return WASM_FALSE;
+  uint8_t opcode = code[instr->offset];
+  if (is_branch_opcode(opcode)) {
+    *out_offset = instr->offset + sizeof(uint8_t);
+    return index == 0;
+  }
+  if (opcode == WASM_OPCODE_BR_TABLE) {
+    uint32_t num_targets = read_istream_u32(code, instr->offset + 1);
+    uint32_t table_offset =
+        read_istream_u32(code, instr->offset + 1 + sizeof(uint32_t));
+    *out_offset = table_offset + index * WASM_TABLE_ENTRY_SIZE +
+                  WASM_TABLE_ENTRY_OFFSET_OFFSET;
+    return index <= num_targets;
+  }
+  return WASM_FALSE;
+}
+
+/* returns the instruction that contains |offset|, which must be in the
+ * function */
+static PeepholeInstr* find_peephole_instr(Context* ctx, uint32_t offset) {
+  PeepholeInstrVector* instrs = &ctx->peephole_instrs;
+  size_t lo = 0;
+  size_t hi = instrs->size;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (instrs->data[mid].offset <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return &instrs->data[lo];
+}
+
+/* marks the instructions that are branched to; returns WASM_FALSE if a branch
+ * goes anywhere but the start of an instruction of the function */
+static WasmBool mark_branch_targets(Context* ctx, const uint8_t* code) {
+  PeepholeInstrVector* instrs = &ctx->peephole_instrs;
+  uint32_t start = instrs->data[0].offset;
+  uint32_t end = instrs->data[instrs->size - 1].offset +
+                 instrs->data[instrs->size - 1].size;
+  size_t i;
+  for (i = 0; i < instrs->size; ++i)
+    instrs->data[i].is_target = WASM_FALSE;
+  for (i = 0; i < instrs->size; ++i) {
+    PeepholeInstr* instr = &instrs->data[i];
+    uint32_t operand_offset;
+    uint32_t j;
+    for (j = 0; get_branch_operand_offset(code, instr, j, &operand_offset);
+         ++j) {
+      uint32_t target = read_istream_u32(code, operand_offset);
+      if (target < start || target >= end)
+        return WASM_FALSE;
+      PeepholeInstr* target_instr = find_peephole_instr(ctx, target);
+      if (target_instr->offset != target)
+        return WASM_FALSE;
+      target_instr->is_target = WASM_TRUE;
+    }
+  }
+  return WASM_TRUE;
+}
+
+/* returns WASM_TRUE if |instr| will be emitted as a single drop or drop_keep,
+ * and gets its counts */
+static WasmBool get_peephole_drop_keep(const uint8_t* code,
+                                       const PeepholeInstr* instr,
+                                       uint32_t* out_drop,
+                                       uint8_t* out_keep) {
+  const uint8_t* p = get_peephole_instr_code(code, instr);
+  uint32_t size = get_peephole_instr_size(instr);
+  if (p[0] == WASM_OPCODE_DROP && size == 1) {
+    *out_drop = 1;
+    *out_keep = 0;
+    return WASM_TRUE;
+  }
+  if (p[0] == WASM_OPCODE_DROP_KEEP &&
+      size == wasm_get_interpreter_instruction_size(p)) {
+    memcpy(out_drop, p + 1, sizeof(uint32_t));
+    *out_keep = p[1 + sizeof(uint32_t)];
+    return WASM_TRUE;
+  }
+  return WASM_FALSE;
+}
+
+/* appends the smallest encoding of drop_keep |drop| |keep| to the replacement
+ * of |instr| */
+static void append_peephole_drop_keep(PeepholeInstr* instr,
+                                      uint32_t drop,
+                                      uint8_t keep) {
+  uint8_t* p = instr->replacement + instr->replacement_size;
+  if (drop == 1 && keep == 0) {
+    p[0] = WASM_OPCODE_DROP;
+    instr->replacement_size += 1;
+  } else {
+    p[0] = WASM_OPCODE_DROP_KEEP;
+    memcpy(p + 1, &drop, sizeof(drop));
+    p[1 + sizeof(drop)] = keep;
+    instr->replacement_size += 1 + sizeof(drop) + sizeof(keep);
+  }
+}
+
+static void append_peephole_opcode(PeepholeInstr* instr, uint8_t opcode) {
+  instr->replacement[instr->replacement_size++] = opcode;
+}
+
+/* whether execution never continues to the instruction after |instr| */
+static WasmBool ends_peephole_block(const uint8_t* code,
+                                    const PeepholeInstr* instr) {
+  const uint8_t* p = get_peephole_instr_code(code, instr);
+  uint32_t size = get_peephole_instr_size(instr);
+  if (instr->replacement_size)
+    return p[size - 1] == WASM_OPCODE_RETURN;
+  switch (p[0]) {
+    case WASM_OPCODE_BR:
+    case WASM_OPCODE_BR_TABLE:
+    case WASM_OPCODE_RETURN:
+    case WASM_OPCODE_UNREACHABLE:
+      return WASM_TRUE;
+
+    default:
+      return WASM_FALSE;
+  }
+}
+
+/* A jump that lands on an unconditional branch goes straight to where that
+ * branch goes; chains longer than this are left as they are. */
+#define MAX_THREADED_JUMPS 8
+
+static void thread_jumps(Context* ctx, uint8_t* code) {
+  PeepholeInstrVector* instrs = &ctx->peephole_instrs;
+  size_t i;
+  for (i = 0; i < instrs->size; ++i) {
+    uint32_t operand_offset;
+    uint32_t j;
+    for (j = 0;
+         get_branch_operand_offset(code, &instrs->data[i], j, &operand_offset);
+         ++j) {
+      uint32_t target = read_istream_u32(code, operand_offset);
+      uint32_t hops;
+      for (hops = 0; hops < MAX_THREADED_JUMPS; ++hops) {
+        if (code[target] != WASM_OPCODE_BR)
+          break;
+        uint32_t next = read_istream_u32(code, target + 1);
+        if (next == target)
+          break;
+        target = next;
+      }
+      memcpy(code + operand_offset, &target, sizeof(target));
+    }
+  }
+}
+
+/* replaces each br to a return, or to a drop_keep and a return, with a copy of
+ * them, folding in a drop_keep just before the br */
+static void inline_branches_to_return(Context* ctx, const uint8_t* code) {
+  PeepholeInstrVector* instrs = &ctx->peephole_instrs;
+  size_t i;
+  for (i = 0; i < instrs->size; ++i) {
+    PeepholeInstr* instr = &instrs->data[i];
+    if (instr->replacement_size || code[instr->offset] != WASM_OPCODE_BR)
+      continue;
+    PeepholeInstr* target =
+        find_peephole_instr(ctx, read_istream_u32(code, instr->offset + 1));
+    if (code[target->offset] == WASM_OPCODE_RETURN) {
+      append_peephole_opcode(instr, WASM_OPCODE_RETURN);
+      continue;
+    }
+
+    uint32_t drop;
+    uint8_t keep;
+    if (target + 1 == instrs->data + instrs->size ||
+        code[target[1].offset] != WASM_OPCODE_RETURN ||
+        !get_peephole_drop_keep(code, target, &drop, &keep)) {
+      continue;
+    }
+
+    uint32_t prev_drop;
+    uint8_t prev_keep;
+    if (i > 0 && !instr->is_target && !instr[-1].removed &&
+        get_peephole_drop_keep(code, &instr[-1], &prev_drop, &prev_keep) &&
+        prev_keep == keep) {
+      instr[-1].replacement_size = 0;
+      append_peephole_drop_keep(&instr[-1], prev_drop + drop, keep);
+    } else {
+      append_peephole_drop_keep(instr, drop, keep);
+    }
+    append_peephole_opcode(instr, WASM_OPCODE_RETURN);
+  }
+}
+
+/* merges runs of drop_keeps that keep the same number of values */
+static void fold_drop_keeps(Context* ctx, const uint8_t* code) {
+  PeepholeInstrVector* instrs = &ctx->peephole_instrs;
+  size_t i;
+  for (i = 0; i < instrs->size; ++i) {
+    PeepholeInstr* instr = &instrs->data[i];
+    uint32_t drop;
+    uint8_t keep;
+    if (instr->removed || !get_peephole_drop_keep(code, instr, &drop, &keep))
+      continue;
+    size_t j;
+    for (j = i + 1; j < instrs->size; ++j) {
+      PeepholeInstr* next = &instrs->data[j];
+      uint32_t next_drop;
+      uint8_t next_keep;
+      if (next->removed)
+        continue;
+      if (next->is_target ||
+          !get_peephole_drop_keep(code, next, &next_drop, &next_keep) ||
+          next_keep != keep) {
+        break;
+      }
+      drop += next_drop;
+      next->removed = WASM_TRUE;
+      instr->replacement_size = 0;
+      append_peephole_drop_keep(instr, drop, keep);
+    }
+  }
+}
+
+/* removes the code after an unconditional branch that nothing branches to */
+static void remove_dead_code(Context* ctx, const uint8_t* code) {
+  PeepholeInstrVector* instrs = &ctx->peephole_instrs;
+  WasmBool live = WASM_TRUE;
+  size_t i;
+  for (i = 0; i < instrs->size; ++i) {
+    PeepholeInstr* instr = &instrs->data[i];
+    if (code[instr->offset] == WASM_OPCODE_DATA) {
+      /* the table of the br_table before it */
+      instr->removed = instr[-1].removed;
+      continue;
+    }
+    if (instr->is_target)
+      live = WASM_TRUE;
+    if (!live)
+      instr->removed = WASM_TRUE;
+    else if (!instr->removed && ends_peephole_block(code, instr))
+      live = WASM_FALSE;
+  }
+}
+
+/* removes branches to the instruction that follows them, dropping their
+ * condition instead */
+static void remove_branches_to_next(Context* ctx, const uint8_t* code) {
+  PeepholeInstrVector* instrs = &ctx->peephole_instrs;
+  size_t i;
+  for (i = 0; i < instrs->size; ++i) {
+    PeepholeInstr* instr = &instrs->data[i];
+    uint8_t opcode = code[instr->offset];
+    if (instr->removed || instr->replacement_size || !is_branch_opcode(opcode))
+      continue;
+    PeepholeInstr* target =
+        find_peephole_instr(ctx, read_istream_u32(code, instr->offset + 1));
+    if (target <= instr)
+      continue;
+    PeepholeInstr* next = instr + 1;
+    while (next < target && next->removed)
+      next++;
+    if (next != target)
+      continue;
+
+    switch (opcode) {
+      case WASM_OPCODE_BR:
+        instr->removed = WASM_TRUE;
+        break;
+
+      case WASM_OPCODE_BR_IF:
+      case WASM_OPCODE_BR_UNLESS:
+        append_peephole_drop_keep(instr, 1, 0);
+        break;
+
+      default:
+        /* a fused comparison pops both of its operands */
+        append_peephole_drop_keep(instr, 2, 0);
+        break;
+    }
+  }
+}
+
+/* moves the offset of a call operand that is waiting for its callee to be
+ * translated to where the operand is now. Returns WASM_FALSE if the call was
+ * removed. */
+static WasmBool move_call_fixup(Context* ctx, uint32_t* offset) {
+  PeepholeInstr* instr = find_peephole_instr(ctx, *offset);
+  if (instr->removed)
+    return WASM_FALSE;
+  *offset = instr->new_offset + (*offset - instr->offset);
+  return WASM_TRUE;
+}
+
+static int compare_uint32(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static void move_call_fixups(Context* ctx, uint32_t start) {
+  /* each callee's fixups from this body are at the end of its list */
+  Uint32Vector* callees = &ctx->body_func_fixup_indexes;
+  qsort(callees->data, callees->size, sizeof(uint32_t), compare_uint32);
+  size_t i;
+  for (i = 0; i < callees->size; ++i) {
+    if (i > 0 && callees->data[i] == callees->data[i - 1])
+      continue;
+    Uint32Vector* fixups = &ctx->func_fixups.data[callees->data[i]];
+    size_t j;
+    size_t kept = 0;
+    for (j = 0; j < fixups->size; ++j) {
+      uint32_t offset = fixups->data[j];
+      if (offset < start || move_call_fixup(ctx, &offset))
+        fixups->data[kept++] = offset;
+    }
+    fixups->size = kept;
+  }
+
+  FuncFixupVector* deferred = &ctx->deferred_func_fixups;
+  size_t kept = 0;
+  for (i = 0; i < deferred->size; ++i) {
+    FuncFixup fixup = deferred->data[i];
+    if (fixup.offset < start || move_call_fixup(ctx, &fixup.offset))
+      deferred->data[kept++] = fixup;
+  }
+  deferred->size = kept;
+}
+
+/* Rewrites the code of |func|, which was just translated, to run fewer
+ * instructions: jumps to unconditional branches go to their final target,
+ * branches to a return return directly, adjacent drop_keeps are merged, and
+ * unreachable code and branches to the next instruction are removed. The
+ * code and the offsets that refer to it are then moved up to close the gaps.
+ * The fuel that the function charges is left as translated, so fuel runs out
+ * at the same place with or without this. */
+static WasmResult optimize_function(Context* ctx, WasmInterpreterFunc* func) {
+  uint32_t start = func->defined.offset;
+  uint32_t end = func->defined.end_offset;
+  uint8_t* code = (uint8_t*)ctx->istream_writer.buf.start;
+  PeepholeInstrVector* instrs = &ctx->peephole_instrs;
+  instrs->size = 0;
+  uint32_t offset;
+  for (offset = start; offset < end;) {
+    PeepholeInstr* instr = wasm_append_peephole_instr(ctx->allocator, instrs);
+    instr->offset = offset;
+    instr->size = wasm_get_interpreter_instruction_size(code + offset);
+    offset += instr->size;
+  }
+  if (instrs->size == 0 || !mark_branch_targets(ctx, code))
+    return WASM_OK;
+
+  thread_jumps(ctx, code);
+  /* a branch that was jumped over may no longer be a target */
+  mark_branch_targets(ctx, code);
+  inline_branches_to_return(ctx, code);
+  /* nor may the end of the function, once branches to it return instead */
+  mark_branch_targets(ctx, code);
+  fold_drop_keeps(ctx, code);
+  remove_dead_code(ctx, code);
+  remove_branches_to_next(ctx, code);
+
+  size_t i;
+  uint32_t new_offset = start;
+  WasmBool changed = WASM_FALSE;
+  for (i = 0; i < instrs->size; ++i) {
+    PeepholeInstr* instr = &instrs->data[i];
+    instr->new_offset = new_offset;
+    if (!instr->removed)
+      new_offset += get_peephole_instr_size(instr);
+    if (instr->removed || instr->replacement_size)
+      changed = WASM_TRUE;
+  }
+  if (!changed)
+    return WASM_OK;
+
+  uint32_t new_size = new_offset - start;
+  uint8_t* new_code = wasm_alloc(ctx->allocator, new_size, 1);
+  for (i = 0; i < instrs->size; ++i) {
+    PeepholeInstr* instr = &instrs->data[i];
+    if (!instr->removed) {
+      memcpy(new_code + (instr->new_offset - start),
+             get_peephole_instr_code(code, instr),
+             get_peephole_instr_size(instr));
+    }
+  }
+
+  /* a br_table's targets are in the data after it, so this is done once all
+   * of the code has been copied */
+  for (i = 0; i < instrs->size; ++i) {
+    PeepholeInstr* instr = &instrs->data[i];
+    if (instr->removed)
+      continue;
+    uint32_t operand_offset;
+    uint32_t j;
+    for (j = 0; get_branch_operand_offset(code, instr, j, &operand_offset);
+         ++j) {
+      PeepholeInstr* target =
+          find_peephole_instr(ctx, read_istream_u32(code, operand_offset));
+      PeepholeInstr* operand_instr = find_peephole_instr(ctx, operand_offset);
+      uint32_t new_operand_offset = operand_instr->new_offset +
+                                    (operand_offset - operand_instr->offset);
+      memcpy(new_code + (new_operand_offset - start), &target->new_offset,
+             sizeof(uint32_t));
+    }
+    if (code[instr->offset] == WASM_OPCODE_BR_TABLE) {
+      uint32_t table_offset =
+          read_istream_u32(code, instr->offset + 1 + sizeof(uint32_t));
+      PeepholeInstr* table = find_peephole_instr(ctx, table_offset);
+      uint32_t new_table_offset =
+          table->new_offset + (table_offset - table->offset);
+      memcpy(new_code + (instr->new_offset - start) + 1 + sizeof(uint32_t),
+             &new_table_offset, sizeof(uint32_t));
+    }
+  }
+
+  move_call_fixups(ctx, start);
+  WasmResult result = emit_data_at(ctx, start, new_code, new_size);
+  wasm_free(ctx->allocator, new_code);
+  CHECK_RESULT(result);
+  ctx->istream_offset = start + new_size;
+  func->defined.end_offset = ctx->istream_offset;
+  return WASM_OK;
+}
+
 static WasmResult end_function_body(uint32_t index, void* user_data) {
   Context* ctx = user_data;
   Label* label = top_label(ctx);
@@ -1202,7 +1980,7 @@ static WasmResult end_function_body(uint32_t index, void* user_data) {
 
   CHECK_RESULT(check_n_types(ctx, &label->sig, "implicit return"));
   CHECK_RESULT(check_type_stack_limit_exact(ctx, label->sig.size, "func"));
-  fixup_top_label(ctx, get_istream_offset(ctx));
+  fixup_top_label(ctx, get_branch_target_offset(ctx));
   if (top_type_is_any(ctx)) {
     /* if the top type is any it means that this code is unreachable, at least
      * from the normal fallthrough, though it's possible that this code was
@@ -1215,6 +1993,19 @@ static WasmResult end_function_body(uint32_t index, void* user_data) {
   CHECK_RESULT(drop_types_for_return(ctx, label->sig.size));
   CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_RETURN));
   pop_label(ctx);
+
+  WasmInterpreterFunc* func = ctx->current_func;
+  func->defined.end_offset = get_istream_offset(ctx);
+  WasmInterpreterFuncSignature* sig =
+      get_signature_by_env_index(ctx, func->sig_index);
+  func->defined.max_stack_height =
+      ctx->max_type_stack_size - sig->param_types.size;
+  CHECK_RESULT(emit_i32_at(ctx, get_alloca_operand_offset(func, 1),
+                           func->defined.max_stack_height));
+  CHECK_RESULT(
+      emit_i32_at(ctx, get_alloca_operand_offset(func, 3), ctx->fuel_cost));
+  if (ctx->optimize)
+    CHECK_RESULT(optimize_function(ctx, func));
   ctx->current_func = NULL;
   ctx->type_stack.size = 0;
   return WASM_OK;
@@ -1243,10 +2034,21 @@ static WasmResult on_local_decl(uint32_t decl_index,
     push_type(ctx, type);
   }
 
+  if (ctx->optimize) {
+    /* locals start out zeroed; only the integer ones are tracked */
+    uint32_t first = func->defined.param_and_local_types.size - count;
+    wasm_resize_known_local_vector(ctx->allocator, &ctx->known_locals,
+                                   func->defined.param_and_local_types.size);
+    if (type == WASM_TYPE_I32 || type == WASM_TYPE_I64) {
+      for (i = first; i < ctx->known_locals.size; ++i)
+        set_known_local(ctx, i, WASM_TRUE, 0);
+    }
+  }
+
   if (decl_index == func->defined.local_decl_count - 1) {
     /* last local declaration, allocate space for all locals. */
-    CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_ALLOCA));
-    CHECK_RESULT(emit_i32(ctx, func->defined.local_count));
+    CHECK_RESULT(emit_i32_at(ctx, get_alloca_operand_offset(func, 0),
+                             func->defined.local_count));
     /* fixup the function label's type_stack_limit to include these values. */
     Label* label = top_label(ctx);
     assert(label->label_type == LABEL_TYPE_FUNC);
@@ -1255,17 +2057,391 @@ static WasmResult on_local_decl(uint32_t decl_index,
   return WASM_OK;
 }
 
+/* The fold_* functions compute an integer operator on constant operands, the
+ * way the interpreter would. They return WASM_FALSE for any other operator,
+ * and for one that would trap, so that the trap still happens when the code
+ * runs. */
+
+static WasmBool fold_i32_binop(WasmOpcode opcode,
+                               uint32_t lhs,
+                               uint32_t rhs,
+                               uint32_t* out_result) {
+  uint32_t shift = rhs & 31;
+  switch (opcode) {
+    case WASM_OPCODE_I32_ADD:
+      *out_result = lhs + rhs;
+      break;
+    case WASM_OPCODE_I32_SUB:
+      *out_result = lhs - rhs;
+      break;
+    case WASM_OPCODE_I32_MUL:
+      *out_result = lhs * rhs;
+      break;
+    case WASM_OPCODE_I32_AND:
+      *out_result = lhs & rhs;
+      break;
+    case WASM_OPCODE_I32_OR:
+      *out_result = lhs | rhs;
+      break;
+    case WASM_OPCODE_I32_XOR:
+      *out_result = lhs ^ rhs;
+      break;
+    case WASM_OPCODE_I32_SHL:
+      *out_result = lhs << shift;
+      break;
+    case WASM_OPCODE_I32_SHR_U:
+      *out_result = lhs >> shift;
+      break;
+    case WASM_OPCODE_I32_SHR_S:
+      *out_result = (uint32_t)((int32_t)lhs >> shift);
+      break;
+    case WASM_OPCODE_I32_ROTL:
+      *out_result = (lhs << shift) | (lhs >> ((32 - shift) & 31));
+      break;
+    case WASM_OPCODE_I32_ROTR:
+      *out_result = (lhs >> shift) | (lhs << ((32 - shift) & 31));
+      break;
+    case WASM_OPCODE_I32_DIV_U:
+    case WASM_OPCODE_I32_REM_U:
+      if (rhs == 0)
+        return WASM_FALSE;
+      *out_result = opcode == WASM_OPCODE_I32_DIV_U ? lhs / rhs : lhs % rhs;
+      break;
+    case WASM_OPCODE_I32_DIV_S:
+      if (rhs == 0 || (lhs == 0x80000000U && rhs == UINT32_MAX))
+        return WASM_FALSE;
+      *out_result = (uint32_t)((int32_t)lhs / (int32_t)rhs);
+      break;
+    case WASM_OPCODE_I32_REM_S:
+      if (rhs == 0)
+        return WASM_FALSE;
+      /* INT32_MIN % -1 is 0, but overflows in C */
+      *out_result =
+          rhs == UINT32_MAX ? 0 : (uint32_t)((int32_t)lhs % (int32_t)rhs);
+      break;
+    case WASM_OPCODE_I32_EQ:
+      *out_result = lhs == rhs;
+      break;
+    case WASM_OPCODE_I32_NE:
+      *out_result = lhs != rhs;
+      break;
+    case WASM_OPCODE_I32_LT_U:
+      *out_result = lhs < rhs;
+      break;
+    case WASM_OPCODE_I32_LE_U:
+      *out_result = lhs <= rhs;
+      break;
+    case WASM_OPCODE_I32_GT_U:
+      *out_result = lhs > rhs;
+      break;
+    case WASM_OPCODE_I32_GE_U:
+      *out_result = lhs >= rhs;
+      break;
+    case WASM_OPCODE_I32_LT_S:
+      *out_result = (int32_t)lhs < (int32_t)rhs;
+      break;
+    case WASM_OPCODE_I32_LE_S:
+      *out_result = (int32_t)lhs <= (int32_t)rhs;
+      break;
+    case WASM_OPCODE_I32_GT_S:
+      *out_result = (int32_t)lhs > (int32_t)rhs;
+      break;
+    case WASM_OPCODE_I32_GE_S:
+      *out_result = (int32_t)lhs >= (int32_t)rhs;
+      break;
+    default:
+      return WASM_FALSE;
+  }
+  return WASM_TRUE;
+}
+
+/* comparisons produce an i32 0 or 1 */
+static WasmBool fold_i64_binop(WasmOpcode opcode,
+                               uint64_t lhs,
+                               uint64_t rhs,
+                               uint64_t* out_result) {
+  uint64_t shift = rhs & 63;
+  switch (opcode) {
+    case WASM_OPCODE_I64_ADD:
+      *out_result = lhs + rhs;
+      break;
+    case WASM_OPCODE_I64_SUB:
+      *out_result = lhs - rhs;
+      break;
+    case WASM_OPCODE_I64_MUL:
+      *out_result = lhs * rhs;
+      break;
+    case WASM_OPCODE_I64_AND:
+      *out_result = lhs & rhs;
+      break;
+    case WASM_OPCODE_I64_OR:
+      *out_result = lhs | rhs;
+      break;
+    case WASM_OPCODE_I64_XOR:
+      *out_result = lhs ^ rhs;
+      break;
+    case WASM_OPCODE_I64_SHL:
+      *out_result = lhs << shift;
+      break;
+    case WASM_OPCODE_I64_SHR_U:
+      *out_result = lhs >> shift;
+      break;
+    case WASM_OPCODE_I64_SHR_S:
+      *out_result = (uint64_t)((int64_t)lhs >> shift);
+      break;
+    case WASM_OPCODE_I64_ROTL:
+      *out_result = (lhs << shift) | (lhs >> ((64 - shift) & 63));
+      break;
+    case WASM_OPCODE_I64_ROTR:
+      *out_result = (lhs >> shift) | (lhs << ((64 - shift) & 63));
+      break;
+    case WASM_OPCODE_I64_DIV_U:
+    case WASM_OPCODE_I64_REM_U:
+      if (rhs == 0)
+        return WASM_FALSE;
+      *out_result = opcode == WASM_OPCODE_I64_DIV_U ? lhs / rhs : lhs % rhs;
+      break;
+    case WASM_OPCODE_I64_DIV_S:
+      if (rhs == 0 || (lhs == 0x8000000000000000ULL && rhs == UINT64_MAX))
+        return WASM_FALSE;
+      *out_result = (uint64_t)((int64_t)lhs / (int64_t)rhs);
+      break;
+    case WASM_OPCODE_I64_REM_S:
+      if (rhs == 0)
+        return WASM_FALSE;
+      *out_result =
+          rhs == UINT64_MAX ? 0 : (uint64_t)((int64_t)lhs % (int64_t)rhs);
+      break;
+    case WASM_OPCODE_I64_EQ:
+      *out_result = lhs == rhs;
+      break;
+    case WASM_OPCODE_I64_NE:
+      *out_result = lhs != rhs;
+      break;
+    case WASM_OPCODE_I64_LT_U:
+      *out_result = lhs < rhs;
+      break;
+    case WASM_OPCODE_I64_LE_U:
+      *out_result = lhs <= rhs;
+      break;
+    case WASM_OPCODE_I64_GT_U:
+      *out_result = lhs > rhs;
+      break;
+    case WASM_OPCODE_I64_GE_U:
+      *out_result = lhs >= rhs;
+      break;
+    case WASM_OPCODE_I64_LT_S:
+      *out_result = (int64_t)lhs < (int64_t)rhs;
+      break;
+    case WASM_OPCODE_I64_LE_S:
+      *out_result = (int64_t)lhs <= (int64_t)rhs;
+      break;
+    case WASM_OPCODE_I64_GT_S:
+      *out_result = (int64_t)lhs > (int64_t)rhs;
+      break;
+    case WASM_OPCODE_I64_GE_S:
+      *out_result = (int64_t)lhs >= (int64_t)rhs;
+      break;
+    default:
+      return WASM_FALSE;
+  }
+  return WASM_TRUE;
+}
+
+static WasmBool fold_unop(WasmOpcode opcode,
+                          uint64_t value,
+                          uint64_t* out_result) {
+  uint32_t value32 = (uint32_t)value;
+  switch (opcode) {
+    case WASM_OPCODE_I32_EQZ:
+      *out_result = value32 == 0;
+      break;
+    case WASM_OPCODE_I64_EQZ:
+      *out_result = value == 0;
+      break;
+    case WASM_OPCODE_I32_CLZ:
+      *out_result = value32 != 0 ? wasm_clz_u32(value32) : 32;
+      break;
+    case WASM_OPCODE_I32_CTZ:
+      *out_result = value32 != 0 ? wasm_ctz_u32(value32) : 32;
+      break;
+    case WASM_OPCODE_I32_POPCNT:
+      *out_result = wasm_popcount_u32(value32);
+      break;
+    case WASM_OPCODE_I64_CLZ:
+      *out_result = value != 0 ? wasm_clz_u64(value) : 64;
+      break;
+    case WASM_OPCODE_I64_CTZ:
+      *out_result = value != 0 ? wasm_ctz_u64(value) : 64;
+      break;
+    case WASM_OPCODE_I64_POPCNT:
+      *out_result = wasm_popcount_u64(value);
+      break;
+    case WASM_OPCODE_I32_WRAP_I64:
+      *out_result = value32;
+      break;
+    case WASM_OPCODE_I64_EXTEND_U_I32:
+      *out_result = value32;
+      break;
+    case WASM_OPCODE_I64_EXTEND_S_I32:
+      *out_result = (uint64_t)(int64_t)(int32_t)value32;
+      break;
+    default:
+      return WASM_FALSE;
+  }
+  return WASM_TRUE;
+}
+
+/* replaces the constant operands of |opcode|, which were the last
+ * instructions emitted, with a constant of the result. |opcode|'s result type
+ * must already be on the type stack. */
+static WasmResult fold_constants(Context* ctx,
+                                 WasmOpcode opcode,
+                                 uint32_t num_operands,
+                                 WasmBool* out_folded) {
+  RecentInstr* rhs = get_recent_instr(ctx, 0);
+  RecentInstr* lhs = get_recent_instr(ctx, 1);
+  uint64_t result;
+  WasmBool folded = WASM_FALSE;
+  *out_folded = WASM_FALSE;
+  if (!ctx->optimize || !is_const_instr(rhs))
+    return WASM_OK;
+  if (num_operands == 1) {
+    folded = fold_unop(opcode, rhs->operand, &result);
+  } else if (is_const_instr(lhs)) {
+    if (rhs->opcode == WASM_OPCODE_I32_CONST) {
+      uint32_t result32;
+      folded = fold_i32_binop(opcode, (uint32_t)lhs->operand,
+                              (uint32_t)rhs->operand, &result32);
+      result = result32;
+    } else {
+      folded = fold_i64_binop(opcode, lhs->operand, rhs->operand, &result);
+    }
+  }
+  if (!folded)
+    return WASM_OK;
+  rewind_recent_instrs(ctx, num_operands);
+  CHECK_RESULT(emit_const(ctx, top_type(ctx), result));
+  *out_folded = WASM_TRUE;
+  return WASM_OK;
+}
+
 static WasmResult on_unary_expr(WasmOpcode opcode, void* user_data) {
   Context* ctx = user_data;
   CHECK_RESULT(check_opcode1(ctx, opcode));
-  CHECK_RESULT(emit_opcode(ctx, opcode));
+  WasmBool folded;
+  CHECK_RESULT(fold_constants(ctx, opcode, 1, &folded));
+  if (!folded)
+    CHECK_RESULT(emit_opcode(ctx, opcode));
+  return WASM_OK;
+}
+
+static WasmResult emit_i32_add(Context* ctx) {
+  RecentInstr* rhs = get_recent_instr(ctx, 0);
+  RecentInstr* lhs = get_recent_instr(ctx, 1);
+  if (rhs && rhs->opcode == WASM_OPCODE_I32_CONST) {
+    uint32_t value = rhs->operand;
+    if (ctx->optimize && lhs &&
+        (uint32_t)lhs->opcode == WASM_OPCODE_I32_ADD_CONST) {
+      /* (x + a) + b is x + (a + b), so add both at once */
+      value += lhs->operand;
+      rewind_recent_instrs(ctx, 2);
+    } else {
+      rewind_recent_instrs(ctx, 1);
+    }
+    CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_I32_ADD_CONST));
+    CHECK_RESULT(emit_i32(ctx, value));
+    get_recent_instr(ctx, 0)->operand = value;
+  } else if (lhs && lhs->opcode == WASM_OPCODE_GET_LOCAL &&
+             rhs->opcode == WASM_OPCODE_GET_LOCAL) {
+    /* the rhs depth was relative to a stack that already had the lhs pushed;
+     * the fused instruction reads both locals before pushing anything */
+    uint32_t lhs_depth = lhs->operand;
+    uint32_t rhs_depth = rhs->operand - 1;
+    rewind_recent_instrs(ctx, 2);
+    CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_I32_ADD_LOCAL_LOCAL));
+    CHECK_RESULT(emit_i32(ctx, lhs_depth));
+    CHECK_RESULT(emit_i32(ctx, rhs_depth));
+  } else {
+    CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_I32_ADD));
+  }
+  return WASM_OK;
+}
+
+/* returns |opcode| itself if it has no register form */
+static uint32_t get_register_opcode(WasmOpcode opcode) {
+  switch (opcode) {
+#define V(NAME, kind, sign, op, text) \
+  case WASM_OPCODE_##NAME:            \
+    return WASM_OPCODE_REG_##NAME;
+    WASM_FOREACH_REGISTER_BINOP(V)
+#undef V
+    default:
+      return opcode;
+  }
+}
+
+static WasmBool is_register_opcode(WasmOpcode opcode) {
+  switch ((uint32_t)opcode) {
+#define V(NAME, kind, sign, op, text) case WASM_OPCODE_REG_##NAME:
+    WASM_FOREACH_REGISTER_BINOP(V)
+#undef V
+      return WASM_TRUE;
+    default:
+      return WASM_FALSE;
+  }
+}
+
+/* replaces the get_local for the rhs, and the lhs too if it is a get_local,
+ * with a register instruction that reads the locals in place. Any other lhs is
+ * a temporary on top of the value stack, which the instruction pops. The
+ * result is pushed unless on_set_local_expr retargets it. */
+static WasmResult emit_register_binop(Context* ctx, uint32_t reg_opcode) {
+  RecentInstr* rhs = get_recent_instr(ctx, 0);
+  RecentInstr* lhs = get_recent_instr(ctx, 1);
+  assert(rhs && rhs->opcode == WASM_OPCODE_GET_LOCAL);
+  uint32_t lhs_depth, rhs_depth;
+  uint8_t drop;
+  if (lhs && lhs->opcode == WASM_OPCODE_GET_LOCAL) {
+    lhs_depth = lhs->operand;
+    rhs_depth = rhs->operand - 1;
+    drop = 0;
+    rewind_recent_instrs(ctx, 2);
+  } else {
+    lhs_depth = 1;
+    rhs_depth = rhs->operand;
+    drop = 1;
+    rewind_recent_instrs(ctx, 1);
+  }
+  CHECK_RESULT(emit_opcode(ctx, reg_opcode));
+  CHECK_RESULT(emit_i32(ctx, 0));
+  CHECK_RESULT(emit_i32(ctx, lhs_depth));
+  CHECK_RESULT(emit_i32(ctx, rhs_depth));
+  CHECK_RESULT(emit_i8(ctx, drop));
   return WASM_OK;
 }
 
 static WasmResult on_binary_expr(WasmOpcode opcode, void* user_data) {
   Context* ctx = user_data;
   CHECK_RESULT(check_opcode2(ctx, opcode));
-  CHECK_RESULT(emit_opcode(ctx, opcode));
+  WasmBool folded;
+  CHECK_RESULT(fold_constants(ctx, opcode, 2, &folded));
+  if (folded)
+    return WASM_OK;
+  uint32_t reg_opcode = get_register_opcode(opcode);
+  RecentInstr* rhs = get_recent_instr(ctx, 0);
+  if (ctx->use_registers && reg_opcode != opcode && rhs &&
+      rhs->opcode == WASM_OPCODE_GET_LOCAL)
+    CHECK_RESULT(emit_register_binop(ctx, reg_opcode));
+  else if (opcode == WASM_OPCODE_I32_ADD)
+    CHECK_RESULT(emit_i32_add(ctx));
+  else if (ctx->optimize && opcode == WASM_OPCODE_I32_SUB && rhs &&
+           rhs->opcode == WASM_OPCODE_I32_CONST) {
+    /* x - c is x + -c, which can use i32.add_const */
+    rhs->operand = (uint32_t)(0 - (uint32_t)rhs->operand);
+    CHECK_RESULT(emit_i32_add(ctx));
+  } else
+    CHECK_RESULT(emit_opcode(ctx, opcode));
   return WASM_OK;
 }
 
@@ -1288,8 +2464,15 @@ static WasmResult on_loop_expr(uint32_t num_types,
   WasmTypeVector sig;
   sig.size = num_types;
   sig.data = sig_types;
-  push_label(ctx, LABEL_TYPE_LOOP, &sig, get_istream_offset(ctx),
+  uint32_t outer_fuel_cost = ctx->fuel_cost;
+  push_label(ctx, LABEL_TYPE_LOOP, &sig, get_branch_target_offset(ctx),
              WASM_INVALID_OFFSET);
+  top_label(ctx)->outer_fuel_cost = outer_fuel_cost;
+  /* every iteration branches back here, so this charges for each pass through
+   * the body. The cost is fixed up at the end of the loop. */
+  ctx->fuel_cost = 0;
+  CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_CHARGE_FUEL));
+  CHECK_RESULT(emit_i32(ctx, 0));
   return WASM_OK;
 }
 
@@ -1299,9 +2482,8 @@ static WasmResult on_if_expr(uint32_t num_types,
   Context* ctx = user_data;
   CHECK_RESULT(check_type_stack_limit(ctx, 1, "if"));
   CHECK_RESULT(pop_and_check_1_type(ctx, WASM_TYPE_I32, "if"));
-  CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_BR_UNLESS));
-  uint32_t fixup_offset = get_istream_offset(ctx);
-  CHECK_RESULT(emit_i32(ctx, WASM_INVALID_OFFSET));
+  uint32_t fixup_offset;
+  CHECK_RESULT(emit_br_unless(ctx, &fixup_offset));
 
   WasmTypeVector sig;
   sig.size = num_types;
@@ -1325,7 +2507,8 @@ static WasmResult on_else_expr(void* user_data) {
   CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_BR));
   label->fixup_offset = get_istream_offset(ctx);
   CHECK_RESULT(emit_i32(ctx, WASM_INVALID_OFFSET));
-  CHECK_RESULT(emit_i32_at(ctx, fixup_cond_offset, get_istream_offset(ctx)));
+  CHECK_RESULT(
+      emit_i32_at(ctx, fixup_cond_offset, get_branch_target_offset(ctx)));
   /* reset the type stack for the other branch arm */
   ctx->type_stack.size = label->type_stack_limit;
   return WASM_OK;
@@ -1345,8 +2528,8 @@ static WasmResult on_end_expr(void* user_data) {
     case LABEL_TYPE_ELSE:
       desc = (label->label_type == LABEL_TYPE_IF) ? "if true branch"
                                                   : "if false branch";
-      CHECK_RESULT(
-          emit_i32_at(ctx, label->fixup_offset, get_istream_offset(ctx)));
+      CHECK_RESULT(emit_i32_at(ctx, label->fixup_offset,
+                               get_branch_target_offset(ctx)));
       break;
 
     case LABEL_TYPE_BLOCK:
@@ -1355,6 +2538,9 @@ static WasmResult on_end_expr(void* user_data) {
 
     case LABEL_TYPE_LOOP:
       desc = "loop";
+      CHECK_RESULT(
+          emit_i32_at(ctx, label->offset + sizeof(uint8_t), ctx->fuel_cost));
+      ctx->fuel_cost = label->outer_fuel_cost;
       break;
 
     case LABEL_TYPE_FUNC:
@@ -1364,7 +2550,7 @@ static WasmResult on_end_expr(void* user_data) {
 
   CHECK_RESULT(check_n_types(ctx, &label->sig, desc));
   CHECK_RESULT(check_type_stack_limit_exact(ctx, label->sig.size, desc));
-  fixup_top_label(ctx, get_istream_offset(ctx));
+  fixup_top_label(ctx, get_branch_target_offset(ctx));
   reset_type_stack_to_limit(ctx);
   push_types(ctx, &label->sig);
   pop_label(ctx);
@@ -1389,12 +2575,21 @@ static WasmResult on_br_if_expr(uint32_t depth, void* user_data) {
   CHECK_DEPTH(ctx, depth);
   depth = translate_depth(ctx, depth);
   CHECK_RESULT(pop_and_check_1_type(ctx, WASM_TYPE_I32, "br_if"));
+  RecentInstr* cond = get_recent_instr(ctx, 0);
+  if (ctx->optimize && is_const_instr(cond)) {
+    /* the branch is either always or never taken */
+    uint64_t value = cond->operand;
+    rewind_recent_instrs(ctx, 1);
+    if (value != 0)
+      CHECK_RESULT(emit_br(ctx, depth));
+    return WASM_OK;
+  }
   /* flip the br_if so if <cond> is true it can drop values from the stack */
-  CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_BR_UNLESS));
-  uint32_t fixup_br_offset = get_istream_offset(ctx);
-  CHECK_RESULT(emit_i32(ctx, WASM_INVALID_OFFSET));
+  uint32_t fixup_br_offset;
+  CHECK_RESULT(emit_br_unless(ctx, &fixup_br_offset));
   CHECK_RESULT(emit_br(ctx, depth));
-  CHECK_RESULT(emit_i32_at(ctx, fixup_br_offset, get_istream_offset(ctx)));
+  CHECK_RESULT(
+      emit_i32_at(ctx, fixup_br_offset, get_branch_target_offset(ctx)));
   return WASM_OK;
 }
 
@@ -1428,6 +2623,143 @@ static WasmResult on_br_table_expr(WasmBinaryReaderContext* context,
   return WASM_OK;
 }
 
+/* adds |delta| to the istream offsets in |code|, which was translated as if
+ * it started at |code_offset|. Calls are left alone, since their operands are
+ * deferred fixups. */
+static void relocate_istream(uint8_t* code,
+                             uint32_t size,
+                             uint32_t code_offset,
+                             uint32_t delta) {
+  uint8_t* pc = code;
+  uint8_t* end = code + size;
+  while (pc < end) {
+    uint8_t* operands = pc + sizeof(uint8_t);
+    uint32_t value;
+    switch (*pc) {
+      case WASM_OPCODE_BR:
+      case WASM_OPCODE_BR_IF:
+      case WASM_OPCODE_BR_UNLESS:
+#define V(NAME, sign, op, text) case WASM_OPCODE_BR_UNLESS_##NAME:
+        WASM_FOREACH_BR_UNLESS_COMPARE(V)
+#undef V
+        memcpy(&value, operands, sizeof(value));
+        value += delta;
+        memcpy(operands, &value, sizeof(value));
+        break;
+
+      case WASM_OPCODE_BR_TABLE: {
+        uint32_t num_targets;
+        uint32_t table_offset;
+        memcpy(&num_targets, operands, sizeof(num_targets));
+        memcpy(&table_offset, operands + sizeof(uint32_t),
+               sizeof(table_offset));
+        /* the table is the DATA that follows; it is skipped below */
+        uint32_t i;
+        for (i = 0; i <= num_targets; ++i) {
+          uint8_t* entry = code + (table_offset - code_offset) +
+                           i * WASM_TABLE_ENTRY_SIZE +
+                           WASM_TABLE_ENTRY_OFFSET_OFFSET;
+          memcpy(&value, entry, sizeof(value));
+          value += delta;
+          memcpy(entry, &value, sizeof(value));
+        }
+        table_offset += delta;
+        memcpy(operands + sizeof(uint32_t), &table_offset,
+               sizeof(table_offset));
+        break;
+      }
+
+      default:
+        break;
+    }
+    pc += wasm_get_interpreter_instruction_size(pc);
+  }
+}
+
+/* returns the istream offset at which the body of |func| starts, after its
+ * ALLOCA */
+static uint32_t get_func_body_offset(WasmInterpreterFunc* func) {
+  return func->defined.offset + sizeof(uint8_t) + 4 * sizeof(uint32_t);
+}
+
+/* a call to |func_index| can be replaced by a copy of the callee's body if the
+ * callee is a small leaf function of this module that was already translated:
+ * the body's locals are addressed relative to the top of the value stack, so
+ * it runs the same way once the callee's locals are pushed after its args. */
+static WasmBool can_inline_call(Context* ctx,
+                                uint32_t func_index,
+                                WasmInterpreterFunc* func) {
+  /* a lazily translated callee may still be a stub */
+  if (!ctx->optimize || ctx->lazy || ctx->module->defined.lazy ||
+      ctx->defer_func_offsets || func->is_host ||
+      func_index < ctx->num_func_imports || func == ctx->current_func ||
+      func->defined.offset == WASM_INVALID_OFFSET)
+    return WASM_FALSE;
+
+  const uint8_t* code = ctx->istream_writer.buf.start;
+  uint32_t start = get_func_body_offset(func);
+  uint32_t end = func->defined.end_offset;
+  uint32_t local_count =
+      read_istream_u32(code, get_alloca_operand_offset(func, 0));
+  if (end <= start || code[end - 1] != WASM_OPCODE_RETURN ||
+      end - start > MAX_INLINE_FUNC_SIZE ||
+      local_count > MAX_INLINE_FUNC_LOCALS)
+    return WASM_FALSE;
+
+  uint32_t offset;
+  for (offset = start; offset < end - 1;) {
+    switch (code[offset]) {
+      case WASM_OPCODE_CALL:
+      case WASM_OPCODE_CALL_INDIRECT:
+      case WASM_OPCODE_CALL_INDIRECT_QUICKEN:
+      case WASM_OPCODE_CALL_HOST:
+      case WASM_OPCODE_RETURN:
+        return WASM_FALSE;
+
+      default:
+        break;
+    }
+    offset += wasm_get_interpreter_instruction_size(code + offset);
+  }
+  return WASM_TRUE;
+}
+
+/* emits the body of |func| in place of a call to it. Its args are already on
+ * the stack; its final DROP_KEEP leaves just the results there, so only the
+ * RETURN is left off. */
+static WasmResult emit_inlined_call(Context* ctx, WasmInterpreterFunc* func) {
+  const uint8_t* code = ctx->istream_writer.buf.start;
+  uint32_t start = get_func_body_offset(func);
+  uint32_t size = func->defined.end_offset - 1 - start;
+  uint32_t local_count =
+      read_istream_u32(code, get_alloca_operand_offset(func, 0));
+  uint32_t fuel_cost =
+      read_istream_u32(code, get_alloca_operand_offset(func, 3));
+  size_t stack_height = ctx->type_stack.size + func->defined.max_stack_height;
+  WasmInterpreterFuncSignature* sig =
+      get_signature_by_env_index(ctx, func->sig_index);
+  stack_height += sig->param_types.size;
+
+  uint32_t i;
+  for (i = 0; i < local_count; ++i)
+    CHECK_RESULT(emit_const(ctx, WASM_TYPE_I64, 0));
+
+  /* emitting may move the istream buffer, so the body is copied out first */
+  uint8_t* body = wasm_alloc(ctx->allocator, size, 1);
+  memcpy(body, code + start, size);
+  relocate_istream(body, size, start, get_istream_offset(ctx) - start);
+  WasmResult result = emit_data(ctx, body, size);
+  wasm_free(ctx->allocator, body);
+  CHECK_RESULT(result);
+
+  /* branches to the callee's RETURN now land here */
+  get_branch_target_offset(ctx);
+  ctx->fuel_cost += fuel_cost;
+  if (stack_height > ctx->max_type_stack_size)
+    ctx->max_type_stack_size = stack_height;
+  return WASM_OK;
+}
+
 static WasmResult on_call_expr(uint32_t func_index, void* user_data) {
   Context* ctx = user_data;
   WasmInterpreterFunc* func = get_func_by_module_index(ctx, func_index);
@@ -1444,6 +2776,8 @@ static WasmResult on_call_expr(uint32_t func_index, void* user_data) {
   if (func->is_host) {
     CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_CALL_HOST));
     CHECK_RESULT(emit_i32(ctx, translate_func_index_to_env(ctx, func_index)));
+  } else if (can_inline_call(ctx, func_index, func)) {
+    CHECK_RESULT(emit_inlined_call(ctx, func));
   } else {
     CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_CALL));
     CHECK_RESULT(emit_func_offset(ctx, func, func_index));
@@ -1468,9 +2802,19 @@ static WasmResult on_call_indirect_expr(uint32_t sig_index, void* user_data) {
         check_type(ctx, sig->param_types.data[i - 1], arg, "call_indirect"));
   }
 
-  CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_CALL_INDIRECT));
-  CHECK_RESULT(emit_i32(ctx, ctx->module->table_index));
-  CHECK_RESULT(emit_i32(ctx, translate_sig_index_to_env(ctx, sig_index)));
+  if (ctx->quicken) {
+    CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_CALL_INDIRECT_QUICKEN));
+    CHECK_RESULT(emit_i32(ctx, ctx->module->table_index));
+    CHECK_RESULT(emit_i32(ctx, translate_sig_index_to_env(ctx, sig_index)));
+    /* the cache, filled in by the interpreter */
+    CHECK_RESULT(emit_i32(ctx, WASM_INVALID_INDEX));
+    CHECK_RESULT(emit_i32(ctx, WASM_INVALID_INDEX));
+    CHECK_RESULT(emit_i64(ctx, 0));
+  } else {
+    CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_CALL_INDIRECT));
+    CHECK_RESULT(emit_i32(ctx, ctx->module->table_index));
+    CHECK_RESULT(emit_i32(ctx, translate_sig_index_to_env(ctx, sig_index)));
+  }
   push_types(ctx, &sig->result_types);
   return WASM_OK;
 }
@@ -1478,23 +2822,28 @@ static WasmResult on_call_indirect_expr(uint32_t sig_index, void* user_data) {
 static WasmResult on_drop_expr(void* user_data) {
   Context* ctx = user_data;
   CHECK_RESULT(check_type_stack_limit(ctx, 1, "drop"));
-  CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_DROP));
+  RecentInstr* value = get_recent_instr(ctx, 0);
+  if (ctx->optimize && value && (is_const_instr(value) ||
+                                 value->opcode == WASM_OPCODE_GET_LOCAL)) {
+    /* the value has no side effects, so it needn't be pushed at all */
+    rewind_recent_instrs(ctx, 1);
+  } else {
+    CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_DROP));
+  }
   pop_type(ctx);
   return WASM_OK;
 }
 
 static WasmResult on_i32_const_expr(uint32_t value, void* user_data) {
   Context* ctx = user_data;
-  CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_I32_CONST));
-  CHECK_RESULT(emit_i32(ctx, value));
+  CHECK_RESULT(emit_const(ctx, WASM_TYPE_I32, value));
   push_type(ctx, WASM_TYPE_I32);
   return WASM_OK;
 }
 
 static WasmResult on_i64_const_expr(uint64_t value, void* user_data) {
   Context* ctx = user_data;
-  CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_I64_CONST));
-  CHECK_RESULT(emit_i64(ctx, value));
+  CHECK_RESULT(emit_const(ctx, WASM_TYPE_I64, value));
   push_type(ctx, WASM_TYPE_I64);
   return WASM_OK;
 }
@@ -1545,17 +2894,45 @@ static WasmResult on_get_local_expr(uint32_t local_index, void* user_data) {
   Context* ctx = user_data;
   CHECK_LOCAL(ctx, local_index);
   WasmType type = get_local_type_by_index(ctx->current_func, local_index);
-  CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_GET_LOCAL));
-  CHECK_RESULT(emit_i32(ctx, translate_local_index(ctx, local_index)));
+  uint32_t depth = translate_local_index(ctx, local_index);
+  uint64_t value;
+  if (get_known_local(ctx, local_index, &value)) {
+    CHECK_RESULT(emit_const(ctx, type, value));
+  } else {
+    CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_GET_LOCAL));
+    CHECK_RESULT(emit_i32(ctx, depth));
+    get_recent_instr(ctx, 0)->operand = depth;
+  }
   push_type(ctx, type);
   return WASM_OK;
 }
 
+/* remembers the value that set_local or tee_local writes to |local_index|, if
+ * it is a constant */
+static void update_known_local(Context* ctx, uint32_t local_index) {
+  RecentInstr* value = get_recent_instr(ctx, 0);
+  if (is_const_instr(value))
+    set_known_local(ctx, local_index, WASM_TRUE, value->operand);
+  else
+    set_known_local(ctx, local_index, WASM_FALSE, 0);
+}
+
 static WasmResult on_set_local_expr(uint32_t local_index, void* user_data) {
   Context* ctx = user_data;
   CHECK_LOCAL(ctx, local_index);
   WasmType type = get_local_type_by_index(ctx->current_func, local_index);
   CHECK_RESULT(pop_and_check_1_type(ctx, type, "set_local"));
+  update_known_local(ctx, local_index);
+  RecentInstr* value = get_recent_instr(ctx, 0);
+  if (value && is_register_opcode(value->opcode)) {
+    /* write the result straight to the local instead of pushing it. The
+     * window is cleared so the instruction isn't mistaken for one that pushes
+     * a value */
+    CHECK_RESULT(emit_i32_at(ctx, value->offset + sizeof(uint8_t),
+                             translate_local_index(ctx, local_index)));
+    ctx->num_recent_instrs = 0;
+    return WASM_OK;
+  }
   CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_SET_LOCAL));
   CHECK_RESULT(emit_i32(ctx, translate_local_index(ctx, local_index)));
   return WASM_OK;
@@ -1568,6 +2945,7 @@ static WasmResult on_tee_local_expr(uint32_t local_index, void* user_data) {
   CHECK_RESULT(check_type_stack_limit(ctx, 1, "tee_local"));
   WasmType value = top_type(ctx);
   CHECK_RESULT(check_type(ctx, type, value, "tee_local"));
+  update_known_local(ctx, local_index);
   CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_TEE_LOCAL));
   CHECK_RESULT(emit_i32(ctx, translate_local_index(ctx, local_index)));
   return WASM_OK;
@@ -1582,14 +2960,55 @@ static WasmResult on_grow_memory_expr(void* user_data) {
   return WASM_OK;
 }
 
+/* returns |opcode| itself if it has no memory 0 form */
+static uint32_t get_memory0_opcode(WasmOpcode opcode) {
+  switch (opcode) {
+#define V(NAME, type, mem_type, text) \
+  case WASM_OPCODE_##NAME:            \
+    return WASM_OPCODE_##NAME##_MEM0;
+    WASM_FOREACH_MEMORY0_LOAD(V)
+    WASM_FOREACH_MEMORY0_STORE(V)
+#undef V
+    default:
+      return opcode;
+  }
+}
+
+/* emits a load or store of the module's memory, without its static offset.
+ * The memory 0 form has no memory index operand. */
+static WasmResult emit_memory_opcode(Context* ctx, WasmOpcode opcode) {
+  uint32_t memory0_opcode = get_memory0_opcode(opcode);
+  if (ctx->module->memory_index == 0 && memory0_opcode != opcode)
+    return emit_opcode(ctx, memory0_opcode);
+  CHECK_RESULT(emit_opcode(ctx, opcode));
+  return emit_i32(ctx, ctx->module->memory_index);
+}
+
 static WasmResult on_load_expr(WasmOpcode opcode,
                                uint32_t alignment_log2,
                                uint32_t offset,
                                void* user_data) {
   Context* ctx = user_data;
   CHECK_RESULT(check_opcode1(ctx, opcode));
-  CHECK_RESULT(emit_opcode(ctx, opcode));
-  CHECK_RESULT(emit_i32(ctx, ctx->module->memory_index));
+  RecentInstr* addr = get_recent_instr(ctx, 0);
+  if (opcode == WASM_OPCODE_I32_LOAD && addr &&
+      addr->opcode == WASM_OPCODE_GET_LOCAL) {
+    uint32_t depth = addr->operand;
+    rewind_recent_instrs(ctx, 1);
+    CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_I32_LOAD_LOCAL));
+    CHECK_RESULT(emit_i32(ctx, ctx->module->memory_index));
+    CHECK_RESULT(emit_i32(ctx, depth));
+  } else if (ctx->optimize && opcode == WASM_OPCODE_I32_LOAD && addr &&
+             addr->opcode == WASM_OPCODE_I32_CONST &&
+             addr->operand + offset <= UINT32_MAX) {
+    /* the static offset becomes the whole address */
+    offset += (uint32_t)addr->operand;
+    rewind_recent_instrs(ctx, 1);
+    CHECK_RESULT(emit_opcode(ctx, WASM_OPCODE_I32_LOAD_CONST));
+    CHECK_RESULT(emit_i32(ctx, ctx->module->memory_index));
+  } else {
+    CHECK_RESULT(emit_memory_opcode(ctx, opcode));
+  }
   CHECK_RESULT(emit_i32(ctx, offset));
   return WASM_OK;
 }
@@ -1600,8 +3019,7 @@ static WasmResult on_store_expr(WasmOpcode opcode,
                                 void* user_data) {
   Context* ctx = user_data;
   CHECK_RESULT(check_opcode2(ctx, opcode));
-  CHECK_RESULT(emit_opcode(ctx, opcode));
-  CHECK_RESULT(emit_i32(ctx, ctx->module->memory_index));
+  CHECK_RESULT(emit_memory_opcode(ctx, opcode));
   CHECK_RESULT(emit_i32(ctx, offset));
   return WASM_OK;
 }
@@ -1680,6 +3098,7 @@ static WasmBinaryReader s_binary_reader = {
     .on_start_function = on_start_function,
 
     .begin_function_body = begin_function_body,
+    .on_skipped_function_body = on_skipped_function_body,
     .on_local_decl_count = on_local_decl_count,
     .on_local_decl = on_local_decl,
     .on_binary_expr = on_binary_expr,
@@ -1728,26 +3147,694 @@ static WasmBinaryReader s_binary_reader = {
     .on_init_expr_i64_const_expr = on_init_expr_i64_const_expr,
 };
 
-static void destroy_context(Context* ctx) {
+/* adds the memories, tables and globals that were added to the environment's
+ * instance by the module just read to the instance template, as they are
+ * before any of the module's code has run */
+static void extend_instance_template(Context* ctx) {
+  WasmInterpreterInstance* instance = &ctx->env->instance;
+  WasmInterpreterInstanceTemplate* template_ = &ctx->env->instance_template;
+  size_t i;
+  for (i = template_->memory_limits.size; i < instance->memories.size; ++i) {
+    wasm_append_limits_value(ctx->allocator, &template_->memory_limits,
+                             &instance->memories.data[i].page_limits);
+  }
+  for (i = template_->table_limits.size; i < instance->tables.size; ++i) {
+    wasm_append_limits_value(ctx->allocator, &template_->table_limits,
+                             &instance->tables.data[i].limits);
+  }
+  for (i = template_->globals.size; i < instance->globals.size; ++i) {
+    wasm_append_interpreter_global_value(ctx->allocator, &template_->globals,
+                                         &instance->globals.data[i]);
+  }
+}
+
+/* destroys what the Context uses to translate a function body */
+static void destroy_function_body_context(Context* ctx) {
+  /* labels are left over if a body failed */
+  while (ctx->label_stack.size > 0)
+    pop_label(ctx);
   wasm_destroy_type_vector(ctx->allocator, &ctx->type_stack);
   wasm_destroy_label_vector(ctx->allocator, &ctx->label_stack);
   WASM_DESTROY_VECTOR_AND_ELEMENTS(ctx->allocator, ctx->depth_fixups,
                                    uint32_vector);
+  wasm_destroy_func_fixup_vector(ctx->allocator, &ctx->deferred_func_fixups);
+  wasm_destroy_peephole_instr_vector(ctx->allocator, &ctx->peephole_instrs);
+  wasm_destroy_known_local_vector(ctx->allocator, &ctx->known_locals);
+  wasm_destroy_uint32_vector(ctx->allocator, &ctx->body_func_fixup_indexes);
+}
+
+static void destroy_context(Context* ctx) {
+  destroy_function_body_context(ctx);
   WASM_DESTROY_VECTOR_AND_ELEMENTS(ctx->allocator, ctx->func_fixups,
                                    uint32_vector);
   wasm_destroy_uint32_vector(ctx->allocator, &ctx->sig_index_mapping);
   wasm_destroy_uint32_vector(ctx->allocator, &ctx->func_index_mapping);
   wasm_destroy_uint32_vector(ctx->allocator, &ctx->global_index_mapping);
+  wasm_destroy_uint32_vector(ctx->allocator, &ctx->body_offsets);
 }
 
-WasmResult wasm_read_binary_interpreter(WasmAllocator* allocator,
-                                        WasmAllocator* memory_allocator,
-                                        WasmInterpreterEnvironment* env,
+#if WASM_INTERPRETER_SCHEDULER
+/* each thread translates about this many chunks, so one that finishes early
+ * can take over work from the others */
+#define CHUNKS_PER_TRANSLATE_THREAD 4
+
+typedef struct TranslateError {
+  uint32_t offset;
+  WasmStringSlice message;
+} TranslateError;
+WASM_DEFINE_VECTOR(translate_error, TranslateError);
+
+/* A run of consecutive function bodies that one thread translates into a
+ * buffer of its own, as if the buffer were the start of the istream. */
+typedef struct TranslateChunk {
+  uint32_t first_index; /* defined function indexes */
+  uint32_t end_index;
+  Context ctx;
+  WasmBinaryErrorHandler error_handler;
+  /* reported, in order, if this is the first chunk that fails */
+  TranslateErrorVector errors;
+  WasmResult result;
+} TranslateChunk;
+
+typedef struct ParallelTranslation {
+  Context* ctx; /* of the module being read */
+  const void* data;
+  size_t size;
+  TranslateChunk* chunks;
+  uint32_t num_chunks;
+  uint32_t next_chunk;
+  pthread_mutex_t mutex;
+} ParallelTranslation;
+
+static void record_translate_error(uint32_t offset,
+                                   const char* message,
+                                   void* user_data) {
+  TranslateChunk* chunk = user_data;
+  TranslateError* error =
+      wasm_append_translate_error(chunk->ctx.allocator, &chunk->errors);
+  error->offset = offset;
+  error->message.length = strlen(message);
+  error->message.start =
+      wasm_strndup(chunk->ctx.allocator, message, error->message.length);
+}
+
+static void translate_chunk(ParallelTranslation* translation,
+                            TranslateChunk* chunk) {
+  Context* module_ctx = translation->ctx;
+  Context* ctx = &chunk->ctx;
+  WasmBinaryReader reader = s_binary_reader;
+  reader.user_data = ctx;
+  chunk->error_handler.on_error = record_translate_error;
+  chunk->error_handler.user_data = chunk;
+
+  ctx->allocator = module_ctx->allocator;
+  ctx->reader = &reader;
+  ctx->error_handler = &chunk->error_handler;
+  ctx->env = module_ctx->env;
+  ctx->module = module_ctx->module;
+  ctx->use_registers = module_ctx->use_registers;
+  ctx->optimize = module_ctx->optimize;
+  ctx->quicken = module_ctx->quicken;
+  ctx->sig_index_mapping = module_ctx->sig_index_mapping;
+  ctx->func_index_mapping = module_ctx->func_index_mapping;
+  ctx->global_index_mapping = module_ctx->global_index_mapping;
+  ctx->num_func_imports = module_ctx->num_func_imports;
+  ctx->num_global_imports = module_ctx->num_global_imports;
+  ctx->defer_func_offsets = WASM_TRUE;
+  wasm_init_mem_writer(ctx->allocator, &ctx->istream_writer);
+
+  WasmReadBinaryOptions options = WASM_READ_BINARY_OPTIONS_DEFAULT;
+  uint32_t i;
+  chunk->result = WASM_OK;
+  for (i = chunk->first_index; i < chunk->end_index; ++i) {
+    chunk->result = wasm_read_binary_function_body(
+        ctx->allocator, translation->data, translation->size,
+        module_ctx->body_offsets.data[i], i, ctx->func_index_mapping.size,
+        ctx->sig_index_mapping.size, &reader, &options);
+    if (WASM_FAILED(chunk->result))
+      break;
+  }
+  ctx->reader = NULL;
+}
+
+static void* run_translate_thread(void* user_data) {
+  ParallelTranslation* translation = user_data;
+  while (WASM_TRUE) {
+    pthread_mutex_lock(&translation->mutex);
+    uint32_t chunk_index = translation->next_chunk;
+    if (chunk_index < translation->num_chunks)
+      translation->next_chunk++;
+    pthread_mutex_unlock(&translation->mutex);
+    if (chunk_index >= translation->num_chunks)
+      break;
+    translate_chunk(translation, &translation->chunks[chunk_index]);
+  }
+  return NULL;
+}
+
+/* translates the bodies that were skipped while reading the module on
+ * |num_threads| threads, then appends them to the istream in order. The
+ * result is the same as translating them one at a time. */
+static WasmResult translate_function_bodies_in_parallel(Context* ctx,
+                                                        const void* data,
+                                                        size_t size,
+                                                        uint32_t num_threads) {
+  uint32_t num_bodies = ctx->body_offsets.size;
+  if (num_bodies == 0)
+    return WASM_OK;
+
+  ParallelTranslation translation;
+  WASM_ZERO_MEMORY(translation);
+  translation.ctx = ctx;
+  translation.data = data;
+  translation.size = size;
+  translation.num_chunks = num_threads * CHUNKS_PER_TRANSLATE_THREAD;
+  if (translation.num_chunks > num_bodies)
+    translation.num_chunks = num_bodies;
+  translation.chunks =
+      wasm_alloc_zero(ctx->allocator,
+                      translation.num_chunks * sizeof(TranslateChunk),
+                      WASM_DEFAULT_ALIGN);
+  pthread_mutex_init(&translation.mutex, NULL);
+
+  /* split the bodies into chunks of about the same number of bytes */
+  uint32_t first_offset = ctx->body_offsets.data[0];
+  uint64_t total_size = ctx->body_offsets.data[num_bodies - 1] - first_offset;
+  uint32_t i;
+  uint32_t index = 0;
+  for (i = 0; i < translation.num_chunks; ++i) {
+    TranslateChunk* chunk = &translation.chunks[i];
+    uint64_t chunk_end =
+        first_offset + total_size * (i + 1) / translation.num_chunks;
+    uint32_t bodies_left = num_bodies - index;
+    uint32_t chunks_left = translation.num_chunks - i;
+    chunk->first_index = index;
+    /* every chunk gets at least one body, and the last one gets the rest */
+    do {
+      ++index;
+    } while (bodies_left - (index - chunk->first_index) >= chunks_left &&
+             (i + 1 < translation.num_chunks
+                  ? ctx->body_offsets.data[index] < chunk_end
+                  : index < num_bodies));
+    chunk->end_index = index;
+  }
+
+  if (num_threads > translation.num_chunks)
+    num_threads = translation.num_chunks;
+  pthread_t* threads = wasm_alloc_zero(
+      ctx->allocator, num_threads * sizeof(pthread_t), WASM_DEFAULT_ALIGN);
+  uint32_t num_started = 0;
+  /* this thread is one of them */
+  for (i = 1; i < num_threads; ++i) {
+    if (pthread_create(&threads[num_started], NULL, run_translate_thread,
+                       &translation) == 0) {
+      num_started++;
+    }
+  }
+  run_translate_thread(&translation);
+  for (i = 0; i < num_started; ++i)
+    pthread_join(threads[i], NULL);
+  wasm_free(ctx->allocator, threads);
+  pthread_mutex_destroy(&translation.mutex);
+
+  /* append the chunks in order, moving their offsets to where they end up */
+  WasmResult result = WASM_OK;
+  for (i = 0; i < translation.num_chunks; ++i) {
+    TranslateChunk* chunk = &translation.chunks[i];
+    if (WASM_FAILED(chunk->result)) {
+      size_t j;
+      for (j = 0; j < chunk->errors.size; ++j) {
+        TranslateError* error = &chunk->errors.data[j];
+        handle_error(error->offset, error->message.start, ctx);
+      }
+      result = WASM_ERROR;
+      break;
+    }
+
+    uint32_t base = get_istream_offset(ctx);
+    Context* chunk_ctx = &chunk->ctx;
+    uint8_t* code = chunk_ctx->istream_writer.buf.start;
+    relocate_istream(code, chunk_ctx->istream_offset, 0, base);
+    result = emit_data(ctx, code, chunk_ctx->istream_offset);
+    if (WASM_FAILED(result))
+      break;
+    uint32_t j;
+    for (j = chunk->first_index; j < chunk->end_index; ++j) {
+      WasmInterpreterFunc* func = get_func_by_defined_index(ctx, j);
+      func->defined.offset += base;
+      func->defined.end_offset += base;
+    }
+    for (j = 0; j < chunk_ctx->deferred_func_fixups.size; ++j)
+      chunk_ctx->deferred_func_fixups.data[j].offset += base;
+  }
+
+  /* now every callee's offset is known */
+  if (WASM_SUCCEEDED(result)) {
+    for (i = 0; i < translation.num_chunks; ++i) {
+      FuncFixupVector* fixups = &translation.chunks[i].ctx.deferred_func_fixups;
+      size_t j;
+      for (j = 0; j < fixups->size; ++j) {
+        WasmInterpreterFunc* callee =
+            &ctx->env->funcs.data[fixups->data[j].func_index];
+        CHECK_RESULT(
+            emit_i32_at(ctx, fixups->data[j].offset, callee->defined.offset));
+      }
+    }
+  }
+
+  for (i = 0; i < translation.num_chunks; ++i) {
+    TranslateChunk* chunk = &translation.chunks[i];
+    if (chunk->ctx.allocator) {
+      wasm_close_mem_writer(&chunk->ctx.istream_writer);
+      destroy_function_body_context(&chunk->ctx);
+    }
+    size_t j;
+    for (j = 0; j < chunk->errors.size; ++j)
+      wasm_destroy_string_slice(ctx->allocator, &chunk->errors.data[j].message);
+    wasm_destroy_translate_error_vector(ctx->allocator, &chunk->errors);
+  }
+  wasm_free(ctx->allocator, translation.chunks);
+  return result;
+}
+#endif
+
+#define ISTREAM_CACHE_MAGIC "wasmistr"
+#define ISTREAM_CACHE_USE_REGISTERS 1
+#define ISTREAM_CACHE_OPTIMIZE 2
+#define ISTREAM_CACHE_QUICKEN 4
+
+/* The file that the translated code of a module is cached in. The header is
+ * followed by the arrays whose sizes it gives, in this order:
+ *
+ *   uint32_t sig_index_mapping[num_sigs];
+ *   uint32_t func_index_mapping[num_funcs];
+ *   uint32_t import_offsets[num_func_imports]; (WASM_INVALID_OFFSET for host
+ *                                               functions)
+ *   uint32_t global_index_mapping[num_globals];
+ *   IstreamCacheFunc funcs[num_funcs - num_func_imports];
+ *   int32_t types[num_types]; (the funcs' param_and_local_types, in order)
+ *   uint8_t istream[istream_size];
+ *   uint8_t module[module_size]; (the bytes of the module, since equal
+ *                                 hashes don't make equal modules)
+ *
+ * The istream has environment indexes and absolute offsets in it, so
+ * everything outside of the module that it depends on is recorded as well,
+ * and the file is only used if reading the rest of the module again gives
+ * the same values. */
+typedef struct IstreamCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t module_hash;
+  uint64_t module_size;
+  uint32_t istream_start;
+  uint32_t istream_size;
+  uint32_t memory_index;
+  uint32_t table_index;
+  uint32_t num_sigs;
+  uint32_t num_funcs;
+  uint32_t num_func_imports;
+  uint32_t num_globals;
+  uint32_t num_types;
+  uint32_t padding;
+} IstreamCacheHeader;
+
+typedef struct IstreamCacheFunc {
+  uint32_t offset;
+  uint32_t end_offset;
+  uint32_t local_decl_count;
+  uint32_t local_count;
+  uint32_t max_stack_height;
+  uint32_t num_types;
+} IstreamCacheFunc;
+
+typedef struct IstreamCache {
+  char* path;
+  const void* module_data;
+  uint64_t module_hash;
+  uint64_t module_size;
+  uint32_t flags;
+  /* the file at |path|, mapped read-only, if it has the right key */
+  const IstreamCacheHeader* image;
+  size_t image_size;
+  /* set once the module's code has been taken from |image| */
+  WasmBool hit;
+} IstreamCache;
+
+#if HAVE_SYS_MMAN_H && HAVE_UNISTD_H
+static uint64_t hash_module(const void* data, size_t size) {
+  /* FNV-1a hash */
+  const uint8_t* p = data;
+  uint64_t hash = 14695981039346656037ULL;
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    hash ^= p[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static void init_istream_cache(WasmAllocator* allocator,
+                               IstreamCache* cache,
+                               const WasmReadBinaryInterpreterOptions* options,
+                               const void* data,
+                               size_t size) {
+  WASM_ZERO_MEMORY(*cache);
+  cache->module_data = data;
+  cache->module_hash = hash_module(data, size);
+  cache->module_size = size;
+  if (options->use_registers)
+    cache->flags |= ISTREAM_CACHE_USE_REGISTERS;
+  if (options->optimize)
+    cache->flags |= ISTREAM_CACHE_OPTIMIZE;
+  if (options->quicken)
+    cache->flags |= ISTREAM_CACHE_QUICKEN;
+
+  const char* format = "%s/%016" PRIx64 "-%u-%u.istream";
+  int length = wasm_snprintf(NULL, 0, format, options->cache_dir,
+                             cache->module_hash,
+                             WASM_INTERPRETER_ISTREAM_VERSION, cache->flags);
+  cache->path = wasm_alloc(allocator, length + 1, 1);
+  wasm_snprintf(cache->path, length + 1, format, options->cache_dir,
+                cache->module_hash, WASM_INTERPRETER_ISTREAM_VERSION,
+                cache->flags);
+}
+
+static size_t get_istream_cache_image_size(const IstreamCacheHeader* header) {
+  uint64_t num_bodies = header->num_funcs - header->num_func_imports;
+  return sizeof(IstreamCacheHeader) +
+         ((uint64_t)header->num_sigs + header->num_funcs +
+          header->num_func_imports + header->num_globals) *
+             sizeof(uint32_t) +
+         num_bodies * sizeof(IstreamCacheFunc) +
+         (uint64_t)header->num_types * sizeof(int32_t) + header->istream_size +
+         header->module_size;
+}
+
+static void map_istream_cache(IstreamCache* cache) {
+  int fd = open(cache->path, O_RDONLY);
+  if (fd == -1)
+    return;
+
+  struct stat st;
+  void* image = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(IstreamCacheHeader))
+    image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED)
+    return;
+
+  const IstreamCacheHeader* header = image;
+  if (memcmp(header->magic, ISTREAM_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != WASM_INTERPRETER_ISTREAM_VERSION ||
+      header->flags != cache->flags ||
+      header->module_hash != cache->module_hash ||
+      header->module_size != cache->module_size ||
+      header->num_func_imports > header->num_funcs ||
+      get_istream_cache_image_size(header) != (size_t)st.st_size ||
+      memcmp((const uint8_t*)image + st.st_size - cache->module_size,
+             cache->module_data, cache->module_size) != 0) {
+    munmap(image, st.st_size);
+    return;
+  }
+  cache->image = header;
+  cache->image_size = st.st_size;
+}
+
+static void unmap_istream_cache(IstreamCache* cache) {
+  if (cache->image) {
+    munmap((void*)cache->image, cache->image_size);
+    cache->image = NULL;
+  }
+}
+
+static void destroy_istream_cache(WasmAllocator* allocator,
+                                  IstreamCache* cache) {
+  unmap_istream_cache(cache);
+  wasm_free(allocator, cache->path);
+}
+
+static WasmBool uint32_vector_equals(const Uint32Vector* vec,
+                                     const uint32_t* data,
+                                     uint32_t size) {
+  return vec->size == size &&
+         memcmp(vec->data, data, size * sizeof(uint32_t)) == 0;
+}
+
+static uint32_t get_import_offset(Context* ctx, uint32_t index) {
+  WasmInterpreterFunc* func =
+      &ctx->env->funcs.data[ctx->func_index_mapping.data[index]];
+  return func->is_host ? WASM_INVALID_OFFSET : func->defined.offset;
+}
+
+/* called once the module has been read without its function bodies; emits
+ * their code from the cache if it was made with the same mappings. Returns
+ * WASM_FALSE if the cache can't be used, leaving the functions as they were. */
+static WasmBool use_istream_cache(Context* ctx, const IstreamCache* cache) {
+  const IstreamCacheHeader* header = cache->image;
+  uint32_t num_bodies = header->num_funcs - header->num_func_imports;
+  if (header->istream_start != ctx->istream_offset ||
+      header->memory_index != ctx->module->memory_index ||
+      header->table_index != ctx->module->table_index ||
+      header->num_func_imports != ctx->num_func_imports ||
+      num_bodies != ctx->body_offsets.size) {
+    return WASM_FALSE;
+  }
+
+  const uint32_t* sig_index_mapping = (const uint32_t*)(header + 1);
+  const uint32_t* func_index_mapping = sig_index_mapping + header->num_sigs;
+  const uint32_t* import_offsets = func_index_mapping + header->num_funcs;
+  const uint32_t* global_index_mapping =
+      import_offsets + header->num_func_imports;
+  const IstreamCacheFunc* funcs =
+      (const IstreamCacheFunc*)(global_index_mapping + header->num_globals);
+  const int32_t* types = (const int32_t*)(funcs + num_bodies);
+  const uint8_t* istream = (const uint8_t*)(types + header->num_types);
+
+  if (!uint32_vector_equals(&ctx->sig_index_mapping, sig_index_mapping,
+                            header->num_sigs) ||
+      !uint32_vector_equals(&ctx->func_index_mapping, func_index_mapping,
+                            header->num_funcs) ||
+      !uint32_vector_equals(&ctx->global_index_mapping, global_index_mapping,
+                            header->num_globals)) {
+    return WASM_FALSE;
+  }
+
+  uint32_t i;
+  for (i = 0; i < header->num_func_imports; ++i) {
+    if (get_import_offset(ctx, i) != import_offsets[i])
+      return WASM_FALSE;
+  }
+
+  /* don't trust the file further than it is big */
+  uint64_t istream_end = (uint64_t)header->istream_start + header->istream_size;
+  uint64_t num_types = 0;
+  for (i = 0; i < num_bodies; ++i) {
+    if (funcs[i].offset < header->istream_start ||
+        funcs[i].offset > funcs[i].end_offset ||
+        funcs[i].end_offset > istream_end) {
+      return WASM_FALSE;
+    }
+    num_types += funcs[i].num_types;
+  }
+  if (num_types != header->num_types)
+    return WASM_FALSE;
+
+  if (WASM_FAILED(emit_data(ctx, istream, header->istream_size)))
+    return WASM_FALSE;
+
+  for (i = 0; i < num_bodies; ++i) {
+    WasmInterpreterFunc* func = get_func_by_defined_index(ctx, i);
+    const IstreamCacheFunc* cached = &funcs[i];
+    func->defined.offset = cached->offset;
+    func->defined.end_offset = cached->end_offset;
+    func->defined.local_decl_count = cached->local_decl_count;
+    func->defined.local_count = cached->local_count;
+    func->defined.max_stack_height = cached->max_stack_height;
+    func->defined.call_count = 0;
+    func->defined.jit_code = NULL;
+    uint32_t j;
+    for (j = 0; j < cached->num_types; ++j) {
+      WasmType type = *types++;
+      wasm_append_type_value(ctx->allocator,
+                             &func->defined.param_and_local_types, &type);
+    }
+  }
+  return WASM_TRUE;
+}
+
+static void write_uint32s(FILE* file, const uint32_t* data, size_t size) {
+  fwrite(data, sizeof(uint32_t), size, file);
+}
+
+/* writes the module that was just translated to the cache. This is best
+ * effort: if the file can't be written, the next read just translates the
+ * module again. The file is written elsewhere first and renamed into place,
+ * so readers in other processes never see part of one. */
+static void write_istream_cache(Context* ctx, const IstreamCache* cache) {
+  WasmInterpreterModule* module = ctx->module;
+  uint32_t num_bodies = ctx->func_index_mapping.size - ctx->num_func_imports;
+  if (num_bodies == 0)
+    return;
+
+  IstreamCacheHeader header;
+  WASM_ZERO_MEMORY(header);
+  memcpy(header.magic, ISTREAM_CACHE_MAGIC, sizeof(header.magic));
+  header.version = WASM_INTERPRETER_ISTREAM_VERSION;
+  header.flags = cache->flags;
+  header.module_hash = cache->module_hash;
+  header.module_size = cache->module_size;
+  header.istream_start = module->defined.istream_start;
+  header.istream_size =
+      module->defined.istream_end - module->defined.istream_start;
+  header.memory_index = module->memory_index;
+  header.table_index = module->table_index;
+  header.num_sigs = ctx->sig_index_mapping.size;
+  header.num_funcs = ctx->func_index_mapping.size;
+  header.num_func_imports = ctx->num_func_imports;
+  header.num_globals = ctx->global_index_mapping.size;
+  uint32_t i;
+  for (i = 0; i < num_bodies; ++i) {
+    header.num_types +=
+        get_func_by_defined_index(ctx, i)->defined.param_and_local_types.size;
+  }
+
+  const char* format = "%s.%d.tmp";
+  int length = wasm_snprintf(NULL, 0, format, cache->path, (int)getpid());
+  char* temp_path = wasm_alloc(ctx->allocator, length + 1, 1);
+  wasm_snprintf(temp_path, length + 1, format, cache->path, (int)getpid());
+
+  FILE* file = fopen(temp_path, "wb");
+  if (!file) {
+    wasm_free(ctx->allocator, temp_path);
+    return;
+  }
+
+  fwrite(&header, sizeof(header), 1, file);
+  write_uint32s(file, ctx->sig_index_mapping.data, header.num_sigs);
+  write_uint32s(file, ctx->func_index_mapping.data, header.num_funcs);
+  for (i = 0; i < header.num_func_imports; ++i) {
+    uint32_t offset = get_import_offset(ctx, i);
+    write_uint32s(file, &offset, 1);
+  }
+  write_uint32s(file, ctx->global_index_mapping.data, header.num_globals);
+  for (i = 0; i < num_bodies; ++i) {
+    WasmInterpreterFunc* func = get_func_by_defined_index(ctx, i);
+    IstreamCacheFunc cached;
+    cached.offset = func->defined.offset;
+    cached.end_offset = func->defined.end_offset;
+    cached.local_decl_count = func->defined.local_decl_count;
+    cached.local_count = func->defined.local_count;
+    cached.max_stack_height = func->defined.max_stack_height;
+    cached.num_types = func->defined.param_and_local_types.size;
+    fwrite(&cached, sizeof(cached), 1, file);
+  }
+  for (i = 0; i < num_bodies; ++i) {
+    WasmTypeVector* types =
+        &get_func_by_defined_index(ctx, i)->defined.param_and_local_types;
+    size_t j;
+    for (j = 0; j < types->size; ++j) {
+      int32_t type = types->data[j];
+      fwrite(&type, sizeof(type), 1, file);
+    }
+  }
+  fwrite((uint8_t*)ctx->env->istream.start + header.istream_start, 1,
+         header.istream_size, file);
+  fwrite(cache->module_data, 1, cache->module_size, file);
+
+  WasmBool written = !ferror(file);
+  if (fclose(file) != 0)
+    written = WASM_FALSE;
+  if (!written || rename(temp_path, cache->path) != 0)
+    unlink(temp_path);
+  wasm_free(ctx->allocator, temp_path);
+}
+#endif
+
+static WasmResult mark_call(uint32_t index, void* user_data) {
+  WasmBool* has_calls = user_data;
+  *has_calls = WASM_TRUE;
+  return WASM_OK;
+}
+
+static void ignore_error(WasmBinaryReaderContext* ctx, const char* message) {}
+
+/* returns whether the skipped body |index| calls another function. An invalid
+ * body counts as one that does; its error is reported when it is translated. */
+static WasmBool function_body_has_calls(Context* ctx,
                                         const void* data,
                                         size_t size,
-                                        const WasmReadBinaryOptions* options,
-                                        WasmBinaryErrorHandler* error_handler,
-                                        WasmInterpreterModule** out_module) {
+                                        uint32_t index) {
+  WasmBool has_calls = WASM_FALSE;
+  WasmBinaryReader reader;
+  WASM_ZERO_MEMORY(reader);
+  reader.user_data = &has_calls;
+  reader.on_error = ignore_error;
+  reader.on_call_expr = mark_call;
+  reader.on_call_indirect_expr = mark_call;
+  WasmReadBinaryOptions options = WASM_READ_BINARY_OPTIONS_DEFAULT;
+  WasmResult result = wasm_read_binary_function_body(
+      ctx->allocator, data, size, ctx->body_offsets.data[index], index,
+      ctx->func_index_mapping.size, ctx->sig_index_mapping.size, &reader,
+      &options);
+  return WASM_FAILED(result) || has_calls;
+}
+
+static WasmResult translate_function_body(Context* ctx,
+                                          const void* data,
+                                          size_t size,
+                                          uint32_t index) {
+  WasmReadBinaryOptions options = WASM_READ_BINARY_OPTIONS_DEFAULT;
+  return wasm_read_binary_function_body(
+      ctx->allocator, data, size, ctx->body_offsets.data[index], index,
+      ctx->func_index_mapping.size, ctx->sig_index_mapping.size, ctx->reader,
+      &options);
+}
+
+/* translates the bodies that were skipped while reading the module, one at a
+ * time. With |optimize|, the bodies that make no calls are translated first,
+ * so that every function that can be inlined has been translated before its
+ * callers; the others follow in order. */
+static WasmResult translate_function_bodies(Context* ctx,
+                                            const void* data,
+                                            size_t size) {
+  Uint32Vector callers;
+  WASM_ZERO_MEMORY(callers);
+  WasmResult result = WASM_OK;
+  uint32_t i;
+  for (i = 0; i < ctx->body_offsets.size; ++i) {
+    if (ctx->optimize && function_body_has_calls(ctx, data, size, i)) {
+      wasm_append_uint32_value(ctx->allocator, &callers, &i);
+      continue;
+    }
+    result = translate_function_body(ctx, data, size, i);
+    if (WASM_FAILED(result))
+      goto done;
+  }
+  for (i = 0; i < callers.size; ++i) {
+    result = translate_function_body(ctx, data, size, callers.data[i]);
+    if (WASM_FAILED(result))
+      goto done;
+  }
+done:
+  wasm_destroy_uint32_vector(ctx->allocator, &callers);
+  return result;
+}
+
+/* reads the module, taking its code from |cache| if it has an image that fits
+ * the environment, and translating it and writing it there otherwise. Either
+ * way the module is only read once, so its imports are only resolved once. */
+static WasmResult read_binary_interpreter(
+    WasmAllocator* allocator,
+    WasmAllocator* memory_allocator,
+    WasmInterpreterEnvironment* env,
+    const void* data,
+    size_t size,
+    const WasmReadBinaryOptions* options,
+    const WasmReadBinaryInterpreterOptions* interpreter_options,
+    WasmBinaryErrorHandler* error_handler,
+    IstreamCache* cache,
+    WasmInterpreterModule** out_module) {
   Context ctx;
   WasmBinaryReader reader;
 
@@ -1755,6 +3842,7 @@ WasmResult wasm_read_binary_interpreter(WasmAllocator* allocator,
 
   WasmInterpreterModule* module =
       wasm_append_interpreter_module(allocator, &env->modules);
+  env->generation++;
 
   WASM_ZERO_MEMORY(ctx);
   WASM_ZERO_MEMORY(reader);
@@ -1770,25 +3858,213 @@ WasmResult wasm_read_binary_interpreter(WasmAllocator* allocator,
   ctx.module->memory_index = WASM_INVALID_INDEX;
   ctx.module->defined.start_func_index = WASM_INVALID_INDEX;
   ctx.module->defined.istream_start = env->istream.size;
+  ctx.module->defined.lazy = NULL;
   ctx.istream_offset = env->istream.size;
+  ctx.use_registers = interpreter_options->use_registers;
+  ctx.optimize = interpreter_options->optimize;
+  ctx.quicken = interpreter_options->quicken;
+  ctx.use_huge_pages = interpreter_options->use_huge_pages;
   CHECK_RESULT(
       wasm_init_mem_writer_existing(&ctx.istream_writer, &env->istream));
 
   reader = s_binary_reader;
   reader.user_data = &ctx;
 
+  WasmBool use_cache = cache && cache->image;
+  /* translating in parallel would interleave the log */
+  WasmBool parallel = WASM_FALSE;
+#if WASM_INTERPRETER_SCHEDULER
+  parallel = interpreter_options->translate_threads > 1 &&
+             !interpreter_options->lazy && !options->log_stream && !use_cache;
+#endif
+
+  /* with |optimize|, the bodies are translated once the module has been read,
+   * in an order that lets more calls be inlined */
+  WasmBool reorder = interpreter_options->optimize &&
+                     !interpreter_options->lazy && !parallel &&
+                     !options->log_stream;
+
+  WasmReadBinaryOptions skip_options;
+  if (interpreter_options->lazy || parallel || use_cache || reorder) {
+    if (interpreter_options->lazy) {
+      ctx.lazy = wasm_alloc_zero(allocator, sizeof(WasmInterpreterLazyModule),
+                                 WASM_DEFAULT_ALIGN);
+    }
+    skip_options = *options;
+    skip_options.skip_function_bodies = WASM_TRUE;
+    options = &skip_options;
+  }
+
   const uint32_t num_function_passes = 1;
   WasmResult result = wasm_read_binary(allocator, data, size, &reader,
                                        num_function_passes, options);
+  WasmBool cache_hit = WASM_FALSE;
+#if HAVE_SYS_MMAN_H && HAVE_UNISTD_H
+  if (WASM_SUCCEEDED(result) && use_cache)
+    cache_hit = cache->hit = use_istream_cache(&ctx, cache);
+#endif
+  /* a cache miss means the cached code was made for another environment */
+  if (WASM_SUCCEEDED(result) && (use_cache || reorder) && !cache_hit)
+    result = translate_function_bodies(&ctx, data, size);
+#if WASM_INTERPRETER_SCHEDULER
+  if (WASM_SUCCEEDED(result) && parallel) {
+    result = translate_function_bodies_in_parallel(
+        &ctx, data, size, interpreter_options->translate_threads);
+  }
+#endif
   wasm_steal_mem_writer_output_buffer(&ctx.istream_writer, &env->istream);
   if (WASM_SUCCEEDED(result)) {
     env->istream.size = ctx.istream_offset;
     ctx.module->defined.istream_end = env->istream.size;
+    extend_instance_template(&ctx);
+#if HAVE_SYS_MMAN_H && HAVE_UNISTD_H
+    if (cache && !cache->hit)
+      write_istream_cache(&ctx, cache);
+#endif
+    if (ctx.lazy) {
+      /* the mappings move to the lazy module, which outlives the Context */
+      WasmInterpreterLazyModule* lazy = ctx.lazy;
+      lazy->allocator = allocator;
+      lazy->data = wasm_alloc(allocator, size, WASM_DEFAULT_ALIGN);
+      memcpy(lazy->data, data, size);
+      lazy->size = size;
+      lazy->sig_index_mapping = ctx.sig_index_mapping;
+      lazy->func_index_mapping = ctx.func_index_mapping;
+      lazy->global_index_mapping = ctx.global_index_mapping;
+      lazy->num_func_imports = ctx.num_func_imports;
+      lazy->num_global_imports = ctx.num_global_imports;
+      lazy->use_registers = ctx.use_registers;
+      lazy->optimize = ctx.optimize;
+      lazy->quicken = ctx.quicken;
+      lazy->body_offsets = ctx.body_offsets;
+      WASM_ZERO_MEMORY(ctx.sig_index_mapping);
+      WASM_ZERO_MEMORY(ctx.func_index_mapping);
+      WASM_ZERO_MEMORY(ctx.global_index_mapping);
+      WASM_ZERO_MEMORY(ctx.body_offsets);
+      ctx.module->defined.lazy = lazy;
+    }
     *out_module = module;
   } else {
+    if (ctx.lazy)
+      wasm_destroy_lazy_interpreter_module(allocator, ctx.lazy);
     wasm_reset_interpreter_environment_to_mark(allocator, env, mark);
     *out_module = NULL;
   }
   destroy_context(&ctx);
   return result;
 }
+
+/* errors in lazily translated bodies are reported as traps, not printed */
+static WasmBinaryErrorHandler s_lazy_error_handler = {NULL, NULL};
+
+WasmResult wasm_translate_lazy_interpreter_func(WasmInterpreterEnvironment* env,
+                                                uint32_t module_index,
+                                                uint32_t func_index) {
+  assert(module_index < env->modules.size);
+  WasmInterpreterModule* module = &env->modules.data[module_index];
+  WasmInterpreterLazyModule* lazy = module->defined.lazy;
+  assert(lazy);
+  WasmInterpreterFunc* func = &env->funcs.data[func_index];
+  assert(func->defined.offset == func->defined.stub_offset);
+  /* the module's defined functions are consecutive in the environment */
+  uint32_t index =
+      func_index - lazy->func_index_mapping.data[lazy->num_func_imports];
+  assert(index < lazy->body_offsets.size);
+
+  Context ctx;
+  WasmBinaryReader reader;
+  WASM_ZERO_MEMORY(ctx);
+  WASM_ZERO_MEMORY(reader);
+
+  ctx.allocator = lazy->allocator;
+  ctx.reader = &reader;
+  ctx.error_handler = &s_lazy_error_handler;
+  ctx.env = env;
+  ctx.module = module;
+  ctx.istream_offset = env->istream.size;
+  ctx.use_registers = lazy->use_registers;
+  ctx.optimize = lazy->optimize;
+  ctx.quicken = lazy->quicken;
+  ctx.sig_index_mapping = lazy->sig_index_mapping;
+  ctx.func_index_mapping = lazy->func_index_mapping;
+  ctx.global_index_mapping = lazy->global_index_mapping;
+  ctx.num_func_imports = lazy->num_func_imports;
+  ctx.num_global_imports = lazy->num_global_imports;
+  CHECK_RESULT(
+      wasm_init_mem_writer_existing(&ctx.istream_writer, &env->istream));
+
+  reader = s_binary_reader;
+  reader.user_data = &ctx;
+
+  size_t istream_size = env->istream.size;
+  WasmReadBinaryOptions options = WASM_READ_BINARY_OPTIONS_DEFAULT;
+  WasmResult result = wasm_read_binary_function_body(
+      lazy->allocator, lazy->data, lazy->size, lazy->body_offsets.data[index],
+      index, lazy->func_index_mapping.size, lazy->sig_index_mapping.size,
+      &reader, &options);
+  if (WASM_SUCCEEDED(result)) {
+    /* code translated before this still calls the stub, which now jumps to
+     * the body */
+    uint8_t opcode = WASM_OPCODE_BR;
+    result = emit_data_at(&ctx, func->defined.stub_offset, &opcode,
+                          sizeof(uint8_t));
+    if (WASM_SUCCEEDED(result)) {
+      result = emit_i32_at(&ctx, func->defined.stub_offset + sizeof(uint8_t),
+                           func->defined.offset);
+    }
+  }
+  wasm_steal_mem_writer_output_buffer(&ctx.istream_writer, &env->istream);
+  if (WASM_SUCCEEDED(result)) {
+    env->istream.size = ctx.istream_offset;
+  } else {
+    env->istream.size = istream_size;
+    func->defined.offset = func->defined.stub_offset;
+    func->defined.end_offset =
+        func->defined.stub_offset + sizeof(uint8_t) + 2 * sizeof(uint32_t);
+    func->defined.local_decl_count = 0;
+    func->defined.local_count = 0;
+    func->defined.max_stack_height = 0;
+    func->defined.param_and_local_types.size = 0;
+  }
+  destroy_function_body_context(&ctx);
+  return result;
+}
+
+void wasm_destroy_lazy_interpreter_module(WasmAllocator* allocator,
+                                          WasmInterpreterLazyModule* lazy) {
+  wasm_free(allocator, lazy->data);
+  wasm_destroy_uint32_vector(allocator, &lazy->sig_index_mapping);
+  wasm_destroy_uint32_vector(allocator, &lazy->func_index_mapping);
+  wasm_destroy_uint32_vector(allocator, &lazy->global_index_mapping);
+  wasm_destroy_uint32_vector(allocator, &lazy->body_offsets);
+  wasm_free(allocator, lazy);
+}
+
+WasmResult wasm_read_binary_interpreter(WasmAllocator* allocator,
+                                        WasmAllocator* memory_allocator,
+                                        WasmInterpreterEnvironment* env,
+                                        const void* data,
+                                        size_t size,
+                                        const WasmReadBinaryOptions* options,
+                                        const WasmReadBinaryInterpreterOptions*
+                                            interpreter_options,
+                                        WasmBinaryErrorHandler* error_handler,
+                                        WasmInterpreterModule** out_module) {
+#if HAVE_SYS_MMAN_H && HAVE_UNISTD_H
+  if (interpreter_options->cache_dir && !interpreter_options->lazy &&
+      !options->log_stream) {
+    IstreamCache cache;
+    init_istream_cache(allocator, &cache, interpreter_options, data, size);
+    map_istream_cache(&cache);
+    WasmResult result = read_binary_interpreter(
+        allocator, memory_allocator, env, data, size, options,
+        interpreter_options, error_handler, &cache, out_module);
+    /* the copied code doesn't refer to the file */
+    destroy_istream_cache(allocator, &cache);
+    return result;
+  }
+#endif
+  return read_binary_interpreter(allocator, memory_allocator, env, data, size,
+                                 options, interpreter_options, error_handler,
+                                 NULL, out_module);
+}
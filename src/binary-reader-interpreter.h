@@ -21,9 +21,49 @@
 
 struct WasmAllocator;
 struct WasmInterpreterEnvironment;
+struct WasmInterpreterLazyModule;
 struct WasmInterpreterModule;
 struct WasmReadBinaryOptions;
 
+typedef struct WasmReadBinaryInterpreterOptions {
+  /* translate i32 binary operators whose operands are locals into register
+   * instructions that read the locals in place, and write the result directly
+   * to the local when it is immediately stored with set_local */
+  WasmBool use_registers;
+  /* back the module's linear memory with transparent huge pages */
+  WasmBool use_huge_pages;
+  /* fold integer constants, including the values of locals that are known
+   * to hold one, while translating, then rewrite each function's code once it
+   * is translated, to thread jumps, merge drop_keeps and remove unreachable
+   * code */
+  WasmBool optimize;
+  /* emit each call_indirect with an inline cache of the function it called
+   * last, which the interpreter fills in and checks against the table, so
+   * that a call site that keeps calling the same function doesn't look it up
+   * again. The istream is then written as it runs, like with |lazy|. */
+  WasmBool quicken;
+  /* only emit a stub for each function, and translate its body the first time
+   * it is called. An invalid body traps then, instead of failing the read. */
+  WasmBool lazy;
+  /* once the rest of the module has been read, translate the function bodies
+   * on this many OS threads, instead of one at a time as they are read. The
+   * code is the same either way. The allocator must then be safe to use from
+   * several threads. Ignored without pthreads, with |lazy|, or when the read
+   * is logged. */
+  uint32_t translate_threads;
+  /* a directory to keep the translated code of each module in, keyed by a
+   * hash of the module's bytes and WASM_INTERPRETER_ISTREAM_VERSION. When the
+   * same module is read again to the same place in an environment with the
+   * same imports, its function bodies aren't parsed, validated or translated;
+   * their code is copied from the cached file, which keeps a copy of the
+   * module's bytes to compare against. NULL to not cache. Ignored
+   * without mmap, with |lazy|, or when the read is logged. */
+  const char* cache_dir;
+} WasmReadBinaryInterpreterOptions;
+
+#define WASM_READ_BINARY_INTERPRETER_OPTIONS_DEFAULT \
+  { WASM_FALSE, WASM_FALSE, WASM_FALSE, WASM_FALSE, WASM_FALSE, 0, NULL }
+
 WASM_EXTERN_C_BEGIN
 WasmResult wasm_read_binary_interpreter(
     struct WasmAllocator* allocator,
@@ -32,8 +72,19 @@ WasmResult wasm_read_binary_interpreter(
     const void* data,
     size_t size,
     const struct WasmReadBinaryOptions* options,
+    const WasmReadBinaryInterpreterOptions* interpreter_options,
     WasmBinaryErrorHandler*,
     struct WasmInterpreterModule** out_module);
+/* translates the body of |func_index|, a function of the module at
+ * |module_index| that was read lazily, to the end of the istream; called by
+ * the interpreter when it reaches the function's stub */
+WasmResult wasm_translate_lazy_interpreter_func(
+    struct WasmInterpreterEnvironment* env,
+    uint32_t module_index,
+    uint32_t func_index);
+void wasm_destroy_lazy_interpreter_module(
+    struct WasmAllocator* allocator,
+    struct WasmInterpreterLazyModule* lazy);
 WASM_EXTERN_C_END
 
 #endif /* WASM_BINARY_READER_INTERPRETER_H_ */
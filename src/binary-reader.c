@@ -583,6 +583,7 @@ LOGGING_END(start_section)
 LOGGING_BEGIN(function_bodies_section)
 LOGGING_UINT32(on_function_bodies_count)
 LOGGING_UINT32(begin_function_body)
+LOGGING_UINT32_UINT32(on_skipped_function_body, "index", "offset")
 LOGGING_UINT32(end_function_body)
 LOGGING_UINT32(on_local_decl_count)
 LOGGING_OPCODE(on_binary_expr)
@@ -1026,6 +1027,7 @@ static WasmBinaryReader s_logging_binary_reader = {
     .on_function_bodies_count = logging_on_function_bodies_count,
     .begin_function_body_pass = logging_begin_function_body_pass,
     .begin_function_body = logging_begin_function_body,
+    .on_skipped_function_body = logging_on_skipped_function_body,
     .on_local_decl_count = logging_on_local_decl_count,
     .on_local_decl = logging_on_local_decl,
     .on_binary_expr = logging_on_binary_expr,
@@ -1922,6 +1924,33 @@ static void read_elem_section(Context* ctx, uint32_t section_size) {
   CALLBACK_CTX0(end_elem_section);
 }
 
+/* reads the |index|th function body, starting with its size */
+static void read_function_body_with_locals(Context* ctx, uint32_t index) {
+  CALLBACK(begin_function_body, index);
+  uint32_t body_size;
+  in_u32_leb128(ctx, &body_size, "function body size");
+  uint32_t body_start_offset = ctx->offset;
+  uint32_t end_offset = body_start_offset + body_size;
+
+  uint32_t num_local_decls;
+  in_u32_leb128(ctx, &num_local_decls, "local declaration count");
+  CALLBACK(on_local_decl_count, num_local_decls);
+  uint32_t k;
+  for (k = 0; k < num_local_decls; ++k) {
+    uint32_t num_local_types;
+    in_u32_leb128(ctx, &num_local_types, "local type count");
+    WasmType local_type;
+    in_type(ctx, &local_type, "local type");
+    RAISE_ERROR_UNLESS(is_concrete_type(local_type),
+                       "expected valid local type");
+    CALLBACK(on_local_decl, k, num_local_types, local_type);
+  }
+
+  read_function_body(ctx, end_offset);
+
+  CALLBACK(end_function_body, index);
+}
+
 static void read_code_section(Context* ctx, uint32_t section_size) {
   CALLBACK_SECTION(begin_function_bodies_section, section_size);
   uint32_t i;
@@ -1930,31 +1959,17 @@ static void read_code_section(Context* ctx, uint32_t section_size) {
                      "function signature count != function body count");
   CALLBACK(on_function_bodies_count, ctx->num_function_bodies);
   for (i = 0; i < ctx->num_function_bodies; ++i) {
-    uint32_t func_offset = ctx->offset;
-    ctx->offset = func_offset;
-    CALLBACK(begin_function_body, i);
-    uint32_t body_size;
-    in_u32_leb128(ctx, &body_size, "function body size");
-    uint32_t body_start_offset = ctx->offset;
-    uint32_t end_offset = body_start_offset + body_size;
-
-    uint32_t num_local_decls;
-    in_u32_leb128(ctx, &num_local_decls, "local declaration count");
-    CALLBACK(on_local_decl_count, num_local_decls);
-    uint32_t k;
-    for (k = 0; k < num_local_decls; ++k) {
-      uint32_t num_local_types;
-      in_u32_leb128(ctx, &num_local_types, "local type count");
-      WasmType local_type;
-      in_type(ctx, &local_type, "local type");
-      RAISE_ERROR_UNLESS(is_concrete_type(local_type),
-                         "expected valid local type");
-      CALLBACK(on_local_decl, k, num_local_types, local_type);
+    if (ctx->options->skip_function_bodies) {
+      uint32_t func_offset = ctx->offset;
+      uint32_t body_size;
+      in_u32_leb128(ctx, &body_size, "function body size");
+      RAISE_ERROR_UNLESS(body_size <= ctx->read_end - ctx->offset,
+                         "function body extends past end of section");
+      ctx->offset += body_size;
+      CALLBACK(on_skipped_function_body, i, func_offset);
+    } else {
+      read_function_body_with_locals(ctx, i);
     }
-
-    read_function_body(ctx, end_offset);
-
-    CALLBACK(end_function_body, i);
   }
   CALLBACK_CTX0(end_function_bodies_section);
 }
@@ -2079,3 +2094,50 @@ WasmResult wasm_read_binary(WasmAllocator* allocator,
   destroy_context(ctx);
   return WASM_OK;
 }
+
+WasmResult wasm_read_binary_function_body(
+    WasmAllocator* allocator,
+    const void* data,
+    size_t size,
+    uint32_t offset,
+    uint32_t index,
+    uint32_t num_funcs,
+    uint32_t num_signatures,
+    WasmBinaryReader* reader,
+    const WasmReadBinaryOptions* options) {
+  LoggingContext logging_context;
+  WASM_ZERO_MEMORY(logging_context);
+  logging_context.reader = reader;
+  logging_context.stream = options->log_stream;
+
+  WasmBinaryReader logging_reader = s_logging_binary_reader;
+  logging_reader.user_data = &logging_context;
+
+  Context context;
+  WASM_ZERO_MEMORY(context);
+  /* all the macros assume a Context* named ctx */
+  Context* ctx = &context;
+  ctx->allocator = allocator;
+  ctx->data = data;
+  ctx->data_size = ctx->read_end = size;
+  ctx->offset = offset;
+  ctx->reader = options->log_stream ? &logging_reader : reader;
+  ctx->options = options;
+  /* only the total is checked, so the functions can all count as defined */
+  ctx->num_function_signatures = num_funcs;
+  ctx->num_signatures = num_signatures;
+
+  if (setjmp(ctx->error_jmp_buf) == 1) {
+    destroy_context(ctx);
+    return WASM_ERROR;
+  }
+
+  wasm_reserve_types(allocator, &ctx->param_types,
+                     INITIAL_PARAM_TYPES_CAPACITY);
+  wasm_reserve_uint32s(allocator, &ctx->target_depths,
+                       INITIAL_BR_TABLE_TARGET_CAPACITY);
+
+  read_function_body_with_locals(ctx, index);
+  destroy_context(ctx);
+  return WASM_OK;
+}
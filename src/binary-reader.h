@@ -26,11 +26,14 @@
 struct WasmAllocator;
 
 #define WASM_READ_BINARY_OPTIONS_DEFAULT \
-  { NULL, WASM_FALSE }
+  { NULL, WASM_FALSE, WASM_FALSE }
 
 typedef struct WasmReadBinaryOptions {
   struct WasmStream* log_stream;
   WasmBool read_debug_names;
+  /* call on_skipped_function_body for each function body instead of reading
+   * it; wasm_read_binary_function_body reads it later */
+  WasmBool skip_function_bodies;
 } WasmReadBinaryOptions;
 
 typedef struct WasmBinaryReaderContext {
@@ -164,6 +167,11 @@ typedef struct WasmBinaryReader {
                                          uint32_t pass,
                                          void* user_data);
   WasmResult (*begin_function_body)(uint32_t index, void* user_data);
+  /* called instead of begin_function_body ... end_function_body when the
+   * bodies are skipped; |offset| is where the body starts */
+  WasmResult (*on_skipped_function_body)(uint32_t index,
+                                         uint32_t offset,
+                                         void* user_data);
   WasmResult (*on_local_decl_count)(uint32_t count, void* user_data);
   WasmResult (*on_local_decl)(uint32_t decl_index,
                               uint32_t count,
@@ -313,6 +321,19 @@ WasmResult wasm_read_binary(struct WasmAllocator* allocator,
                             WasmBinaryReader* reader,
                             uint32_t num_function_passes,
                             const WasmReadBinaryOptions* options);
+/* reads the |index|th function body, which starts at |offset| of the module in
+ * |data|, as wasm_read_binary does for each body, from begin_function_body to
+ * end_function_body. The module has |num_funcs| functions, including imports,
+ * and |num_signatures| signatures. */
+WasmResult wasm_read_binary_function_body(struct WasmAllocator* allocator,
+                                          const void* data,
+                                          size_t size,
+                                          uint32_t offset,
+                                          uint32_t index,
+                                          uint32_t num_funcs,
+                                          uint32_t num_signatures,
+                                          WasmBinaryReader* reader,
+                                          const WasmReadBinaryOptions* options);
 
 size_t wasm_read_u32_leb128(const uint8_t* ptr,
                             const uint8_t* end,
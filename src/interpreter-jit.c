@@ -0,0 +1,1299 @@
+/*
+ * Copyright 2016 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "interpreter-jit.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* The code for a function is a single pass over its istream. Each instruction
+ * is translated on its own, with the value stack pointer held in rbx, so
+ * there is a native address for every istream offset in the function and
+ * branches are simple jumps.
+ *
+ * The code starts with a shared prologue and exit stubs:
+ *
+ *   entry:      called as entry(thread, out_pc, target); saves registers,
+ *               loads the stack pointer and jumps to |target|
+ *   exit:       stores the stack pointer, stores ecx to *out_pc and returns
+ *               WASM_INTERPRETER_OK
+ *   trap_exit:  stores the stack pointer and returns eax
+ *   trap_*:     one per trap, loads its result into eax
+ *
+ * followed by the body, starting at the function's ALLOCA.
+ *
+ * An instruction without a translation, a return, call_indirect and
+ * call_host all exit to the interpreter at that instruction. A direct call
+ * pushes a resume point on the call stack and exits at the callee, so that
+ * the callee's return comes back to the native code.
+ *
+ * Registers:
+ *   rbx  value stack top
+ *   r13  out_pc
+ *   r14  instance
+ *   r15  thread
+ *   rax, rcx, rdx, rsi, rdi  scratch */
+
+/* keeps every value stack displacement within a 32-bit immediate */
+#define MAX_DEPTH (1 << 24)
+#define MAX_UNROLLED_LOCALS 16
+
+#define VALUE_SIZE ((int32_t)sizeof(WasmInterpreterValue))
+
+typedef uint8_t Uint8;
+WASM_DEFINE_VECTOR(uint8, Uint8);
+
+typedef struct Fixup {
+  uint32_t code_offset; /* of the rel32 operand to patch */
+  uint32_t target;      /* istream offset */
+} Fixup;
+WASM_DEFINE_VECTOR(fixup, Fixup);
+
+typedef struct WasmInterpreterJitCode {
+  void* data;
+  size_t size;
+  uint32_t entry_offset;
+} WasmInterpreterJitCode;
+
+typedef WasmInterpreterResult (*JitEntry)(WasmInterpreterThread* thread,
+                                          uint32_t* out_pc,
+                                          const void* target);
+
+typedef enum Reg {
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RSP = 4,
+  RBP = 5,
+  RSI = 6,
+  RDI = 7,
+  R13 = 13,
+  R14 = 14,
+  R15 = 15,
+} Reg;
+
+/* the condition nibble of jcc, setcc and cmovcc; flipping the low bit negates
+ * it */
+typedef enum Cond {
+  COND_B = 0x2,
+  COND_AE = 0x3,
+  COND_E = 0x4,
+  COND_NE = 0x5,
+  COND_BE = 0x6,
+  COND_A = 0x7,
+  COND_L = 0xc,
+  COND_GE = 0xd,
+  COND_LE = 0xe,
+  COND_G = 0xf,
+} Cond;
+
+#define INVERT_COND(cond) ((Cond)((cond) ^ 1))
+
+typedef enum BinopKind {
+  BINOP_ADD,
+  BINOP_SUB,
+  BINOP_MUL,
+  BINOP_DIV_S,
+  BINOP_DIV_U,
+  BINOP_REM_S,
+  BINOP_REM_U,
+  BINOP_AND,
+  BINOP_OR,
+  BINOP_XOR,
+  BINOP_SHL,
+  BINOP_SHR_S,
+  BINOP_SHR_U,
+  BINOP_ROTL,
+  BINOP_ROTR,
+  BINOP_COMPARE,
+} BinopKind;
+
+/* the integer binary operators that have a translation, for both i32 and
+ * i64; the condition is only used by comparisons */
+#define FOREACH_INTEGER_BINOP(V) \
+  V(ADD, ADD, COND_E)            \
+  V(SUB, SUB, COND_E)            \
+  V(MUL, MUL, COND_E)            \
+  V(DIV_S, DIV_S, COND_E)        \
+  V(DIV_U, DIV_U, COND_E)        \
+  V(REM_S, REM_S, COND_E)        \
+  V(REM_U, REM_U, COND_E)        \
+  V(AND, AND, COND_E)            \
+  V(OR, OR, COND_E)              \
+  V(XOR, XOR, COND_E)            \
+  V(SHL, SHL, COND_E)            \
+  V(SHR_S, SHR_S, COND_E)        \
+  V(SHR_U, SHR_U, COND_E)        \
+  V(ROTL, ROTL, COND_E)          \
+  V(ROTR, ROTR, COND_E)          \
+  V(EQ, COMPARE, COND_E)         \
+  V(NE, COMPARE, COND_NE)        \
+  V(LT_S, COMPARE, COND_L)       \
+  V(LT_U, COMPARE, COND_B)       \
+  V(GT_S, COMPARE, COND_G)       \
+  V(GT_U, COMPARE, COND_A)       \
+  V(LE_S, COMPARE, COND_LE)      \
+  V(LE_U, COMPARE, COND_BE)      \
+  V(GE_S, COMPARE, COND_GE)      \
+  V(GE_U, COMPARE, COND_AE)
+
+#define FOREACH_TRAP(V)          \
+  V(MEMORY_ACCESS_OUT_OF_BOUNDS) \
+  V(INTEGER_OVERFLOW)            \
+  V(INTEGER_DIVIDE_BY_ZERO)      \
+  V(UNREACHABLE)                 \
+  V(CALL_STACK_EXHAUSTED)        \
+  V(VALUE_STACK_EXHAUSTED)
+
+typedef enum Trap {
+#define V(name) TRAP_##name,
+  FOREACH_TRAP(V)
+#undef V
+  NUM_TRAPS,
+} Trap;
+
+typedef struct Context {
+  WasmAllocator* allocator;
+  WasmInterpreterEnvironment* env;
+  uint32_t func_index;
+  const uint8_t* istream;
+  uint32_t istream_start;
+  Uint8Vector code;
+  /* the code offset of each instruction, indexed by its istream offset
+   * relative to |istream_start|; WASM_INVALID_OFFSET inside of operands */
+  WasmUint32Array code_offsets;
+  FixupVector fixups;
+  WasmInterpreterJitResumePointVector resume_points;
+  uint32_t exit_offset;
+  uint32_t trap_offsets[NUM_TRAPS];
+  uint32_t entry_offset;
+} Context;
+
+static uint32_t read_u32_at(const uint8_t* p) {
+  uint32_t result;
+  memcpy(&result, p, sizeof(uint32_t));
+  return result;
+}
+
+static uint64_t read_u64_at(const uint8_t* p) {
+  uint64_t result;
+  memcpy(&result, p, sizeof(uint64_t));
+  return result;
+}
+
+static uint32_t get_code_offset(Context* ctx) {
+  return ctx->code.size;
+}
+
+static void emit_u8(Context* ctx, uint8_t value) {
+  wasm_append_uint8_value(ctx->allocator, &ctx->code, &value);
+}
+
+static void emit_u32(Context* ctx, uint32_t value) {
+  int i;
+  for (i = 0; i < 4; ++i)
+    emit_u8(ctx, (value >> (i * 8)) & 0xff);
+}
+
+static void emit_u64(Context* ctx, uint64_t value) {
+  emit_u32(ctx, (uint32_t)value);
+  emit_u32(ctx, (uint32_t)(value >> 32));
+}
+
+static void emit_bytes(Context* ctx, const uint8_t* bytes, size_t size) {
+  size_t i;
+  for (i = 0; i < size; ++i)
+    emit_u8(ctx, bytes[i]);
+}
+
+#define EMIT_BYTES(ctx, ...)                              \
+  do {                                                    \
+    static const uint8_t s_bytes[] = {__VA_ARGS__};       \
+    emit_bytes((ctx), s_bytes, WASM_ARRAY_SIZE(s_bytes)); \
+  } while (0)
+
+static void patch_u32(Context* ctx, uint32_t offset, uint32_t value) {
+  memcpy(&ctx->code.data[offset], &value, sizeof(uint32_t));
+}
+
+static void emit_rex(Context* ctx, WasmBool is_64, Reg reg, Reg rm) {
+  uint8_t rex = 0x40 | (is_64 ? 8 : 0) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+  if (rex != 0x40)
+    emit_u8(ctx, rex);
+}
+
+/* |opcode| with operands |reg| and [|base| + |disp|] */
+static void emit_op_mem(Context* ctx,
+                        WasmBool is_64,
+                        uint8_t opcode,
+                        Reg reg,
+                        Reg base,
+                        int32_t disp) {
+  /* these bases need a SIB byte */
+  assert((base & 7) != RSP);
+  emit_rex(ctx, is_64, reg, base);
+  emit_u8(ctx, opcode);
+  emit_u8(ctx, 0x80 | ((reg & 7) << 3) | (base & 7));
+  emit_u32(ctx, (uint32_t)disp);
+}
+
+/* |opcode| with register operands |reg| and |rm| */
+static void emit_op_reg(Context* ctx,
+                        WasmBool is_64,
+                        uint8_t opcode,
+                        Reg reg,
+                        Reg rm) {
+  emit_rex(ctx, is_64, reg, rm);
+  emit_u8(ctx, opcode);
+  emit_u8(ctx, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static int32_t get_slot_disp(uint32_t depth) {
+  return -(int32_t)depth * VALUE_SIZE;
+}
+
+/* mov reg, [rbx - depth * 8] */
+static void emit_load_slot(Context* ctx,
+                           WasmBool is_64,
+                           Reg reg,
+                           uint32_t depth) {
+  emit_op_mem(ctx, is_64, 0x8b, reg, RBX, get_slot_disp(depth));
+}
+
+/* mov [rbx - depth * 8], reg */
+static void emit_store_slot(Context* ctx,
+                            WasmBool is_64,
+                            uint32_t depth,
+                            Reg reg) {
+  emit_op_mem(ctx, is_64, 0x89, reg, RBX, get_slot_disp(depth));
+}
+
+/* moves the value stack top by |count| values; leaves the flags clobbered */
+static void emit_adjust_top(Context* ctx, int32_t count) {
+  if (count > 0) {
+    EMIT_BYTES(ctx, 0x48, 0x81, 0xc3); /* add rbx, imm32 */
+    emit_u32(ctx, count * VALUE_SIZE);
+  } else if (count < 0) {
+    EMIT_BYTES(ctx, 0x48, 0x81, 0xeb); /* sub rbx, imm32 */
+    emit_u32(ctx, -count * VALUE_SIZE);
+  }
+}
+
+static void emit_jmp_to(Context* ctx, uint32_t code_offset) {
+  emit_u8(ctx, 0xe9);
+  emit_u32(ctx, code_offset - (get_code_offset(ctx) + 4));
+}
+
+static void emit_jcc_to(Context* ctx, Cond cond, uint32_t code_offset) {
+  emit_u8(ctx, 0x0f);
+  emit_u8(ctx, 0x80 | cond);
+  emit_u32(ctx, code_offset - (get_code_offset(ctx) + 4));
+}
+
+/* returns the offset of the rel32 operand, to be passed to patch_jump_here */
+static uint32_t emit_jmp_forward(Context* ctx) {
+  emit_u8(ctx, 0xe9);
+  uint32_t offset = get_code_offset(ctx);
+  emit_u32(ctx, 0);
+  return offset;
+}
+
+static uint32_t emit_jcc_forward(Context* ctx, Cond cond) {
+  emit_u8(ctx, 0x0f);
+  emit_u8(ctx, 0x80 | cond);
+  uint32_t offset = get_code_offset(ctx);
+  emit_u32(ctx, 0);
+  return offset;
+}
+
+static void patch_jump_here(Context* ctx, uint32_t rel_offset) {
+  patch_u32(ctx, rel_offset, get_code_offset(ctx) - (rel_offset + 4));
+}
+
+static void add_fixup(Context* ctx, uint32_t target) {
+  Fixup* fixup = wasm_append_fixup(ctx->allocator, &ctx->fixups);
+  fixup->code_offset = get_code_offset(ctx);
+  fixup->target = target;
+  emit_u32(ctx, 0);
+}
+
+/* jumps to the code of the instruction at istream offset |target| */
+static void emit_jmp_istream(Context* ctx, uint32_t target) {
+  emit_u8(ctx, 0xe9);
+  add_fixup(ctx, target);
+}
+
+static void emit_jcc_istream(Context* ctx, Cond cond, uint32_t target) {
+  emit_u8(ctx, 0x0f);
+  emit_u8(ctx, 0x80 | cond);
+  add_fixup(ctx, target);
+}
+
+static void emit_trap_if(Context* ctx, Cond cond, Trap trap) {
+  emit_jcc_to(ctx, cond, ctx->trap_offsets[trap]);
+}
+
+/* continues in the interpreter at istream offset |pc| */
+static void emit_exit(Context* ctx, uint32_t pc) {
+  emit_u8(ctx, 0xb9); /* mov ecx, imm32 */
+  emit_u32(ctx, pc);
+  emit_jmp_to(ctx, ctx->exit_offset);
+}
+
+static void emit_prologue_and_stubs(Context* ctx) {
+  /* entry */
+  EMIT_BYTES(ctx, 0x53,        /* push rbx */
+             0x41, 0x55,       /* push r13 */
+             0x41, 0x56,       /* push r14 */
+             0x41, 0x57);      /* push r15 */
+  emit_op_reg(ctx, WASM_TRUE, 0x89, RDI, R15); /* mov r15, rdi */
+  emit_op_reg(ctx, WASM_TRUE, 0x89, RSI, R13); /* mov r13, rsi */
+  emit_op_mem(ctx, WASM_TRUE, 0x8b, R14, R15,
+              offsetof(WasmInterpreterThread, instance));
+  emit_op_mem(ctx, WASM_TRUE, 0x8b, RBX, R15,
+              offsetof(WasmInterpreterThread, value_stack_top));
+  EMIT_BYTES(ctx, 0xff, 0xe2); /* jmp rdx */
+
+  /* exit, falls through to the epilogue */
+  ctx->exit_offset = get_code_offset(ctx);
+  emit_op_mem(ctx, WASM_TRUE, 0x89, RBX, R15,
+              offsetof(WasmInterpreterThread, value_stack_top));
+  emit_op_mem(ctx, WASM_FALSE, 0x89, RCX, R13, 0);
+  WASM_STATIC_ASSERT(WASM_INTERPRETER_OK == 0);
+  EMIT_BYTES(ctx, 0x31, 0xc0); /* xor eax, eax */
+  uint32_t epilogue_offset = get_code_offset(ctx);
+  EMIT_BYTES(ctx, 0x41, 0x5f,  /* pop r15 */
+             0x41, 0x5e,       /* pop r14 */
+             0x41, 0x5d,       /* pop r13 */
+             0x5b,             /* pop rbx */
+             0xc3);            /* ret */
+
+  uint32_t trap_exit_offset = get_code_offset(ctx);
+  emit_op_mem(ctx, WASM_TRUE, 0x89, RBX, R15,
+              offsetof(WasmInterpreterThread, value_stack_top));
+  emit_jmp_to(ctx, epilogue_offset);
+
+#define V(name)                                               \
+  ctx->trap_offsets[TRAP_##name] = get_code_offset(ctx);      \
+  emit_u8(ctx, 0xb8); /* mov eax, imm32 */                    \
+  emit_u32(ctx, WASM_INTERPRETER_TRAP_##name);                \
+  emit_jmp_to(ctx, trap_exit_offset);
+  FOREACH_TRAP(V)
+#undef V
+}
+
+static WasmBool get_integer_binop(uint8_t opcode,
+                                  WasmBool* out_is_64,
+                                  BinopKind* out_kind,
+                                  Cond* out_cond) {
+  switch (opcode) {
+#define V(NAME, kind, cond)       \
+  case WASM_OPCODE_I32_##NAME:    \
+    *out_is_64 = WASM_FALSE;      \
+    *out_kind = BINOP_##kind;     \
+    *out_cond = cond;             \
+    return WASM_TRUE;             \
+  case WASM_OPCODE_I64_##NAME:    \
+    *out_is_64 = WASM_TRUE;       \
+    *out_kind = BINOP_##kind;     \
+    *out_cond = cond;             \
+    return WASM_TRUE;
+    FOREACH_INTEGER_BINOP(V)
+#undef V
+    default:
+      return WASM_FALSE;
+  }
+}
+
+/* computes rax = rax |kind| rcx. Comparisons produce an i32. */
+static void emit_binop(Context* ctx, WasmBool is_64, BinopKind kind, Cond cond) {
+  switch (kind) {
+    case BINOP_ADD:
+      emit_op_reg(ctx, is_64, 0x01, RCX, RAX);
+      break;
+
+    case BINOP_SUB:
+      emit_op_reg(ctx, is_64, 0x29, RCX, RAX);
+      break;
+
+    case BINOP_AND:
+      emit_op_reg(ctx, is_64, 0x21, RCX, RAX);
+      break;
+
+    case BINOP_OR:
+      emit_op_reg(ctx, is_64, 0x09, RCX, RAX);
+      break;
+
+    case BINOP_XOR:
+      emit_op_reg(ctx, is_64, 0x31, RCX, RAX);
+      break;
+
+    case BINOP_MUL:
+      /* imul rax, rcx */
+      emit_rex(ctx, is_64, RAX, RCX);
+      EMIT_BYTES(ctx, 0x0f, 0xaf, 0xc1);
+      break;
+
+    /* the shift and rotate count is in cl, and the hardware masks it the
+     * same way that wasm does */
+    case BINOP_SHL:
+      emit_op_reg(ctx, is_64, 0xd3, (Reg)4, RAX);
+      break;
+
+    case BINOP_SHR_S:
+      emit_op_reg(ctx, is_64, 0xd3, (Reg)7, RAX);
+      break;
+
+    case BINOP_SHR_U:
+      emit_op_reg(ctx, is_64, 0xd3, (Reg)5, RAX);
+      break;
+
+    case BINOP_ROTL:
+      emit_op_reg(ctx, is_64, 0xd3, (Reg)0, RAX);
+      break;
+
+    case BINOP_ROTR:
+      emit_op_reg(ctx, is_64, 0xd3, (Reg)1, RAX);
+      break;
+
+    case BINOP_DIV_S:
+    case BINOP_DIV_U:
+    case BINOP_REM_S:
+    case BINOP_REM_U: {
+      WasmBool is_signed = kind == BINOP_DIV_S || kind == BINOP_REM_S;
+      WasmBool is_rem = kind == BINOP_REM_S || kind == BINOP_REM_U;
+      emit_op_reg(ctx, is_64, 0x85, RCX, RCX); /* test rcx, rcx */
+      emit_trap_if(ctx, COND_E, TRAP_INTEGER_DIVIDE_BY_ZERO);
+      uint32_t done_fixup = WASM_INVALID_OFFSET;
+      if (is_signed) {
+        /* the minimum value divided by -1 overflows: div_s traps, and rem_s
+         * is 0. idiv would fault on both. */
+        emit_rex(ctx, is_64, RAX, RCX);
+        EMIT_BYTES(ctx, 0x83, 0xf9, 0xff); /* cmp rcx, -1 */
+        uint32_t divide_fixup = emit_jcc_forward(ctx, COND_NE);
+        if (is_rem) {
+          EMIT_BYTES(ctx, 0x31, 0xd2); /* xor edx, edx */
+          done_fixup = emit_jmp_forward(ctx);
+        } else {
+          if (is_64) {
+            EMIT_BYTES(ctx, 0x48, 0xba); /* mov rdx, imm64 */
+            emit_u64(ctx, 0x8000000000000000ULL);
+          } else {
+            emit_u8(ctx, 0xba); /* mov edx, imm32 */
+            emit_u32(ctx, 0x80000000U);
+          }
+          emit_op_reg(ctx, is_64, 0x39, RDX, RAX); /* cmp rax, rdx */
+          emit_trap_if(ctx, COND_E, TRAP_INTEGER_OVERFLOW);
+        }
+        patch_jump_here(ctx, divide_fixup);
+        emit_rex(ctx, is_64, RAX, RAX);
+        emit_u8(ctx, 0x99); /* cdq or cqo */
+        emit_op_reg(ctx, is_64, 0xf7, (Reg)7, RCX); /* idiv rcx */
+      } else {
+        EMIT_BYTES(ctx, 0x31, 0xd2); /* xor edx, edx */
+        emit_op_reg(ctx, is_64, 0xf7, (Reg)6, RCX); /* div rcx */
+      }
+      if (done_fixup != WASM_INVALID_OFFSET)
+        patch_jump_here(ctx, done_fixup);
+      if (is_rem)
+        emit_op_reg(ctx, is_64, 0x89, RDX, RAX); /* mov rax, rdx */
+      break;
+    }
+
+    case BINOP_COMPARE:
+      emit_op_reg(ctx, is_64, 0x39, RCX, RAX); /* cmp rax, rcx */
+      emit_u8(ctx, 0x0f);
+      emit_u8(ctx, 0x90 | cond);
+      emit_u8(ctx, 0xc0);                /* setcc al */
+      EMIT_BYTES(ctx, 0x0f, 0xb6, 0xc0); /* movzx eax, al */
+      break;
+  }
+}
+
+/* leaves the address of |size| bytes at |rax| + |offset| in |memory_index|
+ * as rdx + rax, or traps. |rax| is the zero-extended i32 address. */
+static WasmBool emit_memory_address(Context* ctx,
+                                    uint32_t memory_index,
+                                    uint32_t offset,
+                                    uint32_t size) {
+  uint64_t memory_disp =
+      (uint64_t)memory_index * sizeof(WasmInterpreterMemory);
+  if (memory_disp > INT32_MAX - sizeof(WasmInterpreterMemory))
+    return WASM_FALSE;
+
+  if (offset) {
+    emit_u8(ctx, 0xb9); /* mov ecx, imm32 */
+    emit_u32(ctx, offset);
+    emit_op_reg(ctx, WASM_TRUE, 0x01, RCX, RAX); /* add rax, rcx */
+  }
+  emit_op_mem(ctx, WASM_TRUE, 0x8b, RDX, R14,
+              offsetof(WasmInterpreterInstance, memories.data));
+  emit_op_mem(ctx, WASM_FALSE, 0x8b, RCX, RDX,
+              memory_disp + offsetof(WasmInterpreterMemory, byte_size));
+  emit_op_mem(ctx, WASM_TRUE, 0x8d, RSI, RAX, size); /* lea rsi, [rax+size] */
+  emit_op_reg(ctx, WASM_TRUE, 0x39, RCX, RSI);       /* cmp rsi, rcx */
+  emit_trap_if(ctx, COND_A, TRAP_MEMORY_ACCESS_OUT_OF_BOUNDS);
+  emit_op_mem(ctx, WASM_TRUE, 0x8b, RDX, RDX,
+              memory_disp + offsetof(WasmInterpreterMemory, data));
+  return WASM_TRUE;
+}
+
+/* returns the form of a memory 0 load or store that has a memory index
+ * operand, or |opcode| itself if it isn't one */
+static uint8_t get_general_memory_opcode(uint8_t opcode) {
+  switch (opcode) {
+#define V(NAME, type, mem_type, text) \
+  case WASM_OPCODE_##NAME##_MEM0:     \
+    return WASM_OPCODE_##NAME;
+    WASM_FOREACH_MEMORY0_LOAD(V)
+    WASM_FOREACH_MEMORY0_STORE(V)
+#undef V
+    default:
+      return opcode;
+  }
+}
+
+static WasmBool is_memory0_opcode(uint8_t opcode) {
+  return get_general_memory_opcode(opcode) != opcode;
+}
+
+/* the number of bytes that a load reads, and whether its result is 64 bits */
+static void get_load_info(uint8_t opcode,
+                          uint32_t* out_size,
+                          WasmBool* out_is_64) {
+  switch (opcode) {
+    case WASM_OPCODE_I32_LOAD8_S:
+    case WASM_OPCODE_I32_LOAD8_U:
+      *out_size = 1;
+      *out_is_64 = WASM_FALSE;
+      break;
+
+    case WASM_OPCODE_I64_LOAD8_S:
+    case WASM_OPCODE_I64_LOAD8_U:
+      *out_size = 1;
+      *out_is_64 = WASM_TRUE;
+      break;
+
+    case WASM_OPCODE_I32_LOAD16_S:
+    case WASM_OPCODE_I32_LOAD16_U:
+      *out_size = 2;
+      *out_is_64 = WASM_FALSE;
+      break;
+
+    case WASM_OPCODE_I64_LOAD16_S:
+    case WASM_OPCODE_I64_LOAD16_U:
+      *out_size = 2;
+      *out_is_64 = WASM_TRUE;
+      break;
+
+    case WASM_OPCODE_I32_LOAD:
+    case WASM_OPCODE_F32_LOAD:
+      *out_size = 4;
+      *out_is_64 = WASM_FALSE;
+      break;
+
+    case WASM_OPCODE_I64_LOAD32_S:
+    case WASM_OPCODE_I64_LOAD32_U:
+      *out_size = 4;
+      *out_is_64 = WASM_TRUE;
+      break;
+
+    case WASM_OPCODE_I64_LOAD:
+    case WASM_OPCODE_F64_LOAD:
+      *out_size = 8;
+      *out_is_64 = WASM_TRUE;
+      break;
+
+    default:
+      assert(0);
+      break;
+  }
+}
+
+/* loads into rax from [rdx + rax], extended as |opcode| says */
+static void emit_load_from_memory(Context* ctx, uint8_t opcode) {
+  switch (opcode) {
+    case WASM_OPCODE_I32_LOAD8_S:
+      EMIT_BYTES(ctx, 0x0f, 0xbe, 0x04, 0x02); /* movsx eax, byte */
+      break;
+
+    case WASM_OPCODE_I64_LOAD8_S:
+      EMIT_BYTES(ctx, 0x48, 0x0f, 0xbe, 0x04, 0x02); /* movsx rax, byte */
+      break;
+
+    case WASM_OPCODE_I32_LOAD8_U:
+    case WASM_OPCODE_I64_LOAD8_U:
+      EMIT_BYTES(ctx, 0x0f, 0xb6, 0x04, 0x02); /* movzx eax, byte */
+      break;
+
+    case WASM_OPCODE_I32_LOAD16_S:
+      EMIT_BYTES(ctx, 0x0f, 0xbf, 0x04, 0x02); /* movsx eax, word */
+      break;
+
+    case WASM_OPCODE_I64_LOAD16_S:
+      EMIT_BYTES(ctx, 0x48, 0x0f, 0xbf, 0x04, 0x02); /* movsx rax, word */
+      break;
+
+    case WASM_OPCODE_I32_LOAD16_U:
+    case WASM_OPCODE_I64_LOAD16_U:
+      EMIT_BYTES(ctx, 0x0f, 0xb7, 0x04, 0x02); /* movzx eax, word */
+      break;
+
+    case WASM_OPCODE_I64_LOAD32_S:
+      EMIT_BYTES(ctx, 0x48, 0x63, 0x04, 0x02); /* movsxd rax, dword */
+      break;
+
+    case WASM_OPCODE_I32_LOAD:
+    case WASM_OPCODE_F32_LOAD:
+    case WASM_OPCODE_I64_LOAD32_U:
+      EMIT_BYTES(ctx, 0x8b, 0x04, 0x02); /* mov eax, dword */
+      break;
+
+    case WASM_OPCODE_I64_LOAD:
+    case WASM_OPCODE_F64_LOAD:
+      EMIT_BYTES(ctx, 0x48, 0x8b, 0x04, 0x02); /* mov rax, qword */
+      break;
+
+    default:
+      assert(0);
+      break;
+  }
+}
+
+static WasmBool get_store_size(uint8_t opcode, uint32_t* out_size) {
+  switch (opcode) {
+    case WASM_OPCODE_I32_STORE8:
+    case WASM_OPCODE_I64_STORE8:
+      *out_size = 1;
+      return WASM_TRUE;
+
+    case WASM_OPCODE_I32_STORE16:
+    case WASM_OPCODE_I64_STORE16:
+      *out_size = 2;
+      return WASM_TRUE;
+
+    case WASM_OPCODE_I32_STORE:
+    case WASM_OPCODE_I64_STORE32:
+    case WASM_OPCODE_F32_STORE:
+      *out_size = 4;
+      return WASM_TRUE;
+
+    case WASM_OPCODE_I64_STORE:
+    case WASM_OPCODE_F64_STORE:
+      *out_size = 8;
+      return WASM_TRUE;
+
+    default:
+      return WASM_FALSE;
+  }
+}
+
+/* stores the low |size| bytes of rcx to [rdx + rax] */
+static void emit_store_to_memory(Context* ctx, uint32_t size) {
+  switch (size) {
+    case 1:
+      EMIT_BYTES(ctx, 0x88, 0x0c, 0x02);
+      break;
+    case 2:
+      EMIT_BYTES(ctx, 0x66, 0x89, 0x0c, 0x02);
+      break;
+    case 4:
+      EMIT_BYTES(ctx, 0x89, 0x0c, 0x02);
+      break;
+    case 8:
+      EMIT_BYTES(ctx, 0x48, 0x89, 0x0c, 0x02);
+      break;
+    default:
+      assert(0);
+      break;
+  }
+}
+
+static void emit_drop_keep(Context* ctx, uint32_t drop, uint8_t keep) {
+  assert(keep <= 1);
+  if (keep == 1 && drop > 0) {
+    emit_load_slot(ctx, WASM_TRUE, RAX, 1);
+    emit_store_slot(ctx, WASM_TRUE, drop + 1, RAX);
+  }
+  emit_adjust_top(ctx, -(int32_t)drop);
+}
+
+static void emit_alloca(Context* ctx,
+                        uint32_t local_count,
+                        uint32_t max_stack_height) {
+  emit_op_mem(ctx, WASM_TRUE, 0x8b, RAX, R15,
+              offsetof(WasmInterpreterThread, value_stack_end));
+  emit_op_reg(ctx, WASM_TRUE, 0x29, RBX, RAX); /* sub rax, rbx */
+  EMIT_BYTES(ctx, 0x48, 0x3d); /* cmp rax, imm32 */
+  emit_u32(ctx, max_stack_height * VALUE_SIZE);
+  emit_trap_if(ctx, COND_B, TRAP_VALUE_STACK_EXHAUSTED);
+
+  if (local_count == 0)
+    return;
+  EMIT_BYTES(ctx, 0x31, 0xc0); /* xor eax, eax */
+  if (local_count <= MAX_UNROLLED_LOCALS) {
+    uint32_t i;
+    for (i = 0; i < local_count; ++i)
+      emit_op_mem(ctx, WASM_TRUE, 0x89, RAX, RBX, i * VALUE_SIZE);
+  } else {
+    emit_op_reg(ctx, WASM_TRUE, 0x89, RBX, RDI); /* mov rdi, rbx */
+    emit_u8(ctx, 0xb9); /* mov ecx, imm32 */
+    emit_u32(ctx, local_count);
+    EMIT_BYTES(ctx, 0xf3, 0x48, 0xab); /* rep stosq */
+  }
+  emit_adjust_top(ctx, local_count);
+}
+
+/* Function entries are charged by the interpreter, since every call enters
+ * through the callee's ALLOCA or JIT_ENTRY, so only loops charge in native
+ * code. When the fuel is gone, the interpreter runs the CHARGE_FUEL at |pc|
+ * again and stops there. */
+static void emit_charge_fuel(Context* ctx, uint32_t pc, uint32_t cost) {
+  emit_op_mem(ctx, WASM_TRUE, 0x8b, RAX, R15,
+              offsetof(WasmInterpreterThread, fuel));
+  EMIT_BYTES(ctx, 0x48, 0x85, 0xc0); /* test rax, rax */
+  uint32_t has_fuel = emit_jcc_forward(ctx, COND_G);
+  emit_exit(ctx, pc);
+  patch_jump_here(ctx, has_fuel);
+  EMIT_BYTES(ctx, 0x48, 0x2d); /* sub rax, imm32 */
+  emit_u32(ctx, cost);
+  emit_op_mem(ctx, WASM_TRUE, 0x89, RAX, R15,
+              offsetof(WasmInterpreterThread, fuel));
+}
+
+static void emit_call(Context* ctx, uint32_t callee_offset) {
+  emit_op_mem(ctx, WASM_TRUE, 0x8b, RAX, R15,
+              offsetof(WasmInterpreterThread, call_stack_top));
+  emit_op_mem(ctx, WASM_TRUE, 0x3b, RAX, R15,
+              offsetof(WasmInterpreterThread, call_stack_end));
+  emit_trap_if(ctx, COND_AE, TRAP_CALL_STACK_EXHAUSTED);
+  uint32_t resume_point_index =
+      ctx->env->jit_resume_points.size + ctx->resume_points.size;
+  EMIT_BYTES(ctx, 0xc7, 0x00); /* mov dword [rax], imm32 */
+  emit_u32(ctx, resume_point_index | WASM_JIT_RESUME_POINT_BIT);
+  EMIT_BYTES(ctx, 0x48, 0x83, 0xc0, sizeof(uint32_t)); /* add rax, imm8 */
+  emit_op_mem(ctx, WASM_TRUE, 0x89, RAX, R15,
+              offsetof(WasmInterpreterThread, call_stack_top));
+  emit_exit(ctx, callee_offset);
+
+  /* the callee's return continues with the next instruction */
+  WasmInterpreterJitResumePoint* point = wasm_append_interpreter_jit_resume_point(
+      ctx->allocator, &ctx->resume_points);
+  point->func_index = ctx->func_index;
+  point->code_offset = get_code_offset(ctx);
+}
+
+static void emit_br_table(Context* ctx,
+                          uint32_t num_targets,
+                          uint32_t table_offset) {
+  emit_load_slot(ctx, WASM_FALSE, RAX, 1);
+  emit_adjust_top(ctx, -1);
+  /* out of range keys use the last entry */
+  emit_u8(ctx, 0x3d); /* cmp eax, imm32 */
+  emit_u32(ctx, num_targets);
+  emit_u8(ctx, 0xb9); /* mov ecx, imm32 */
+  emit_u32(ctx, num_targets);
+  EMIT_BYTES(ctx, 0x0f, 0x43, 0xc1); /* cmovae eax, ecx */
+  EMIT_BYTES(ctx, 0x48, 0x8d, 0x0d); /* lea rcx, [rip + table] */
+  uint32_t table_fixup = get_code_offset(ctx);
+  emit_u32(ctx, 0);
+  EMIT_BYTES(ctx, 0x48, 0x63, 0x04, 0x81, /* movsxd rax, [rcx + rax * 4] */
+             0x48, 0x01, 0xc8,             /* add rax, rcx */
+             0xff, 0xe0);                  /* jmp rax */
+
+  /* the table holds the offset of each entry's code from the table */
+  uint32_t table_start = get_code_offset(ctx);
+  patch_jump_here(ctx, table_fixup);
+  uint32_t i;
+  for (i = 0; i <= num_targets; ++i)
+    emit_u32(ctx, 0);
+  for (i = 0; i <= num_targets; ++i) {
+    patch_u32(ctx, table_start + i * sizeof(uint32_t),
+              get_code_offset(ctx) - table_start);
+    const uint8_t* entry =
+        ctx->istream + table_offset + i * WASM_TABLE_ENTRY_SIZE;
+    emit_drop_keep(ctx, read_u32_at(entry + WASM_TABLE_ENTRY_DROP_OFFSET),
+                   entry[WASM_TABLE_ENTRY_KEEP_OFFSET]);
+    emit_jmp_istream(ctx,
+                     read_u32_at(entry + WASM_TABLE_ENTRY_OFFSET_OFFSET));
+  }
+}
+
+/* emits the code for the instruction at |pc|; returns WASM_FALSE if it has
+ * no translation */
+static WasmBool emit_instruction(Context* ctx, const uint8_t* pc) {
+  uint8_t opcode = *pc;
+  const uint8_t* operands = pc + 1;
+  WasmBool is_64;
+  BinopKind kind;
+  Cond cond;
+
+  if (get_integer_binop(opcode, &is_64, &kind, &cond)) {
+    emit_load_slot(ctx, is_64, RAX, 2);
+    emit_load_slot(ctx, is_64, RCX, 1);
+    emit_binop(ctx, is_64, kind, cond);
+    emit_store_slot(ctx, is_64 && kind != BINOP_COMPARE, 2, RAX);
+    emit_adjust_top(ctx, -1);
+    return WASM_TRUE;
+  }
+
+  switch (opcode) {
+    case WASM_OPCODE_ALLOCA:
+    case WASM_OPCODE_JIT_ENTRY:
+      emit_alloca(ctx, read_u32_at(operands),
+                  read_u32_at(operands + sizeof(uint32_t)));
+      break;
+
+    case WASM_OPCODE_CHARGE_FUEL:
+      emit_charge_fuel(ctx, pc - ctx->istream, read_u32_at(operands));
+      break;
+
+    case WASM_OPCODE_NOP:
+    case WASM_OPCODE_DATA:
+    /* an i32 is the low half of a value, and the reinterpretations keep the
+     * bits as they are */
+    case WASM_OPCODE_I32_WRAP_I64:
+    case WASM_OPCODE_I32_REINTERPRET_F32:
+    case WASM_OPCODE_I64_REINTERPRET_F64:
+    case WASM_OPCODE_F32_REINTERPRET_I32:
+    case WASM_OPCODE_F64_REINTERPRET_I64:
+      break;
+
+    case WASM_OPCODE_UNREACHABLE:
+      emit_jmp_to(ctx, ctx->trap_offsets[TRAP_UNREACHABLE]);
+      break;
+
+    case WASM_OPCODE_BR:
+      emit_jmp_istream(ctx, read_u32_at(operands));
+      break;
+
+    case WASM_OPCODE_BR_IF:
+    case WASM_OPCODE_BR_UNLESS:
+      emit_load_slot(ctx, WASM_FALSE, RAX, 1);
+      emit_adjust_top(ctx, -1);
+      EMIT_BYTES(ctx, 0x85, 0xc0); /* test eax, eax */
+      emit_jcc_istream(ctx, opcode == WASM_OPCODE_BR_IF ? COND_NE : COND_E,
+                       read_u32_at(operands));
+      break;
+
+#define V(NAME, sign, op, text) case WASM_OPCODE_BR_UNLESS_##NAME:
+      WASM_FOREACH_BR_UNLESS_COMPARE(V)
+#undef V
+    {
+      uint8_t compare_opcode = 0;
+      switch (opcode) {
+#define V(NAME, sign, op, text)        \
+  case WASM_OPCODE_BR_UNLESS_##NAME:   \
+    compare_opcode = WASM_OPCODE_##NAME; \
+    break;
+        WASM_FOREACH_BR_UNLESS_COMPARE(V)
+#undef V
+      }
+      get_integer_binop(compare_opcode, &is_64, &kind, &cond);
+      emit_load_slot(ctx, WASM_FALSE, RAX, 2);
+      emit_load_slot(ctx, WASM_FALSE, RCX, 1);
+      emit_adjust_top(ctx, -2);
+      emit_op_reg(ctx, WASM_FALSE, 0x39, RCX, RAX); /* cmp eax, ecx */
+      emit_jcc_istream(ctx, INVERT_COND(cond), read_u32_at(operands));
+      break;
+    }
+
+    case WASM_OPCODE_BR_TABLE:
+      emit_br_table(ctx, read_u32_at(operands),
+                    read_u32_at(operands + sizeof(uint32_t)));
+      break;
+
+    case WASM_OPCODE_CALL:
+      emit_call(ctx, read_u32_at(operands));
+      break;
+
+    case WASM_OPCODE_I32_CONST:
+    case WASM_OPCODE_F32_CONST:
+      /* mov dword [rbx], imm32 */
+      emit_op_mem(ctx, WASM_FALSE, 0xc7, (Reg)0, RBX, 0);
+      emit_u32(ctx, read_u32_at(operands));
+      emit_adjust_top(ctx, 1);
+      break;
+
+    case WASM_OPCODE_I64_CONST:
+    case WASM_OPCODE_F64_CONST:
+      EMIT_BYTES(ctx, 0x48, 0xb8); /* mov rax, imm64 */
+      emit_u64(ctx, read_u64_at(operands));
+      emit_store_slot(ctx, WASM_TRUE, 0, RAX);
+      emit_adjust_top(ctx, 1);
+      break;
+
+    case WASM_OPCODE_GET_LOCAL:
+      emit_load_slot(ctx, WASM_TRUE, RAX, read_u32_at(operands));
+      emit_store_slot(ctx, WASM_TRUE, 0, RAX);
+      emit_adjust_top(ctx, 1);
+      break;
+
+    case WASM_OPCODE_SET_LOCAL:
+      /* the depth is counted after popping the value */
+      emit_load_slot(ctx, WASM_TRUE, RAX, 1);
+      emit_store_slot(ctx, WASM_TRUE, read_u32_at(operands) + 1, RAX);
+      emit_adjust_top(ctx, -1);
+      break;
+
+    case WASM_OPCODE_TEE_LOCAL:
+      emit_load_slot(ctx, WASM_TRUE, RAX, 1);
+      emit_store_slot(ctx, WASM_TRUE, read_u32_at(operands), RAX);
+      break;
+
+    case WASM_OPCODE_GET_GLOBAL:
+    case WASM_OPCODE_SET_GLOBAL: {
+      uint64_t disp =
+          (uint64_t)read_u32_at(operands) * sizeof(WasmInterpreterGlobal) +
+          offsetof(WasmInterpreterGlobal, typed_value.value);
+      if (disp > INT32_MAX)
+        return WASM_FALSE;
+      emit_op_mem(ctx, WASM_TRUE, 0x8b, RAX, R14,
+                  offsetof(WasmInterpreterInstance, globals.data));
+      if (opcode == WASM_OPCODE_GET_GLOBAL) {
+        emit_op_mem(ctx, WASM_TRUE, 0x8b, RCX, RAX, disp);
+        emit_store_slot(ctx, WASM_TRUE, 0, RCX);
+        emit_adjust_top(ctx, 1);
+      } else {
+        emit_load_slot(ctx, WASM_TRUE, RCX, 1);
+        emit_op_mem(ctx, WASM_TRUE, 0x89, RCX, RAX, disp);
+        emit_adjust_top(ctx, -1);
+      }
+      break;
+    }
+
+    case WASM_OPCODE_DROP:
+      emit_adjust_top(ctx, -1);
+      break;
+
+    case WASM_OPCODE_DROP_KEEP:
+      emit_drop_keep(ctx, read_u32_at(operands),
+                     operands[sizeof(uint32_t)]);
+      break;
+
+    case WASM_OPCODE_SELECT:
+      emit_load_slot(ctx, WASM_FALSE, RAX, 1);
+      emit_load_slot(ctx, WASM_TRUE, RCX, 2);
+      emit_load_slot(ctx, WASM_TRUE, RDX, 3);
+      EMIT_BYTES(ctx, 0x85, 0xc0,              /* test eax, eax */
+                 0x48, 0x0f, 0x44, 0xd1);      /* cmove rdx, rcx */
+      emit_store_slot(ctx, WASM_TRUE, 3, RDX);
+      emit_adjust_top(ctx, -2);
+      break;
+
+    case WASM_OPCODE_I32_EQZ:
+    case WASM_OPCODE_I64_EQZ:
+      is_64 = opcode == WASM_OPCODE_I64_EQZ;
+      emit_load_slot(ctx, is_64, RAX, 1);
+      emit_op_reg(ctx, is_64, 0x85, RAX, RAX); /* test rax, rax */
+      EMIT_BYTES(ctx, 0x0f, 0x94, 0xc0,        /* sete al */
+                 0x0f, 0xb6, 0xc0);            /* movzx eax, al */
+      emit_store_slot(ctx, WASM_FALSE, 1, RAX);
+      break;
+
+    case WASM_OPCODE_I64_EXTEND_S_I32:
+      /* movsxd rax, [rbx - 8] */
+      emit_op_mem(ctx, WASM_TRUE, 0x63, RAX, RBX, get_slot_disp(1));
+      emit_store_slot(ctx, WASM_TRUE, 1, RAX);
+      break;
+
+    case WASM_OPCODE_I64_EXTEND_U_I32:
+      emit_load_slot(ctx, WASM_FALSE, RAX, 1);
+      emit_store_slot(ctx, WASM_TRUE, 1, RAX);
+      break;
+
+    case WASM_OPCODE_I32_LOAD8_S:
+    case WASM_OPCODE_I32_LOAD8_U:
+    case WASM_OPCODE_I32_LOAD16_S:
+    case WASM_OPCODE_I32_LOAD16_U:
+    case WASM_OPCODE_I64_LOAD8_S:
+    case WASM_OPCODE_I64_LOAD8_U:
+    case WASM_OPCODE_I64_LOAD16_S:
+    case WASM_OPCODE_I64_LOAD16_U:
+    case WASM_OPCODE_I64_LOAD32_S:
+    case WASM_OPCODE_I64_LOAD32_U:
+    case WASM_OPCODE_I32_LOAD:
+    case WASM_OPCODE_I64_LOAD:
+    case WASM_OPCODE_F32_LOAD:
+    case WASM_OPCODE_F64_LOAD:
+    case WASM_OPCODE_I32_LOAD_LOCAL:
+    case WASM_OPCODE_I32_LOAD_CONST:
+#define V(NAME, type, mem_type, text) case WASM_OPCODE_##NAME##_MEM0:
+      WASM_FOREACH_MEMORY0_LOAD(V)
+#undef V
+    {
+      /* i32.load_local reads the address from a local and i32.load_const has
+       * none, so both push the result instead of replacing the address on
+       * top of the stack */
+      WasmBool is_local = opcode == WASM_OPCODE_I32_LOAD_LOCAL;
+      WasmBool is_const = opcode == WASM_OPCODE_I32_LOAD_CONST;
+      uint8_t load_opcode = is_local || is_const
+                                ? WASM_OPCODE_I32_LOAD
+                                : get_general_memory_opcode(opcode);
+      uint32_t memory_index = 0;
+      if (!is_memory0_opcode(opcode)) {
+        memory_index = read_u32_at(operands);
+        operands += sizeof(uint32_t);
+      }
+      uint32_t address_depth = is_local ? read_u32_at(operands) : 1;
+      uint32_t offset =
+          read_u32_at(operands + (is_local ? sizeof(uint32_t) : 0));
+      uint32_t size;
+      get_load_info(load_opcode, &size, &is_64);
+      if (is_const) {
+        emit_u8(ctx, 0xb8); /* mov eax, imm32 */
+        emit_u32(ctx, offset);
+        offset = 0;
+      } else {
+        emit_load_slot(ctx, WASM_FALSE, RAX, address_depth);
+      }
+      if (!emit_memory_address(ctx, memory_index, offset, size))
+        return WASM_FALSE;
+      emit_load_from_memory(ctx, load_opcode);
+      if (is_local || is_const) {
+        emit_store_slot(ctx, WASM_FALSE, 0, RAX);
+        emit_adjust_top(ctx, 1);
+      } else {
+        emit_store_slot(ctx, is_64, 1, RAX);
+      }
+      break;
+    }
+
+    case WASM_OPCODE_I32_STORE8:
+    case WASM_OPCODE_I32_STORE16:
+    case WASM_OPCODE_I32_STORE:
+    case WASM_OPCODE_I64_STORE8:
+    case WASM_OPCODE_I64_STORE16:
+    case WASM_OPCODE_I64_STORE32:
+    case WASM_OPCODE_I64_STORE:
+    case WASM_OPCODE_F32_STORE:
+    case WASM_OPCODE_F64_STORE:
+#define V(NAME, type, mem_type, text) case WASM_OPCODE_##NAME##_MEM0:
+      WASM_FOREACH_MEMORY0_STORE(V)
+#undef V
+    {
+      uint32_t size;
+      get_store_size(get_general_memory_opcode(opcode), &size);
+      uint32_t memory_index = 0;
+      if (!is_memory0_opcode(opcode)) {
+        memory_index = read_u32_at(operands);
+        operands += sizeof(uint32_t);
+      }
+      emit_load_slot(ctx, WASM_FALSE, RAX, 2);
+      if (!emit_memory_address(ctx, memory_index, read_u32_at(operands),
+                               size)) {
+        return WASM_FALSE;
+      }
+      emit_load_slot(ctx, WASM_TRUE, RCX, 1);
+      emit_store_to_memory(ctx, size);
+      emit_adjust_top(ctx, -2);
+      break;
+    }
+
+    case WASM_OPCODE_I32_ADD_LOCAL_LOCAL:
+      emit_load_slot(ctx, WASM_FALSE, RAX, read_u32_at(operands));
+      emit_load_slot(ctx, WASM_FALSE, RCX,
+                     read_u32_at(operands + sizeof(uint32_t)));
+      emit_binop(ctx, WASM_FALSE, BINOP_ADD, COND_E);
+      emit_store_slot(ctx, WASM_FALSE, 0, RAX);
+      emit_adjust_top(ctx, 1);
+      break;
+
+    case WASM_OPCODE_I32_ADD_CONST:
+      /* add dword [rbx - 8], imm32 */
+      emit_op_mem(ctx, WASM_FALSE, 0x81, (Reg)0, RBX, get_slot_disp(1));
+      emit_u32(ctx, read_u32_at(operands));
+      break;
+
+#define V(NAME, kind, sign, op, text) case WASM_OPCODE_REG_##NAME:
+      WASM_FOREACH_REGISTER_BINOP(V)
+#undef V
+    {
+      uint8_t base_opcode = 0;
+      switch (opcode) {
+#define V(NAME, kind, sign, op, text) \
+  case WASM_OPCODE_REG_##NAME:        \
+    base_opcode = WASM_OPCODE_##NAME; \
+    break;
+        WASM_FOREACH_REGISTER_BINOP(V)
+#undef V
+      }
+      get_integer_binop(base_opcode, &is_64, &kind, &cond);
+      uint32_t dst_depth = read_u32_at(operands);
+      uint32_t drop = operands[3 * sizeof(uint32_t)];
+      emit_load_slot(ctx, WASM_FALSE, RAX,
+                     read_u32_at(operands + sizeof(uint32_t)));
+      emit_load_slot(ctx, WASM_FALSE, RCX,
+                     read_u32_at(operands + 2 * sizeof(uint32_t)));
+      emit_binop(ctx, WASM_FALSE, kind, cond);
+      /* the destination depth is counted after dropping */
+      if (dst_depth == 0) {
+        emit_store_slot(ctx, WASM_FALSE, drop, RAX);
+        emit_adjust_top(ctx, 1 - (int32_t)drop);
+      } else {
+        emit_store_slot(ctx, WASM_FALSE, dst_depth + drop, RAX);
+        emit_adjust_top(ctx, -(int32_t)drop);
+      }
+      break;
+    }
+
+    default:
+      return WASM_FALSE;
+  }
+  return WASM_TRUE;
+}
+
+static WasmBool compile_func(Context* ctx, const WasmInterpreterFunc* func) {
+  uint32_t start = func->defined.offset;
+  uint32_t end = func->defined.end_offset;
+  emit_prologue_and_stubs(ctx);
+  ctx->entry_offset = get_code_offset(ctx);
+
+  const uint8_t* pc = &ctx->istream[start];
+  const uint8_t* pc_end = &ctx->istream[end];
+  while (pc < pc_end) {
+    uint32_t offset = pc - ctx->istream;
+    ctx->code_offsets.data[offset - start] = get_code_offset(ctx);
+    /* instructions without a translation are left to the interpreter */
+    switch (*pc) {
+      case WASM_OPCODE_RETURN:
+      case WASM_OPCODE_CALL_INDIRECT:
+      case WASM_OPCODE_CALL_INDIRECT_QUICKEN:
+      case WASM_OPCODE_CALL_INDIRECT_CACHED:
+      case WASM_OPCODE_CALL_HOST:
+        emit_exit(ctx, offset);
+        break;
+
+      default:
+        if (!emit_instruction(ctx, pc))
+          emit_exit(ctx, offset);
+        break;
+    }
+    pc += wasm_get_interpreter_instruction_size(pc);
+  }
+
+  size_t i;
+  for (i = 0; i < ctx->fixups.size; ++i) {
+    Fixup* fixup = &ctx->fixups.data[i];
+    if (fixup->target < start || fixup->target >= end)
+      return WASM_FALSE;
+    uint32_t code_offset = ctx->code_offsets.data[fixup->target - start];
+    if (code_offset == WASM_INVALID_OFFSET)
+      return WASM_FALSE;
+    patch_u32(ctx, fixup->code_offset,
+              code_offset - (fixup->code_offset + sizeof(uint32_t)));
+  }
+  return WASM_TRUE;
+}
+
+WasmBool wasm_compile_jit_func(WasmAllocator* allocator,
+                               WasmInterpreterEnvironment* env,
+                               uint32_t func_index) {
+  WasmInterpreterFunc* func = &env->funcs.data[func_index];
+  assert(!func->is_host);
+  if ((uint64_t)func->defined.param_and_local_types.size +
+          func->defined.max_stack_height >=
+      MAX_DEPTH) {
+    return WASM_FALSE;
+  }
+
+  Context ctx;
+  WASM_ZERO_MEMORY(ctx);
+  ctx.allocator = allocator;
+  ctx.env = env;
+  ctx.func_index = func_index;
+  ctx.istream = env->istream.start;
+  ctx.istream_start = func->defined.offset;
+  uint32_t istream_size = func->defined.end_offset - func->defined.offset;
+  wasm_new_uint32_array(allocator, &ctx.code_offsets, istream_size);
+  uint32_t i;
+  for (i = 0; i < istream_size; ++i)
+    ctx.code_offsets.data[i] = WASM_INVALID_OFFSET;
+
+  WasmBool result = compile_func(&ctx, func);
+  void* data = MAP_FAILED;
+  if (result) {
+    /* the code is position-independent, so it is copied to pages that are
+     * never writable and executable at the same time */
+    data = mmap(NULL, ctx.code.size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data != MAP_FAILED) {
+      memcpy(data, ctx.code.data, ctx.code.size);
+      if (mprotect(data, ctx.code.size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(data, ctx.code.size);
+        data = MAP_FAILED;
+      }
+    }
+    result = data != MAP_FAILED;
+  }
+
+  if (result) {
+    WasmInterpreterJitCode* code =
+        wasm_alloc(allocator, sizeof(WasmInterpreterJitCode),
+                   WASM_DEFAULT_ALIGN);
+    code->data = data;
+    code->size = ctx.code.size;
+    code->entry_offset = ctx.entry_offset;
+    func->defined.jit_code = code;
+    for (i = 0; i < ctx.resume_points.size; ++i) {
+      wasm_append_interpreter_jit_resume_point_value(
+          allocator, &env->jit_resume_points, &ctx.resume_points.data[i]);
+    }
+  }
+
+  wasm_destroy_uint8_vector(allocator, &ctx.code);
+  wasm_destroy_uint32_array(allocator, &ctx.code_offsets);
+  wasm_destroy_fixup_vector(allocator, &ctx.fixups);
+  wasm_destroy_interpreter_jit_resume_point_vector(allocator,
+                                                   &ctx.resume_points);
+  return result;
+}
+
+void wasm_destroy_jit_code(WasmAllocator* allocator,
+                           WasmInterpreterJitCode* code) {
+  munmap(code->data, code->size);
+  wasm_free(allocator, code);
+}
+
+static WasmInterpreterResult run_jit_code(WasmInterpreterThread* thread,
+                                          const WasmInterpreterJitCode* code,
+                                          uint32_t code_offset,
+                                          uint32_t* out_pc) {
+  JitEntry entry = (JitEntry)(uintptr_t)code->data;
+  return entry(thread, out_pc, (const uint8_t*)code->data + code_offset);
+}
+
+WasmInterpreterResult wasm_run_jit_func(WasmInterpreterThread* thread,
+                                        const WasmInterpreterFunc* func,
+                                        uint32_t* out_pc) {
+  const WasmInterpreterJitCode* code = func->defined.jit_code;
+  return run_jit_code(thread, code, code->entry_offset, out_pc);
+}
+
+WasmInterpreterResult wasm_resume_jit_code(WasmInterpreterThread* thread,
+                                           uint32_t resume_point_index,
+                                           uint32_t* out_pc) {
+  WasmInterpreterEnvironment* env = thread->env;
+  assert(resume_point_index < env->jit_resume_points.size);
+  WasmInterpreterJitResumePoint* point =
+      &env->jit_resume_points.data[resume_point_index];
+  const WasmInterpreterFunc* func = &env->funcs.data[point->func_index];
+  return run_jit_code(thread, func->defined.jit_code, point->code_offset,
+                      out_pc);
+}
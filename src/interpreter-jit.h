@@ -0,0 +1,51 @@
+/*
+ * Copyright 2016 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASM_INTERPRETER_JIT_H_
+#define WASM_INTERPRETER_JIT_H_
+
+#include "interpreter.h"
+
+/* The baseline compiler, only built with WASM_INTERPRETER_JIT. It translates
+ * the istream of one function to x86-64 machine code that works on the
+ * thread's value stack just like the interpreter does, so control can move
+ * between the two at any instruction. Instructions that the compiler doesn't
+ * handle exit back to the interpreter. */
+
+WASM_EXTERN_C_BEGIN
+/* compiles the defined function |func_index| and sets its jit_code. Returns
+ * WASM_FALSE if the function can't be compiled. */
+WasmBool wasm_compile_jit_func(WasmAllocator* allocator,
+                               WasmInterpreterEnvironment* env,
+                               uint32_t func_index);
+void wasm_destroy_jit_code(WasmAllocator* allocator,
+                           struct WasmInterpreterJitCode* code);
+
+/* These run native code until it exits to the interpreter, and return the
+ * istream offset to continue at in |out_pc|. The value stack pointer is read
+ * from and written back to |thread|. wasm_run_jit_func enters |func| at its
+ * start, where the interpreter would execute its ALLOCA. */
+WasmInterpreterResult wasm_run_jit_func(WasmInterpreterThread* thread,
+                                        const WasmInterpreterFunc* func,
+                                        uint32_t* out_pc);
+/* continues after a direct call, at the index of a resume point that was
+ * popped from the call stack */
+WasmInterpreterResult wasm_resume_jit_code(WasmInterpreterThread* thread,
+                                           uint32_t resume_point_index,
+                                           uint32_t* out_pc);
+WASM_EXTERN_C_END
+
+#endif /* WASM_INTERPRETER_JIT_H_ */
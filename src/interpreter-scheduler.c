@@ -0,0 +1,292 @@
+/*
+ * Copyright 2016 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "interpreter-scheduler.h"
+
+#include <assert.h>
+
+typedef struct Worker {
+  WasmInterpreterScheduler* scheduler;
+  uint32_t index;
+} Worker;
+
+/* the worker running on this OS thread, if any; a task that it schedules
+ * goes on its own queue */
+static __thread Worker* s_current_worker;
+
+WasmResult wasm_init_interpreter_scheduler(
+    WasmAllocator* allocator,
+    WasmInterpreterScheduler* scheduler,
+    const WasmInterpreterSchedulerOptions* options) {
+  WASM_ZERO_MEMORY(*scheduler);
+  scheduler->allocator = allocator;
+  scheduler->options = *options;
+#if WASM_INTERPRETER_JIT
+  scheduler->options.worker_count = 1;
+#endif
+  if (scheduler->options.worker_count == 0)
+    scheduler->options.worker_count = 1;
+  if (scheduler->options.quantum <= 0)
+    return WASM_ERROR;
+
+  uint32_t worker_count = scheduler->options.worker_count;
+  scheduler->queues =
+      wasm_alloc_zero(allocator, worker_count * sizeof(WasmInterpreterRunQueue),
+                      WASM_DEFAULT_ALIGN);
+  uint32_t i;
+  for (i = 0; i < worker_count; ++i)
+    pthread_mutex_init(&scheduler->queues[i].mutex, NULL);
+  pthread_mutex_init(&scheduler->mutex, NULL);
+  pthread_cond_init(&scheduler->cond, NULL);
+  return WASM_OK;
+}
+
+void wasm_destroy_interpreter_scheduler(WasmInterpreterScheduler* scheduler) {
+  assert(scheduler->pending_count == 0);
+  uint32_t i;
+  for (i = 0; i < scheduler->options.worker_count; ++i)
+    pthread_mutex_destroy(&scheduler->queues[i].mutex);
+  wasm_free(scheduler->allocator, scheduler->queues);
+  pthread_mutex_destroy(&scheduler->mutex);
+  pthread_cond_destroy(&scheduler->cond);
+}
+
+static void push_task(WasmInterpreterScheduler* scheduler,
+                      uint32_t queue_index,
+                      WasmInterpreterTask* task) {
+  WasmInterpreterRunQueue* queue = &scheduler->queues[queue_index];
+  uint32_t priority = task->priority;
+  task->next = NULL;
+  pthread_mutex_lock(&queue->mutex);
+  if (queue->last[priority])
+    queue->last[priority]->next = task;
+  else
+    queue->first[priority] = task;
+  queue->last[priority] = task;
+  /* the count is changed while the queue is still locked, so that a worker
+   * can't take the task and decrement it first. A queue's mutex may be held
+   * while the scheduler's is taken, but not the other way around. */
+  pthread_mutex_lock(&scheduler->mutex);
+  scheduler->queued_count++;
+  pthread_cond_signal(&scheduler->cond);
+  pthread_mutex_unlock(&scheduler->mutex);
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+static WasmInterpreterTask* pop_task(WasmInterpreterScheduler* scheduler,
+                                     uint32_t queue_index,
+                                     uint32_t priority) {
+  WasmInterpreterRunQueue* queue = &scheduler->queues[queue_index];
+  pthread_mutex_lock(&queue->mutex);
+  WasmInterpreterTask* task = queue->first[priority];
+  if (task) {
+    queue->first[priority] = task->next;
+    if (!task->next)
+      queue->last[priority] = NULL;
+    pthread_mutex_lock(&scheduler->mutex);
+    assert(scheduler->queued_count > 0);
+    scheduler->queued_count--;
+    task->running = WASM_TRUE;
+    pthread_mutex_unlock(&scheduler->mutex);
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return task;
+}
+
+/* takes the highest priority task, preferring the worker's own queue and
+ * then stealing from the next workers' queues in turn */
+static WasmInterpreterTask* take_task(Worker* worker) {
+  WasmInterpreterScheduler* scheduler = worker->scheduler;
+  uint32_t worker_count = scheduler->options.worker_count;
+  uint32_t priority;
+  for (priority = WASM_INTERPRETER_NUM_PRIORITIES; priority > 0; --priority) {
+    uint32_t i;
+    for (i = 0; i < worker_count; ++i) {
+      WasmInterpreterTask* task = pop_task(
+          scheduler, (worker->index + i) % worker_count, priority - 1);
+      if (task)
+        return task;
+    }
+  }
+  return NULL;
+}
+
+/* the queue for a task that is scheduled or resumed on this OS thread */
+static uint32_t choose_queue(WasmInterpreterScheduler* scheduler) {
+  if (s_current_worker && s_current_worker->scheduler == scheduler)
+    return s_current_worker->index;
+  pthread_mutex_lock(&scheduler->mutex);
+  uint32_t queue_index = scheduler->next_queue;
+  scheduler->next_queue =
+      (scheduler->next_queue + 1) % scheduler->options.worker_count;
+  pthread_mutex_unlock(&scheduler->mutex);
+  return queue_index;
+}
+
+void wasm_schedule_interpreter_task(WasmInterpreterScheduler* scheduler,
+                                    WasmInterpreterTask* task) {
+  assert(task->priority < WASM_INTERPRETER_NUM_PRIORITIES);
+  task->fuel_used = 0;
+  pthread_mutex_lock(&scheduler->mutex);
+  scheduler->pending_count++;
+  pthread_mutex_unlock(&scheduler->mutex);
+  push_task(scheduler, choose_queue(scheduler), task);
+}
+
+static void finish_task(WasmInterpreterScheduler* scheduler,
+                        WasmInterpreterTask* task,
+                        WasmInterpreterResult result) {
+  task->result = result;
+  if (task->on_done)
+    task->on_done(task, task->user_data);
+
+  pthread_mutex_lock(&scheduler->mutex);
+  if (--scheduler->pending_count == 0)
+    pthread_cond_broadcast(&scheduler->cond);
+  pthread_mutex_unlock(&scheduler->mutex);
+}
+
+/* |task| has suspended and its worker is done with it */
+static void resume_task(WasmInterpreterScheduler* scheduler,
+                        WasmInterpreterTask* task,
+                        const WasmInterpreterTypedValue* results,
+                        uint32_t num_results) {
+  WasmInterpreterResult result =
+      wasm_resume_host_call(task->thread, results, num_results);
+  if (result != WASM_INTERPRETER_OK) {
+    finish_task(scheduler, task, result);
+    return;
+  }
+  push_task(scheduler, choose_queue(scheduler), task);
+}
+
+void wasm_resume_interpreter_task(WasmInterpreterScheduler* scheduler,
+                                  WasmInterpreterTask* task,
+                                  const WasmInterpreterTypedValue* results,
+                                  uint32_t num_results) {
+  assert(num_results <= 1);
+  pthread_mutex_lock(&scheduler->mutex);
+  if (task->running) {
+    /* the worker resumes it once wasm_run_interpreter has returned */
+    task->resumed_while_running = WASM_TRUE;
+    task->early_num_results = num_results;
+    if (num_results)
+      task->early_result = results[0];
+    pthread_mutex_unlock(&scheduler->mutex);
+    return;
+  }
+  pthread_mutex_unlock(&scheduler->mutex);
+  resume_task(scheduler, task, results, num_results);
+}
+
+/* runs |task| for one quantum, and then either queues it again or finishes
+ * it */
+static void run_task(Worker* worker, WasmInterpreterTask* task) {
+  WasmInterpreterScheduler* scheduler = worker->scheduler;
+  int64_t quantum = scheduler->options.quantum;
+  if (task->fuel != WASM_INTERPRETER_UNLIMITED_FUEL &&
+      task->fuel - task->fuel_used < quantum)
+    quantum = task->fuel - task->fuel_used;
+
+  WasmInterpreterThread* thread = task->thread;
+  thread->fuel = quantum;
+  WasmInterpreterResult result =
+      wasm_run_interpreter(thread, task->call_stack_return_top);
+  task->fuel_used += quantum - thread->fuel;
+
+  pthread_mutex_lock(&scheduler->mutex);
+  task->running = WASM_FALSE;
+  WasmBool resumed = task->resumed_while_running;
+  task->resumed_while_running = WASM_FALSE;
+  pthread_mutex_unlock(&scheduler->mutex);
+
+  if (result == WASM_INTERPRETER_FUEL_EXHAUSTED &&
+      (task->fuel == WASM_INTERPRETER_UNLIMITED_FUEL ||
+       task->fuel_used < task->fuel)) {
+    push_task(scheduler, worker->index, task);
+    return;
+  }
+
+  /* still pending, but only wasm_resume_interpreter_task queues it again */
+  if (result == WASM_INTERPRETER_SUSPENDED) {
+    if (resumed) {
+      resume_task(scheduler, task, &task->early_result,
+                  task->early_num_results);
+    }
+    return;
+  }
+
+  finish_task(scheduler, task, result);
+}
+
+static void* run_worker(void* arg) {
+  Worker* worker = arg;
+  WasmInterpreterScheduler* scheduler = worker->scheduler;
+  Worker* prev_worker = s_current_worker;
+  s_current_worker = worker;
+  for (;;) {
+    WasmInterpreterTask* task = take_task(worker);
+    if (task) {
+      run_task(worker, task);
+      continue;
+    }
+
+    /* a task queued after take_task looked is counted, so it isn't missed */
+    WasmBool done;
+    pthread_mutex_lock(&scheduler->mutex);
+    while (scheduler->queued_count == 0 && scheduler->pending_count != 0)
+      pthread_cond_wait(&scheduler->cond, &scheduler->mutex);
+    done = scheduler->pending_count == 0;
+    pthread_mutex_unlock(&scheduler->mutex);
+    if (done)
+      break;
+  }
+  s_current_worker = prev_worker;
+  return NULL;
+}
+
+WasmResult wasm_run_interpreter_scheduler(WasmInterpreterScheduler* scheduler) {
+  WasmAllocator* allocator = scheduler->allocator;
+  uint32_t worker_count = scheduler->options.worker_count;
+  Worker* workers = wasm_alloc(allocator, worker_count * sizeof(Worker),
+                               WASM_DEFAULT_ALIGN);
+  pthread_t* os_threads = wasm_alloc_zero(
+      allocator, worker_count * sizeof(pthread_t), WASM_DEFAULT_ALIGN);
+  WasmResult result = WASM_OK;
+  uint32_t started_count;
+  for (started_count = 1; started_count < worker_count; ++started_count) {
+    Worker* worker = &workers[started_count];
+    worker->scheduler = scheduler;
+    worker->index = started_count;
+    if (pthread_create(&os_threads[started_count], NULL, run_worker, worker) !=
+        0) {
+      /* the workers that did start, and the caller, take its tasks */
+      result = WASM_ERROR;
+      break;
+    }
+  }
+
+  workers[0].scheduler = scheduler;
+  workers[0].index = 0;
+  run_worker(&workers[0]);
+
+  uint32_t i;
+  for (i = 1; i < started_count; ++i)
+    pthread_join(os_threads[i], NULL);
+  wasm_free(allocator, os_threads);
+  wasm_free(allocator, workers);
+  return result;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2016 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASM_INTERPRETER_SCHEDULER_H_
+#define WASM_INTERPRETER_SCHEDULER_H_
+
+#include <pthread.h>
+
+#include "interpreter.h"
+
+/* Runs many interpreter threads as green threads over a few OS threads, only
+ * built with WASM_INTERPRETER_SCHEDULER. Each task runs for a quantum of fuel
+ * at a time and then goes to the back of its worker's run queue, so tasks of
+ * the same priority share the workers in proportion to fuel rather than to
+ * wall-clock time. A worker takes the highest priority task it can find,
+ * from its own queue first and then from the other workers' queues, so a
+ * lower priority task only runs when no higher priority task is waiting. A
+ * task whose host function suspends it waits outside the queues, without
+ * holding up a worker, until wasm_resume_interpreter_task.
+ *
+ * Tasks that run at the same time must not share an instance, and their
+ * threads' allocator must be safe to use from several OS threads. With
+ * WASM_INTERPRETER_JIT all tasks run on the calling thread, since the JIT
+ * patches the environment. */
+
+#define WASM_INTERPRETER_NUM_PRIORITIES 4
+
+struct WasmInterpreterTask;
+
+typedef void (*WasmInterpreterTaskDoneCallback)(
+    struct WasmInterpreterTask* task,
+    void* user_data);
+
+typedef struct WasmInterpreterTask {
+  /* the thread to run, from its pc until the function that
+   * |call_stack_return_top| belongs to returns, like wasm_run_interpreter */
+  WasmInterpreterThread* thread;
+  uint32_t* call_stack_return_top;
+  uint32_t priority; /* < WASM_INTERPRETER_NUM_PRIORITIES, higher runs first */
+  /* the most fuel the task may use over all of its quanta, or
+   * WASM_INTERPRETER_UNLIMITED_FUEL */
+  int64_t fuel;
+
+  /* set once the task is done, just before |on_done| is called from the
+   * worker that ran it. |on_done| may schedule more tasks. */
+  WasmInterpreterResult result;
+  int64_t fuel_used;
+  WasmInterpreterTaskDoneCallback on_done;
+  void* user_data;
+
+  /* used by the scheduler */
+  struct WasmInterpreterTask* next; /* in a run queue */
+  WasmBool running;
+  /* a task can be resumed before its worker has seen it suspend; the result
+   * of the host call is kept until then. Functions have at most one. */
+  WasmBool resumed_while_running;
+  uint32_t early_num_results;
+  WasmInterpreterTypedValue early_result;
+} WasmInterpreterTask;
+
+typedef struct WasmInterpreterRunQueue {
+  pthread_mutex_t mutex;
+  WasmInterpreterTask* first[WASM_INTERPRETER_NUM_PRIORITIES];
+  WasmInterpreterTask* last[WASM_INTERPRETER_NUM_PRIORITIES];
+} WasmInterpreterRunQueue;
+
+#define WASM_INTERPRETER_SCHEDULER_OPTIONS_DEFAULT \
+  { 1, 10000 }
+
+typedef struct WasmInterpreterSchedulerOptions {
+  uint32_t worker_count; /* OS threads, including the caller's */
+  int64_t quantum;       /* fuel that a task runs for at a time */
+} WasmInterpreterSchedulerOptions;
+
+typedef struct WasmInterpreterScheduler {
+  WasmAllocator* allocator;
+  WasmInterpreterSchedulerOptions options;
+  WasmInterpreterRunQueue* queues; /* one for each worker */
+  /* guards the counts; workers without a task wait on |cond| until one is
+   * queued or all are done */
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  size_t queued_count;  /* tasks in run queues */
+  size_t pending_count; /* tasks scheduled and not done yet */
+  uint32_t next_queue;  /* for tasks scheduled from outside the workers */
+} WasmInterpreterScheduler;
+
+WASM_EXTERN_C_BEGIN
+WasmResult wasm_init_interpreter_scheduler(
+    WasmAllocator* allocator,
+    WasmInterpreterScheduler* scheduler,
+    const WasmInterpreterSchedulerOptions* options);
+void wasm_destroy_interpreter_scheduler(WasmInterpreterScheduler* scheduler);
+/* queues |task|, which stays owned by the caller and must stay alive until
+ * it is done. This may be called from any thread, including from a task's
+ * host functions and |on_done|. */
+void wasm_schedule_interpreter_task(WasmInterpreterScheduler* scheduler,
+                                    WasmInterpreterTask* task);
+/* runs the workers, on the calling thread and worker_count - 1 new ones,
+ * until every scheduled task is done */
+WasmResult wasm_run_interpreter_scheduler(WasmInterpreterScheduler* scheduler);
+/* passes the results of the host call that suspended |task| to
+ * wasm_resume_host_call, and queues the task again. It may be called from
+ * any thread while the scheduler runs, even from the host function itself. A
+ * task that fails to resume is done, and its |on_done| may be called on the
+ * calling thread. */
+void wasm_resume_interpreter_task(WasmInterpreterScheduler* scheduler,
+                                  WasmInterpreterTask* task,
+                                  const WasmInterpreterTypedValue* results,
+                                  uint32_t num_results);
+WASM_EXTERN_C_END
+
+#endif /* WASM_INTERPRETER_SCHEDULER_H_ */
@@ -14,26 +14,69 @@
  * limitations under the License.
  */
 
+/* for memfd_create */
+#define _GNU_SOURCE
+
 #include "interpreter.h"
 
 #include <assert.h>
 #include <inttypes.h>
 #include <math.h>
 
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#if HAVE_MEMFD_CREATE
+#include <unistd.h>
+#endif
+
+#if WASM_INTERPRETER_GUARD_PAGES
+#include <setjmp.h>
+#include <signal.h>
+#endif
+
+#include "binary-reader-interpreter.h"
+#if WASM_INTERPRETER_JIT
+#include "interpreter-jit.h"
+#endif
 #include "stream.h"
 
 #define INITIAL_ISTREAM_CAPACITY (64 * 1024)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+/* address space reserved for a memory without a declared maximum: 256MiB */
+#define UNBOUNDED_MEMORY_RESERVATION_PAGES 4096
 
-#define V(rtype, type1, type2, mem_size, code, NAME, text) [code] = text,
 static const char* s_interpreter_opcode_name[] = {
+#define V(rtype, type1, type2, mem_size, code, NAME, text) [code] = text,
     WASM_FOREACH_OPCODE(V)
+#undef V
     [WASM_OPCODE_ALLOCA] = "alloca",
+    [WASM_OPCODE_JIT_ENTRY] = "jit_entry",
+    [WASM_OPCODE_CHARGE_FUEL] = "charge_fuel",
     [WASM_OPCODE_BR_UNLESS] = "br_unless",
+#define V(NAME, sign, op, text) \
+  [WASM_OPCODE_BR_UNLESS_##NAME] = "br_unless_" text,
+    WASM_FOREACH_BR_UNLESS_COMPARE(V)
+#undef V
+    [WASM_OPCODE_I32_ADD_LOCAL_LOCAL] = "i32.add_local_local",
+    [WASM_OPCODE_I32_ADD_CONST] = "i32.add_const",
+    [WASM_OPCODE_I32_LOAD_LOCAL] = "i32.load_local",
+    [WASM_OPCODE_I32_LOAD_CONST] = "i32.load_const",
+#define V(NAME, kind, sign, op, text) [WASM_OPCODE_REG_##NAME] = "reg." text,
+    WASM_FOREACH_REGISTER_BINOP(V)
+#undef V
+#define V(NAME, type, mem_type, text) [WASM_OPCODE_##NAME##_MEM0] = text "_mem0",
+    WASM_FOREACH_MEMORY0_LOAD(V)
+    WASM_FOREACH_MEMORY0_STORE(V)
+#undef V
     [WASM_OPCODE_CALL_HOST] = "call_host",
     [WASM_OPCODE_DATA] = "data",
     [WASM_OPCODE_DROP_KEEP] = "drop_keep",
+    [WASM_OPCODE_TRANSLATE] = "translate",
+    [WASM_OPCODE_CALL_INDIRECT_QUICKEN] = "call_indirect_quicken",
+    [WASM_OPCODE_CALL_INDIRECT_CACHED] = "call_indirect_cached",
 };
-#undef V
 
 #define CHECK_RESULT(expr) \
   do {                     \
@@ -62,12 +105,23 @@ static void wasm_destroy_interpreter_func_signature(
 static void wasm_destroy_interpreter_func(
     WasmAllocator* allocator,
     WasmInterpreterFunc* func) {
-  if (!func->is_host)
+  if (!func->is_host) {
     wasm_destroy_type_vector(allocator, &func->defined.param_and_local_types);
+#if WASM_INTERPRETER_JIT
+    if (func->defined.jit_code)
+      wasm_destroy_jit_code(allocator, func->defined.jit_code);
+#endif
+  }
 }
 
 static void wasm_destroy_interpreter_memory(WasmAllocator* unused,
                                             WasmInterpreterMemory* memory) {
+#if HAVE_SYS_MMAN_H
+  if (memory->reserved_byte_size) {
+    munmap(memory->data, memory->reserved_byte_size);
+    return;
+  }
+#endif
   if (memory->allocator) {
     wasm_free(memory->allocator, memory->data);
   } else {
@@ -80,6 +134,51 @@ static void wasm_destroy_interpreter_table(WasmAllocator* allocator,
   wasm_destroy_uint32_array(allocator, &table->func_indexes);
 }
 
+void wasm_new_interpreter_table_epoch(WasmInterpreterEnvironment* env,
+                                      WasmInterpreterTable* table) {
+  table->epoch = ++env->last_table_epoch;
+}
+
+void wasm_destroy_interpreter_instance(WasmAllocator* allocator,
+                                       WasmInterpreterInstance* instance) {
+  WASM_DESTROY_VECTOR_AND_ELEMENTS(allocator, instance->memories,
+                                   interpreter_memory);
+  WASM_DESTROY_VECTOR_AND_ELEMENTS(allocator, instance->tables,
+                                   interpreter_table);
+  wasm_destroy_interpreter_global_vector(allocator, &instance->globals);
+}
+
+void wasm_destroy_interpreter_snapshot(WasmAllocator* allocator,
+                                       WasmInterpreterSnapshot* snapshot) {
+  wasm_destroy_limits_vector(allocator, &snapshot->memory_limits);
+  WASM_DESTROY_VECTOR_AND_ELEMENTS(allocator, snapshot->tables,
+                                   interpreter_table);
+  wasm_destroy_interpreter_global_vector(allocator, &snapshot->globals);
+#if HAVE_MEMFD_CREATE
+  if (snapshot->memory_fd != -1)
+    close(snapshot->memory_fd);
+#endif
+  if (snapshot->memory_data)
+    wasm_free(allocator, snapshot->memory_data);
+}
+
+static void wasm_destroy_interpreter_data_segment(
+    WasmAllocator* allocator,
+    WasmInterpreterDataSegment* segment) {
+  wasm_free(allocator, segment->data);
+}
+
+static void wasm_destroy_interpreter_instance_template(
+    WasmAllocator* allocator,
+    WasmInterpreterInstanceTemplate* template_) {
+  wasm_destroy_limits_vector(allocator, &template_->memory_limits);
+  wasm_destroy_limits_vector(allocator, &template_->table_limits);
+  wasm_destroy_interpreter_global_vector(allocator, &template_->globals);
+  WASM_DESTROY_VECTOR_AND_ELEMENTS(allocator, template_->data_segments,
+                                   interpreter_data_segment);
+  wasm_destroy_interpreter_elem_vector(allocator, &template_->elems);
+}
+
 static void wasm_destroy_interpreter_import(WasmAllocator* allocator,
                                             WasmInterpreterImport* import) {
   wasm_destroy_string_slice(allocator, &import->module_name);
@@ -94,6 +193,8 @@ static void wasm_destroy_interpreter_module(WasmAllocator* allocator,
   if (!module->is_host) {
     WASM_DESTROY_ARRAY_AND_ELEMENTS(allocator, module->defined.imports,
                                     interpreter_import);
+    if (module->defined.lazy)
+      wasm_destroy_lazy_interpreter_module(allocator, module->defined.lazy);
   }
 }
 
@@ -104,13 +205,87 @@ void wasm_destroy_interpreter_environment(WasmAllocator* allocator,
   WASM_DESTROY_VECTOR_AND_ELEMENTS(allocator, env->sigs,
                                    interpreter_func_signature);
   WASM_DESTROY_VECTOR_AND_ELEMENTS(allocator, env->funcs, interpreter_func);
-  WASM_DESTROY_VECTOR_AND_ELEMENTS(allocator, env->memories,
-                                   interpreter_memory);
-  WASM_DESTROY_VECTOR_AND_ELEMENTS(allocator, env->tables, interpreter_table);
-  wasm_destroy_interpreter_global_vector(allocator, &env->globals);
+  wasm_destroy_interpreter_instance(allocator, &env->instance);
+  wasm_destroy_interpreter_instance_template(allocator,
+                                             &env->instance_template);
   wasm_destroy_output_buffer(&env->istream);
   wasm_destroy_binding_hash(allocator, &env->module_bindings);
   wasm_destroy_binding_hash(allocator, &env->registered_module_bindings);
+  wasm_destroy_binding_hash(allocator, &env->sig_bindings);
+  wasm_destroy_interpreter_jit_resume_point_vector(allocator,
+                                                   &env->jit_resume_points);
+}
+
+/* the key is the param count followed by one byte per param and result type;
+ * the count keeps (i32)->() and ()->(i32) apart */
+static WasmStringSlice make_sig_key(WasmAllocator* allocator,
+                                    uint32_t param_count,
+                                    const WasmType* param_types,
+                                    uint32_t result_count,
+                                    const WasmType* result_types) {
+  size_t length = sizeof(uint32_t) + param_count + result_count;
+  uint8_t* key = wasm_alloc(allocator, length, 1);
+  uint8_t* p = key;
+  memcpy(p, &param_count, sizeof(uint32_t));
+  p += sizeof(uint32_t);
+  uint32_t i;
+  for (i = 0; i < param_count; ++i)
+    *p++ = (uint8_t)param_types[i];
+  for (i = 0; i < result_count; ++i)
+    *p++ = (uint8_t)result_types[i];
+
+  WasmStringSlice result;
+  result.start = (const char*)key;
+  result.length = length;
+  return result;
+}
+
+static void insert_sig_binding(WasmAllocator* allocator,
+                               WasmInterpreterEnvironment* env,
+                               uint32_t sig_index) {
+  WasmInterpreterFuncSignature* sig = &env->sigs.data[sig_index];
+  WasmStringSlice key = make_sig_key(
+      allocator, sig->param_types.size, sig->param_types.data,
+      sig->result_types.size, sig->result_types.data);
+  wasm_insert_binding(allocator, &env->sig_bindings, &key)->index = sig_index;
+}
+
+/* returns the index in |env->sigs| of the signature with the given types,
+ * appending it if there isn't one yet */
+uint32_t wasm_intern_interpreter_func_signature(
+    WasmAllocator* allocator,
+    WasmInterpreterEnvironment* env,
+    uint32_t param_count,
+    const WasmType* param_types,
+    uint32_t result_count,
+    const WasmType* result_types) {
+  WasmStringSlice key = make_sig_key(allocator, param_count, param_types,
+                                     result_count, result_types);
+  int index = wasm_find_binding_index_by_name(&env->sig_bindings, &key);
+  if (index != -1) {
+    wasm_destroy_string_slice(allocator, &key);
+    return index;
+  }
+
+  WasmInterpreterFuncSignature* sig =
+      wasm_append_interpreter_func_signature(allocator, &env->sigs);
+  WASM_ZERO_MEMORY(*sig);
+  wasm_reserve_types(allocator, &sig->param_types, param_count);
+  sig->param_types.size = param_count;
+  if (param_count) {
+    memcpy(sig->param_types.data, param_types,
+           param_count * sizeof(WasmType));
+  }
+  wasm_reserve_types(allocator, &sig->result_types, result_count);
+  sig->result_types.size = result_count;
+  if (result_count) {
+    memcpy(sig->result_types.data, result_types,
+           result_count * sizeof(WasmType));
+  }
+
+  uint32_t sig_index = env->sigs.size - 1;
+  wasm_insert_binding(allocator, &env->sig_bindings, &key)->index = sig_index;
+  return sig_index;
 }
 
 WasmInterpreterEnvironmentMark wasm_mark_interpreter_environment(
@@ -120,9 +295,11 @@ WasmInterpreterEnvironmentMark wasm_mark_interpreter_environment(
   mark.modules_size = env->modules.size;
   mark.sigs_size = env->sigs.size;
   mark.funcs_size = env->funcs.size;
-  mark.memories_size = env->memories.size;
-  mark.tables_size = env->tables.size;
-  mark.globals_size = env->globals.size;
+  mark.memories_size = env->instance.memories.size;
+  mark.tables_size = env->instance.tables.size;
+  mark.globals_size = env->instance.globals.size;
+  mark.data_segments_size = env->instance_template.data_segments.size;
+  mark.elems_size = env->instance_template.elems.size;
   mark.istream_size = env->istream.size;
   return mark;
 }
@@ -132,13 +309,15 @@ void wasm_reset_interpreter_environment_to_mark(
     WasmInterpreterEnvironment* env,
     WasmInterpreterEnvironmentMark mark) {
   size_t i;
-
-#define DESTROY_PAST_MARK(destroy_name, names)                                 \
-  do {                                                                         \
-    assert(mark.names##_size <= env->names.size);                              \
-    for (i = mark.names##_size; i < env->names.size; ++i)                      \
-      wasm_destroy_interpreter_##destroy_name(allocator, &env->names.data[i]); \
-    env->names.size = mark.names##_size;                                       \
+  env->generation++;
+
+#define DESTROY_PAST_MARK(destroy_name, owner, names)                         \
+  do {                                                                        \
+    assert(mark.names##_size <= (owner)->names.size);                         \
+    for (i = mark.names##_size; i < (owner)->names.size; ++i)                 \
+      wasm_destroy_interpreter_##destroy_name(allocator,                      \
+                                              &(owner)->names.data[i]);       \
+    (owner)->names.size = mark.names##_size;                                  \
   } while (0)
 
   /* Destroy entries in the binding hash. */
@@ -161,22 +340,547 @@ void wasm_reset_interpreter_environment_to_mark(
     }
   }
 
-  DESTROY_PAST_MARK(module, modules);
-  DESTROY_PAST_MARK(func_signature, sigs);
-  DESTROY_PAST_MARK(func, funcs);
-  DESTROY_PAST_MARK(memory, memories);
-  DESTROY_PAST_MARK(table, tables);
-  env->globals.size = mark.globals_size;
+  /* the bindings for the remaining signatures are rebuilt rather than
+   * removed one at a time */
+  if (mark.sigs_size < env->sigs.size) {
+    wasm_destroy_binding_hash(allocator, &env->sig_bindings);
+    WASM_ZERO_MEMORY(env->sig_bindings);
+    for (i = 0; i < mark.sigs_size; ++i)
+      insert_sig_binding(allocator, env, i);
+  }
+
+  DESTROY_PAST_MARK(module, env, modules);
+  DESTROY_PAST_MARK(func_signature, env, sigs);
+  DESTROY_PAST_MARK(func, env, funcs);
+  DESTROY_PAST_MARK(memory, &env->instance, memories);
+  DESTROY_PAST_MARK(table, &env->instance, tables);
+  env->instance.globals.size = mark.globals_size;
   env->istream.size = mark.istream_size;
 
+  /* the remaining functions that were translated lazily after the mark lose
+   * their code, so they go back to their stubs */
+  for (i = 0; i < env->funcs.size; ++i) {
+    WasmInterpreterFunc* func = &env->funcs.data[i];
+    if (func->is_host || func->defined.stub_offset == WASM_INVALID_OFFSET ||
+        func->defined.offset < mark.istream_size)
+      continue;
+    uint8_t* stub = (uint8_t*)env->istream.start + func->defined.stub_offset;
+    uint32_t func_index = i;
+    stub[0] = WASM_OPCODE_TRANSLATE;
+    memcpy(stub + sizeof(uint8_t), &func_index, sizeof(uint32_t));
+    func->defined.offset = func->defined.stub_offset;
+    func->defined.end_offset =
+        func->defined.stub_offset + sizeof(uint8_t) + 2 * sizeof(uint32_t);
+    func->defined.local_decl_count = 0;
+    func->defined.local_count = 0;
+    func->defined.max_stack_height = 0;
+    func->defined.param_and_local_types.size = 0;
+    func->defined.call_count = 0;
+#if WASM_INTERPRETER_JIT
+    if (func->defined.jit_code) {
+      wasm_destroy_jit_code(allocator, func->defined.jit_code);
+      func->defined.jit_code = NULL;
+    }
+#endif
+  }
+
+  /* a module's memories, tables and globals are added to the template only
+   * once it has been read successfully, so the template may already be
+   * shorter than the mark */
+  WasmInterpreterInstanceTemplate* template_ = &env->instance_template;
+#define TRUNCATE_PAST_MARK(names, mark_size) \
+  do {                                       \
+    if (template_->names.size > (mark_size)) \
+      template_->names.size = (mark_size);   \
+  } while (0)
+
+  TRUNCATE_PAST_MARK(memory_limits, mark.memories_size);
+  TRUNCATE_PAST_MARK(table_limits, mark.tables_size);
+  TRUNCATE_PAST_MARK(globals, mark.globals_size);
+  DESTROY_PAST_MARK(data_segment, template_, data_segments);
+  template_->elems.size = mark.elems_size;
+
+#undef TRUNCATE_PAST_MARK
 #undef DESTROY_PAST_MARK
 }
 
+#if WASM_INTERPRETER_GUARD_PAGES
+/* the jump buffer of the innermost wasm_run_interpreter on this thread, and
+ * the instance it is running; NULL when not running. */
+static __thread sigjmp_buf* s_trap_jmp_buf;
+static __thread WasmInterpreterInstance* s_trap_instance;
+static struct sigaction s_prev_sigsegv_action;
+
+static WasmBool is_guard_page_address(WasmInterpreterInstance* instance,
+                                      uintptr_t address) {
+  size_t i;
+  for (i = 0; i < instance->memories.size; ++i) {
+    WasmInterpreterMemory* memory = &instance->memories.data[i];
+    if (address - (uintptr_t)memory->data < memory->reserved_byte_size)
+      return WASM_TRUE;
+  }
+  return WASM_FALSE;
+}
+
+static void handle_sigsegv(int signo, siginfo_t* info, void* context) {
+  if (s_trap_jmp_buf &&
+      is_guard_page_address(s_trap_instance, (uintptr_t)info->si_addr)) {
+    siglongjmp(*s_trap_jmp_buf, 1);
+  }
+  /* not an out of bounds memory access, so it is passed on to the previous
+   * handler, and this one stays installed for later accesses */
+  if (s_prev_sigsegv_action.sa_flags & SA_SIGINFO) {
+    s_prev_sigsegv_action.sa_sigaction(signo, info, context);
+  } else if (s_prev_sigsegv_action.sa_handler != SIG_DFL &&
+             s_prev_sigsegv_action.sa_handler != SIG_IGN) {
+    s_prev_sigsegv_action.sa_handler(signo);
+  } else {
+    /* the default action ends the process: return with it in place, so the
+     * faulting instruction faults again and takes it */
+    signal(SIGSEGV, SIG_DFL);
+  }
+}
+
+static WasmResult install_sigsegv_handler(void) {
+  static WasmBool s_installed;
+  if (s_installed)
+    return WASM_OK;
+
+  struct sigaction action;
+  WASM_ZERO_MEMORY(action);
+  sigemptyset(&action.sa_mask);
+  /* the handler doesn't return when it jumps out, so don't leave SIGSEGV
+   * blocked */
+  action.sa_flags = SA_SIGINFO | SA_NODEFER;
+  action.sa_sigaction = handle_sigsegv;
+  if (sigaction(SIGSEGV, &action, &s_prev_sigsegv_action) != 0)
+    return WASM_ERROR;
+  s_installed = WASM_TRUE;
+  return WASM_OK;
+}
+#endif
+
+#if HAVE_SYS_MMAN_H
+/* reserves |size| bytes of inaccessible address space, or returns NULL. With
+ * |huge_pages|, the reservation is aligned to a huge page and the kernel is
+ * asked to back it with transparent huge pages. */
+static void* reserve_memory(uint64_t size, WasmBool huge_pages) {
+  uint64_t alignment = huge_pages ? HUGE_PAGE_SIZE : 0;
+  if (size > SIZE_MAX - alignment)
+    return NULL;
+  void* data = mmap(NULL, size + alignment, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (data == MAP_FAILED)
+    return NULL;
+  if (huge_pages) {
+    uintptr_t start = (uintptr_t)data;
+    uintptr_t end = start + size + alignment;
+    uintptr_t aligned_start = (start + alignment - 1) & ~(alignment - 1);
+    uintptr_t aligned_end = aligned_start + size;
+    if (aligned_start != start)
+      munmap(data, aligned_start - start);
+    if (aligned_end != end)
+      munmap((void*)aligned_end, end - aligned_end);
+    data = (void*)aligned_start;
+#ifdef MADV_HUGEPAGE
+    madvise(data, size, MADV_HUGEPAGE);
+#endif
+  }
+  return data;
+}
+
+/* makes the reserved pages in [|from|, |to|) at |data| accessible. They have
+ * never been touched, so they are already zero. */
+static WasmResult commit_memory(void* data, uint32_t from, uint32_t to) {
+  if (from == to)
+    return WASM_OK;
+  void* start = (void*)((intptr_t)data + from);
+  if (mprotect(start, to - from, PROT_READ | PROT_WRITE) != 0)
+    return WASM_ERROR;
+  return WASM_OK;
+}
+
+/* reserves |reserved_byte_size| bytes of address space for |memory| and
+ * commits its first |byte_size| bytes, or returns NULL. */
+static void* reserve_and_commit_memory(const WasmInterpreterMemory* memory,
+                                       uint64_t reserved_byte_size,
+                                       uint32_t byte_size) {
+  WasmBool huge_pages =
+      memory->use_huge_pages && reserved_byte_size >= HUGE_PAGE_SIZE;
+  void* data = reserve_memory(reserved_byte_size, huge_pages);
+  if (!data)
+    return NULL;
+  if (WASM_FAILED(commit_memory(data, 0, byte_size))) {
+    munmap(data, reserved_byte_size);
+    return NULL;
+  }
+  return data;
+}
+
+#if !WASM_INTERPRETER_GUARD_PAGES
+/* returns the number of pages to reserve address space for when |memory| has
+ * |page_size| pages. That's its maximum when it declares one; otherwise it is
+ * at least UNBOUNDED_MEMORY_RESERVATION_PAGES, so that each instance doesn't
+ * take 4GiB of address space, and growing past it moves the data. */
+static uint64_t get_reserved_page_size(const WasmInterpreterMemory* memory,
+                                       uint32_t page_size) {
+  if (memory->page_limits.has_max)
+    return memory->page_limits.max;
+  if (page_size < UNBOUNDED_MEMORY_RESERVATION_PAGES)
+    return UNBOUNDED_MEMORY_RESERVATION_PAGES;
+  return page_size;
+}
+#endif
+#endif
+
+/* allocates zeroed data for the initial pages of |memory|. Where mmap is
+ * available, address space is reserved up front (see get_reserved_page_size),
+ * so growing within it never moves or copies the data. The reservation
+ * bypasses |memory->allocator|, which is only used where mmap isn't
+ * available or the reservation fails. With WASM_INTERPRETER_GUARD_PAGES the
+ * reservation is required, since the interpreter doesn't check bounds. */
+WasmResult wasm_alloc_interpreter_memory(WasmInterpreterMemory* memory) {
+  memory->byte_size = memory->page_limits.initial * WASM_PAGE_SIZE;
+  memory->reserved_byte_size = 0;
+#if HAVE_SYS_MMAN_H
+#if WASM_INTERPRETER_GUARD_PAGES
+  CHECK_RESULT(install_sigsegv_handler());
+  uint64_t reserved_byte_size = WASM_GUARD_PAGES_RESERVATION_SIZE;
+#else
+  uint64_t reserved_byte_size =
+      get_reserved_page_size(memory, memory->page_limits.initial) *
+      WASM_PAGE_SIZE;
+#endif
+  void* data = reserved_byte_size
+                   ? reserve_and_commit_memory(memory, reserved_byte_size,
+                                               memory->byte_size)
+                   : NULL;
+  if (data) {
+    memory->data = data;
+    memory->reserved_byte_size = reserved_byte_size;
+    return WASM_OK;
+  }
+#endif
+#if WASM_INTERPRETER_GUARD_PAGES
+  return WASM_ERROR;
+#else
+  memory->data = wasm_alloc_zero(memory->allocator, memory->byte_size,
+                                 WASM_DEFAULT_ALIGN);
+  return WASM_OK;
+#endif
+}
+
+/* grows |memory| to |new_page_size| pages, zeroing the new pages. The limits
+ * must already have been checked. */
+WasmResult wasm_grow_interpreter_memory(WasmInterpreterMemory* memory,
+                                        uint32_t new_page_size) {
+  uint32_t old_byte_size = memory->byte_size;
+  uint32_t new_byte_size = new_page_size * WASM_PAGE_SIZE;
+#if HAVE_SYS_MMAN_H
+  if (memory->reserved_byte_size) {
+    if (new_byte_size <= memory->reserved_byte_size) {
+      CHECK_RESULT(commit_memory(memory->data, old_byte_size, new_byte_size));
+    } else {
+#if WASM_INTERPRETER_GUARD_PAGES
+      assert(0);
+      return WASM_ERROR;
+#else
+      /* only a memory without a declared maximum can outgrow its
+       * reservation. Its data is moved to a reservation at least twice as
+       * large, so that growing a page at a time doesn't copy every time. */
+      uint64_t reserved_page_size =
+          memory->reserved_byte_size / WASM_PAGE_SIZE * 2;
+      if (reserved_page_size > WASM_MAX_PAGES)
+        reserved_page_size = WASM_MAX_PAGES;
+      if (reserved_page_size < new_page_size)
+        reserved_page_size = new_page_size;
+      uint64_t reserved_byte_size = reserved_page_size * WASM_PAGE_SIZE;
+      void* new_data = reserve_and_commit_memory(memory, reserved_byte_size,
+                                                 new_byte_size);
+      if (!new_data)
+        return WASM_ERROR;
+      memcpy(new_data, memory->data, old_byte_size);
+      munmap(memory->data, memory->reserved_byte_size);
+      memory->data = new_data;
+      memory->reserved_byte_size = reserved_byte_size;
+#endif
+    }
+    memory->page_limits.initial = new_page_size;
+    memory->byte_size = new_byte_size;
+    return WASM_OK;
+  }
+#endif
+  void* new_data = wasm_realloc(memory->allocator, memory->data, new_byte_size,
+                                WASM_DEFAULT_ALIGN);
+  if (new_data == NULL)
+    return WASM_ERROR;
+  memset((void*)((intptr_t)new_data + old_byte_size), 0,
+         new_byte_size - old_byte_size);
+  memory->data = new_data;
+  memory->page_limits.initial = new_page_size;
+  memory->byte_size = new_byte_size;
+  return WASM_OK;
+}
+
+/* initializes |instance| from the environment's instance template: fresh
+ * memories and tables with the segments copied in, and the globals' initial
+ * values. The modules aren't read again and start functions aren't run. */
+WasmResult wasm_init_interpreter_instance(WasmAllocator* allocator,
+                                          WasmInterpreterEnvironment* env,
+                                          WasmInterpreterInstance* instance) {
+  const WasmInterpreterInstanceTemplate* template_ = &env->instance_template;
+  assert(template_->memory_limits.size == env->instance.memories.size);
+  assert(template_->table_limits.size == env->instance.tables.size);
+  assert(template_->globals.size == env->instance.globals.size);
+  WASM_ZERO_MEMORY(*instance);
+  size_t i;
+  for (i = 0; i < template_->memory_limits.size; ++i) {
+    const WasmInterpreterMemory* env_memory = &env->instance.memories.data[i];
+    WasmInterpreterMemory* memory =
+        wasm_append_interpreter_memory(allocator, &instance->memories);
+    WASM_ZERO_MEMORY(*memory);
+    memory->allocator =
+        env_memory->allocator ? env_memory->allocator : allocator;
+    memory->page_limits = template_->memory_limits.data[i];
+    memory->use_huge_pages = env_memory->use_huge_pages;
+    if (WASM_FAILED(wasm_alloc_interpreter_memory(memory))) {
+      instance->memories.size--;
+      goto fail;
+    }
+  }
+
+  for (i = 0; i < template_->table_limits.size; ++i) {
+    WasmInterpreterTable* table =
+        wasm_append_interpreter_table(allocator, &instance->tables);
+    table->limits = template_->table_limits.data[i];
+    wasm_new_uint32_array(allocator, &table->func_indexes,
+                          table->limits.initial);
+    size_t j;
+    for (j = 0; j < table->func_indexes.size; ++j)
+      table->func_indexes.data[j] = WASM_INVALID_INDEX;
+    /* the elems below are written before any code can run against it */
+    wasm_new_interpreter_table_epoch(env, table);
+  }
+
+  wasm_extend_interpreter_globals(allocator, &instance->globals,
+                                  &template_->globals);
+
+  /* the segments were checked against the memories and tables as they were
+   * when they were read, which may have been grown by then */
+  for (i = 0; i < template_->data_segments.size; ++i) {
+    const WasmInterpreterDataSegment* segment =
+        &template_->data_segments.data[i];
+    WasmInterpreterMemory* memory =
+        &instance->memories.data[segment->memory_index];
+    if ((uint64_t)segment->address + segment->size > memory->byte_size)
+      goto fail;
+    memcpy((uint8_t*)memory->data + segment->address, segment->data,
+           segment->size);
+  }
+
+  for (i = 0; i < template_->elems.size; ++i) {
+    const WasmInterpreterElem* elem = &template_->elems.data[i];
+    WasmInterpreterTable* table = &instance->tables.data[elem->table_index];
+    if (elem->offset >= table->func_indexes.size)
+      goto fail;
+    table->func_indexes.data[elem->offset] = elem->func_index;
+  }
+  return WASM_OK;
+
+fail:
+  wasm_destroy_interpreter_instance(allocator, instance);
+  return WASM_ERROR;
+}
+
+static void copy_interpreter_tables(WasmAllocator* allocator,
+                                    WasmInterpreterTableVector* dst,
+                                    const WasmInterpreterTableVector* src) {
+  size_t i;
+  for (i = 0; i < src->size; ++i) {
+    const WasmInterpreterTable* src_table = &src->data[i];
+    WasmInterpreterTable* table = wasm_append_interpreter_table(allocator, dst);
+    table->limits = src_table->limits;
+    wasm_new_uint32_array(allocator, &table->func_indexes,
+                          src_table->func_indexes.size);
+    memcpy(table->func_indexes.data, src_table->func_indexes.data,
+           src_table->func_indexes.size * sizeof(uint32_t));
+    /* the contents are the same, so caches of either are good for both */
+    table->epoch = src_table->epoch;
+  }
+}
+
+#if HAVE_MEMFD_CREATE
+/* writes the memories of |instance| back to back into a new anonymous file,
+ * leaving the all-zero pages as holes, or returns -1. */
+static int write_snapshot_memory_file(const WasmInterpreterInstance* instance,
+                                      uint64_t total_byte_size) {
+  int fd = memfd_create("wasm-snapshot", MFD_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  if (ftruncate(fd, total_byte_size) != 0)
+    goto fail;
+  uint64_t offset = 0;
+  size_t i;
+  for (i = 0; i < instance->memories.size; ++i) {
+    const WasmInterpreterMemory* memory = &instance->memories.data[i];
+    uint32_t page_offset;
+    for (page_offset = 0; page_offset < memory->byte_size;
+         page_offset += WASM_PAGE_SIZE) {
+      const uint8_t* page = (const uint8_t*)memory->data + page_offset;
+      size_t j;
+      for (j = 0; j < WASM_PAGE_SIZE && page[j] == 0; ++j) {
+      }
+      if (j == WASM_PAGE_SIZE)
+        continue;
+      if (pwrite(fd, page, WASM_PAGE_SIZE, offset + page_offset) !=
+          WASM_PAGE_SIZE)
+        goto fail;
+    }
+    offset += memory->byte_size;
+  }
+  return fd;
+
+fail:
+  close(fd);
+  return -1;
+}
+#endif
+
+/* records the current memories, tables and globals of |instance|, which must
+ * have been initialized for |env|. */
+WasmResult wasm_snapshot_interpreter_instance(
+    WasmAllocator* allocator,
+    WasmInterpreterEnvironment* env,
+    const WasmInterpreterInstance* instance,
+    WasmInterpreterSnapshot* out_snapshot) {
+  WASM_ZERO_MEMORY(*out_snapshot);
+  out_snapshot->env = env;
+  out_snapshot->generation = env->generation;
+  out_snapshot->memory_fd = -1;
+
+  uint64_t total_byte_size = 0;
+  size_t i;
+  for (i = 0; i < instance->memories.size; ++i) {
+    const WasmInterpreterMemory* memory = &instance->memories.data[i];
+    wasm_append_limits_value(allocator, &out_snapshot->memory_limits,
+                             &memory->page_limits);
+    total_byte_size += memory->byte_size;
+  }
+  copy_interpreter_tables(allocator, &out_snapshot->tables, &instance->tables);
+  wasm_extend_interpreter_globals(allocator, &out_snapshot->globals,
+                                  &instance->globals);
+
+  if (total_byte_size == 0)
+    return WASM_OK;
+#if HAVE_MEMFD_CREATE
+  out_snapshot->memory_fd =
+      write_snapshot_memory_file(instance, total_byte_size);
+  if (out_snapshot->memory_fd != -1)
+    return WASM_OK;
+#endif
+  if (total_byte_size > SIZE_MAX)
+    goto fail;
+  out_snapshot->memory_data =
+      wasm_alloc(allocator, total_byte_size, WASM_DEFAULT_ALIGN);
+  if (!out_snapshot->memory_data)
+    goto fail;
+  uint8_t* dst = out_snapshot->memory_data;
+  for (i = 0; i < instance->memories.size; ++i) {
+    const WasmInterpreterMemory* memory = &instance->memories.data[i];
+    memcpy(dst, memory->data, memory->byte_size);
+    dst += memory->byte_size;
+  }
+  return WASM_OK;
+
+fail:
+  wasm_destroy_interpreter_snapshot(allocator, out_snapshot);
+  return WASM_ERROR;
+}
+
+/* fills |memory|, which was just allocated, with its contents from
+ * |snapshot|, starting at |offset|. A reserved memory maps the snapshot's
+ * file over its committed pages, so that the pages are shared until they are
+ * written to. */
+static WasmResult copy_snapshot_memory(const WasmInterpreterSnapshot* snapshot,
+                                       uint64_t offset,
+                                       WasmInterpreterMemory* memory) {
+  if (memory->byte_size == 0)
+    return WASM_OK;
+#if HAVE_MEMFD_CREATE
+  if (snapshot->memory_fd != -1) {
+    if (memory->reserved_byte_size) {
+      void* data = mmap(memory->data, memory->byte_size,
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                        snapshot->memory_fd, offset);
+      if (data == MAP_FAILED)
+        return WASM_ERROR;
+#ifdef MADV_HUGEPAGE
+      /* the new mapping doesn't keep the advice given by reserve_memory */
+      if (memory->use_huge_pages &&
+          memory->reserved_byte_size >= HUGE_PAGE_SIZE)
+        madvise(data, memory->byte_size, MADV_HUGEPAGE);
+#endif
+      return WASM_OK;
+    }
+    if (pread(snapshot->memory_fd, memory->data, memory->byte_size, offset) !=
+        (ssize_t)memory->byte_size)
+      return WASM_ERROR;
+    return WASM_OK;
+  }
+#endif
+  memcpy(memory->data, (uint8_t*)snapshot->memory_data + offset,
+         memory->byte_size);
+  return WASM_OK;
+}
+
+/* initializes |instance| from |snapshot| rather than from the instance
+ * template. This fails if modules have been loaded or unloaded since the
+ * snapshot was taken. */
+WasmResult wasm_init_interpreter_instance_from_snapshot(
+    WasmAllocator* allocator,
+    WasmInterpreterEnvironment* env,
+    const WasmInterpreterSnapshot* snapshot,
+    WasmInterpreterInstance* instance) {
+  WASM_ZERO_MEMORY(*instance);
+  if (snapshot->env != env || snapshot->generation != env->generation)
+    return WASM_ERROR;
+
+  uint64_t offset = 0;
+  size_t i;
+  for (i = 0; i < snapshot->memory_limits.size; ++i) {
+    const WasmInterpreterMemory* env_memory = &env->instance.memories.data[i];
+    WasmInterpreterMemory* memory =
+        wasm_append_interpreter_memory(allocator, &instance->memories);
+    WASM_ZERO_MEMORY(*memory);
+    memory->allocator =
+        env_memory->allocator ? env_memory->allocator : allocator;
+    memory->page_limits = snapshot->memory_limits.data[i];
+    memory->use_huge_pages = env_memory->use_huge_pages;
+    if (WASM_FAILED(wasm_alloc_interpreter_memory(memory))) {
+      instance->memories.size--;
+      goto fail;
+    }
+    if (WASM_FAILED(copy_snapshot_memory(snapshot, offset, memory)))
+      goto fail;
+    offset += memory->byte_size;
+  }
+
+  copy_interpreter_tables(allocator, &instance->tables, &snapshot->tables);
+  wasm_extend_interpreter_globals(allocator, &instance->globals,
+                                  &snapshot->globals);
+  return WASM_OK;
+
+fail:
+  wasm_destroy_interpreter_instance(allocator, instance);
+  return WASM_ERROR;
+}
+
 WasmInterpreterModule* wasm_append_host_module(WasmAllocator* allocator,
                                                WasmInterpreterEnvironment* env,
                                                WasmStringSlice name) {
   WasmInterpreterModule* module =
       wasm_append_interpreter_module(allocator, &env->modules);
+  env->generation++;
   module->name = wasm_dup_string_slice(allocator, name);
   module->memory_index = WASM_INVALID_INDEX;
   module->table_index = WASM_INVALID_INDEX;
@@ -200,11 +904,14 @@ void wasm_init_interpreter_thread(WasmAllocator* allocator,
                         options->call_stack_size);
   thread->allocator = allocator;
   thread->env = env;
+  thread->instance = &env->instance;
   thread->value_stack_top = thread->value_stack.data;
   thread->value_stack_end = thread->value_stack.data + thread->value_stack.size;
   thread->call_stack_top = thread->call_stack.data;
   thread->call_stack_end = thread->call_stack.data + thread->call_stack.size;
   thread->pc = options->pc;
+  thread->fuel = options->fuel;
+  thread->suspended_sig_index = WASM_INVALID_INDEX;
 }
 
 WasmInterpreterResult wasm_push_thread_value(WasmInterpreterThread* thread,
@@ -226,6 +933,87 @@ WasmInterpreterExport* wasm_get_interpreter_export_by_name(
   return &module->exports.data[field_index];
 }
 
+WasmInterpreterResult wasm_get_interpreter_export_handle(
+    WasmInterpreterEnvironment* env,
+    WasmInterpreterModule* module,
+    const WasmStringSlice* name,
+    WasmInterpreterExportHandle* out_handle) {
+  WasmInterpreterExport* export =
+      wasm_get_interpreter_export_by_name(module, name);
+  if (!export)
+    return WASM_INTERPRETER_UNKNOWN_EXPORT;
+  if (export->kind != WASM_EXTERNAL_KIND_FUNC)
+    return WASM_INTERPRETER_EXPORT_KIND_MISMATCH;
+  assert(export->index < env->funcs.size);
+  const WasmInterpreterFunc* func = &env->funcs.data[export->index];
+  assert(func->sig_index < env->sigs.size);
+  const WasmInterpreterFuncSignature* sig = &env->sigs.data[func->sig_index];
+  out_handle->func_index = export->index;
+  out_handle->param_count = sig->param_types.size;
+  out_handle->result_count = sig->result_types.size;
+  out_handle->fuel_per_call = 0;
+  return WASM_INTERPRETER_OK;
+}
+
+WasmInterpreterResult wasm_call_interpreter_export(
+    WasmInterpreterThread* thread,
+    const WasmInterpreterExportHandle* handle,
+    const WasmInterpreterValue* args,
+    WasmInterpreterValue* results,
+    uint32_t call_count,
+    uint32_t* out_calls_done) {
+  assert(handle->func_index < thread->env->funcs.size);
+  WasmInterpreterFunc* func = &thread->env->funcs.data[handle->func_index];
+  WasmInterpreterValue* value_stack_base = thread->value_stack_top;
+  uint32_t* call_stack_base = thread->call_stack_top;
+  size_t param_bytes = handle->param_count * sizeof(WasmInterpreterValue);
+  size_t result_bytes = handle->result_count * sizeof(WasmInterpreterValue);
+  WasmInterpreterResult result = WASM_INTERPRETER_OK;
+  uint32_t i;
+  /* the stack is checked once here, so the arguments can be copied */
+  if ((size_t)(thread->value_stack_end - value_stack_base) <
+      handle->param_count) {
+    result = WASM_INTERPRETER_TRAP_VALUE_STACK_EXHAUSTED;
+    i = 0;
+    goto done;
+  }
+
+  for (i = 0; i < call_count; ++i) {
+    if (param_bytes)
+      memcpy(value_stack_base, args, param_bytes);
+    thread->value_stack_top = value_stack_base + handle->param_count;
+    if (handle->fuel_per_call)
+      thread->fuel = handle->fuel_per_call;
+    if (func->is_host) {
+      result = wasm_call_host(thread, func);
+    } else {
+      thread->pc = func->defined.offset;
+      result = wasm_run_interpreter(thread, call_stack_base);
+      /* use OK instead of RETURNED, as for a host function */
+      if (result == WASM_INTERPRETER_RETURNED)
+        result = WASM_INTERPRETER_OK;
+    }
+    /* the stacks are reset below, so the call can't be resumed */
+    if (result == WASM_INTERPRETER_SUSPENDED)
+      thread->suspended_sig_index = WASM_INVALID_INDEX;
+    if (result != WASM_INTERPRETER_OK)
+      goto done;
+    assert(thread->value_stack_top ==
+           value_stack_base + handle->result_count);
+    if (result_bytes)
+      memcpy(results, value_stack_base, result_bytes);
+    args += handle->param_count;
+    results += handle->result_count;
+  }
+
+done:
+  thread->value_stack_top = value_stack_base;
+  thread->call_stack_top = call_stack_base;
+  if (out_calls_done)
+    *out_calls_done = i;
+  return result;
+}
+
 void wasm_destroy_interpreter_thread(WasmAllocator* allocator,
                                      WasmInterpreterThread* thread) {
   wasm_destroy_interpreter_value_array(allocator, &thread->value_stack);
@@ -462,17 +1250,42 @@ DEFINE_BITCAST(bitcast_u64_to_f64, uint64_t, double)
 #define TYPE_FIELD_NAME_F32 f32_bits
 #define TYPE_FIELD_NAME_F64 f64_bits
 
-#define TRAP(type) return WASM_INTERPRETER_TRAP_##type
+/* The functions that execute instructions keep the value stack pointer in
+ * the local |value_stack_top|, so the compiler can hold it in a register
+ * instead of reloading it through |thread| after every store. It is written
+ * back whenever something else may look at the thread: host calls, traps, and
+ * returning to the caller. */
+#define SAVE_VALUE_STACK_TOP() thread->value_stack_top = value_stack_top
+#define LOAD_VALUE_STACK_TOP() value_stack_top = thread->value_stack_top
+
+#define TRAP(type)                        \
+  do {                                    \
+    SAVE_VALUE_STACK_TOP();               \
+    return WASM_INTERPRETER_TRAP_##type;  \
+  } while (0)
+#define CALL_HOST(func)                                                 \
+  do {                                                                  \
+    SAVE_VALUE_STACK_TOP();                                             \
+    WasmInterpreterResult host_result = wasm_call_host(thread, (func)); \
+    LOAD_VALUE_STACK_TOP();                                             \
+    LOAD_MEMORY0();                                                     \
+    if (host_result != WASM_INTERPRETER_OK) {                           \
+      if (host_result != WASM_INTERPRETER_SUSPENDED)                    \
+        return host_result;                                             \
+      result = host_result;                                             \
+      goto exit_loop;                                                   \
+    }                                                                   \
+  } while (0)
+
 #define TRAP_UNLESS(cond, type) TRAP_IF(!(cond), type)
-#define TRAP_IF(cond, type)                \
-  do {                                     \
-    if (WASM_UNLIKELY(cond))               \
-      return WASM_INTERPRETER_TRAP_##type; \
+#define TRAP_IF(cond, type)    \
+  do {                         \
+    if (WASM_UNLIKELY(cond))   \
+      TRAP(type);              \
   } while (0)
 
-#define CHECK_STACK()                                         \
-  TRAP_IF(thread->value_stack_top >= thread->value_stack_end, \
-          VALUE_STACK_EXHAUSTED)
+#define CHECK_STACK() \
+  TRAP_IF(value_stack_top >= value_stack_end, VALUE_STACK_EXHAUSTED)
 
 #define PUSH_NEG_1_AND_BREAK_IF(cond) \
   if (WASM_UNLIKELY(cond)) {          \
@@ -480,17 +1293,14 @@ DEFINE_BITCAST(bitcast_u64_to_f64, uint64_t, double)
     break;                            \
   }
 
-#define PUSH(v)        \
-  do {                 \
-    CHECK_STACK();     \
-    (*thread->value_stack_top++) = (v); \
-  } while (0)
+/* pushes are unchecked; the ALLOCA at the start of each function checks
+ * that there is room for the most values its body ever pushes */
+#define PUSH(v) (*value_stack_top++) = (v)
 
-#define PUSH_TYPE(type, v)                                \
-  do {                                                    \
-    CHECK_STACK();                                        \
-    (*thread->value_stack_top++).TYPE_FIELD_NAME_##type = \
-        (VALUE_TYPE_##type)(v);                           \
+#define PUSH_TYPE(type, v)                        \
+  do {                                            \
+    (*value_stack_top++).TYPE_FIELD_NAME_##type = \
+        (VALUE_TYPE_##type)(v);                   \
   } while (0)
 
 #define PUSH_I32(v) PUSH_TYPE(I32, (v))
@@ -498,9 +1308,13 @@ DEFINE_BITCAST(bitcast_u64_to_f64, uint64_t, double)
 #define PUSH_F32(v) PUSH_TYPE(F32, (v))
 #define PUSH_F64(v) PUSH_TYPE(F64, (v))
 
-#define PICK(depth) (*(thread->value_stack_top - (depth)))
+#define PICK(depth) (*(value_stack_top - (depth)))
 #define TOP() (PICK(1))
-#define POP() (*--thread->value_stack_top)
+/* replaces the top value without moving the stack pointer; binary operators
+ * pop the rhs and overwrite the lhs in place */
+#define SET_TOP(type, v) \
+  (TOP().TYPE_FIELD_NAME_##type = (VALUE_TYPE_##type)(v))
+#define POP() (*--value_stack_top)
 #define POP_I32() (POP().i32)
 #define POP_I64() (POP().i64)
 #define POP_F32() (POP().f32_bits)
@@ -510,11 +1324,40 @@ DEFINE_BITCAST(bitcast_u64_to_f64, uint64_t, double)
     assert((keep) <= 1);               \
     if ((keep) == 1)                   \
       PICK((drop) + 1) = TOP();        \
-    thread->value_stack_top -= (drop); \
+    value_stack_top -= (drop);         \
   } while (0)
 
 #define GOTO(offset) pc = &istream[offset]
 
+/* With GCC's "labels as values" extension each handler jumps straight to the
+ * next handler instead of going back through the switch, which gives the
+ * branch predictor one indirect branch per opcode to learn. Other compilers
+ * use the switch; in both cases a handler ends with NEXT(). */
+#ifndef WASM_INTERPRETER_USE_COMPUTED_GOTO
+#if COMPILER_IS_GNU || COMPILER_IS_CLANG
+#define WASM_INTERPRETER_USE_COMPUTED_GOTO 1
+#else
+#define WASM_INTERPRETER_USE_COMPUTED_GOTO 0
+#endif
+#endif
+
+#if WASM_INTERPRETER_USE_COMPUTED_GOTO
+#define TARGET(name) \
+  case WASM_OPCODE_##name: \
+  op_##name:
+#define NEXT()                        \
+  do {                                \
+    if (single_step)                  \
+      goto exit_loop;                 \
+    opcode = *pc++;                   \
+    assert(s_opcode_targets[opcode]); \
+    goto* s_opcode_targets[opcode];   \
+  } while (0)
+#else
+#define TARGET(name) case WASM_OPCODE_##name:
+#define NEXT() break
+#endif
+
 #define PUSH_CALL()                                           \
   do {                                                        \
     TRAP_IF(thread->call_stack_top >= thread->call_stack_end, \
@@ -524,58 +1367,177 @@ DEFINE_BITCAST(bitcast_u64_to_f64, uint64_t, double)
 
 #define POP_CALL() (*--thread->call_stack_top)
 
-#define GET_MEMORY(var)                      \
-  uint32_t memory_index = read_u32(&pc);     \
-  assert(memory_index < env->memories.size); \
-  WasmInterpreterMemory* var = &env->memories.data[memory_index]
+/* sets |func_index| to that of the function at |entry_index| in |table|,
+ * trapping unless there is one with the signature |sig_index| */
+#define GET_INDIRECT_FUNC_INDEX(table, sig_index, entry_index, func_index)    \
+  do {                                                                        \
+    TRAP_IF((entry_index) >= (table)->func_indexes.size,                      \
+            UNDEFINED_TABLE_INDEX);                                           \
+    (func_index) = (table)->func_indexes.data[entry_index];                   \
+    TRAP_IF((func_index) == WASM_INVALID_INDEX, UNINITIALIZED_TABLE_ELEMENT); \
+    TRAP_UNLESS(env->funcs.data[func_index].sig_index == (sig_index),         \
+                INDIRECT_CALL_SIGNATURE_MISMATCH);                            \
+  } while (0)
+
+#define CALL_FUNC(func)             \
+  do {                              \
+    if ((func)->is_host) {          \
+      CALL_HOST(func);              \
+    } else {                        \
+      PUSH_CALL();                  \
+      GOTO((func)->defined.offset); \
+    }                               \
+  } while (0)
+
+/* |instr| is the start of the charging instruction; if the fuel is already
+ * gone, the thread stops there so running it again retries the charge. */
+#define CHARGE_FUEL(instr, cost)                 \
+  do {                                           \
+    if (WASM_UNLIKELY(thread->fuel <= 0)) {      \
+      pc = (instr);                              \
+      result = WASM_INTERPRETER_FUEL_EXHAUSTED;  \
+      goto exit_loop;                            \
+    }                                            \
+    thread->fuel -= (cost);                      \
+  } while (0)
+
+#if WASM_INTERPRETER_JIT
+/* runs native code with |run|, which leaves the stack pointer in |thread|
+ * and returns the pc that the native code exited at; execution continues
+ * there. A trap ends the run like any other trap. */
+#define RUN_JIT_CODE(run, arg)                                       \
+  do {                                                               \
+    uint32_t jit_pc;                                                 \
+    SAVE_VALUE_STACK_TOP();                                          \
+    WasmInterpreterResult jit_result = run(thread, (arg), &jit_pc);  \
+    LOAD_VALUE_STACK_TOP();                                          \
+    LOAD_MEMORY0();                                                  \
+    if (WASM_UNLIKELY(jit_result != WASM_INTERPRETER_OK))            \
+      return jit_result;                                             \
+    GOTO(jit_pc);                                                    \
+  } while (0)
+#endif
+
+#define GET_MEMORY(var)                           \
+  uint32_t memory_index = read_u32(&pc);          \
+  assert(memory_index < instance->memories.size); \
+  WasmInterpreterMemory* var = &instance->memories.data[memory_index]
+
+/* memory 0 of the instance is kept in |memory0_data| and |memory0_size| for
+ * the *_MEM0 instructions. Only grow_memory, a host call or native code can
+ * change it, so it is reloaded after each of those. */
+#define LOAD_MEMORY0()                                   \
+  do {                                                   \
+    if (instance->memories.size > 0) {                   \
+      memory0_data = instance->memories.data[0].data;    \
+      memory0_size = instance->memories.data[0].byte_size; \
+    }                                                    \
+  } while (0)
+
+/* |offset| is the 64-bit sum of the address and the static offset. With guard
+ * pages, every such offset is inside the memory's reservation, and an access
+ * past byte_size faults and is turned into a trap by handle_sigsegv. */
+#if WASM_INTERPRETER_GUARD_PAGES
+#define CHECK_MEMORY_ACCESS(byte_size, offset, size) (void)(byte_size)
+#define MEMORY_ADDRESS(data, offset) ((void*)((intptr_t)(data) + (offset)))
+#else
+#define CHECK_MEMORY_ACCESS(byte_size, offset, size) \
+  TRAP_IF((offset) + (size) > (byte_size), MEMORY_ACCESS_OUT_OF_BOUNDS)
+#define MEMORY_ADDRESS(data, offset) \
+  ((void*)((intptr_t)(data) + (uint32_t)(offset)))
+#endif
+
+#define LOAD(type, mem_type) LOAD_FROM(type, mem_type, POP_I32())
+
+/* the operands are read in order: memory index, then whatever |address| reads,
+ * then the static offset */
+#define LOAD_FROM(type, mem_type, address)                               \
+  do {                                                                   \
+    GET_MEMORY(memory);                                                  \
+    LOAD_FROM_MEMORY(memory->data, memory->byte_size, type, mem_type,    \
+                     address);                                           \
+  } while (0)
 
-#define LOAD(type, mem_type)                                        \
+#define LOAD_FROM_MEMORY(data, byte_size, type, mem_type, address)  \
   do {                                                              \
-    GET_MEMORY(memory);                                             \
-    uint64_t offset = (uint64_t)POP_I32() + read_u32(&pc);          \
+    uint64_t offset = (uint64_t)(address);                          \
+    offset += read_u32(&pc);                                        \
     MEM_TYPE_##mem_type value;                                      \
-    TRAP_IF(offset + sizeof(value) > memory->byte_size,             \
-            MEMORY_ACCESS_OUT_OF_BOUNDS);                           \
-    void* src = (void*)((intptr_t)memory->data + (uint32_t)offset); \
+    CHECK_MEMORY_ACCESS(byte_size, offset, sizeof(value));          \
+    void* src = MEMORY_ADDRESS(data, offset);                       \
     memcpy(&value, src, sizeof(MEM_TYPE_##mem_type));               \
     PUSH_##type((MEM_TYPE_EXTEND_##type##_##mem_type)value);        \
   } while (0)
 
-#define STORE(type, mem_type)                                       \
+#define STORE(type, mem_type)                                             \
+  do {                                                                    \
+    GET_MEMORY(memory);                                                   \
+    STORE_TO_MEMORY(memory->data, memory->byte_size, type, mem_type);     \
+  } while (0)
+
+#define STORE_TO_MEMORY(data, byte_size, type, mem_type)            \
   do {                                                              \
-    GET_MEMORY(memory);                                             \
     VALUE_TYPE_##type value = POP_##type();                         \
     uint64_t offset = (uint64_t)POP_I32() + read_u32(&pc);          \
     MEM_TYPE_##mem_type src = (MEM_TYPE_##mem_type)value;           \
-    TRAP_IF(offset + sizeof(src) > memory->byte_size,               \
-            MEMORY_ACCESS_OUT_OF_BOUNDS);                           \
-    void* dst = (void*)((intptr_t)memory->data + (uint32_t)offset); \
+    CHECK_MEMORY_ACCESS(byte_size, offset, sizeof(src));            \
+    void* dst = MEMORY_ADDRESS(data, offset);                       \
     memcpy(dst, &src, sizeof(MEM_TYPE_##mem_type));                 \
   } while (0)
 
-#define BINOP(rtype, type, op)            \
-  do {                                    \
-    VALUE_TYPE_##type rhs = POP_##type(); \
-    VALUE_TYPE_##type lhs = POP_##type(); \
-    PUSH_##rtype(lhs op rhs);             \
+#define BINOP(rtype, type, op)                          \
+  do {                                                  \
+    VALUE_TYPE_##type rhs = POP_##type();               \
+    VALUE_TYPE_##type lhs = TOP().TYPE_FIELD_NAME_##type; \
+    SET_TOP(rtype, lhs op rhs);                         \
+  } while (0)
+
+#define BR_UNLESS_COMPARE(type, sign, op)                   \
+  do {                                                      \
+    uint32_t new_pc = read_u32(&pc);                        \
+    VALUE_TYPE_##type rhs = POP_##type();                   \
+    VALUE_TYPE_##type lhs = POP_##type();                   \
+    if (!(BITCAST_##type##_TO_##sign(lhs)                   \
+              op BITCAST_##type##_TO_##sign(rhs)))          \
+      GOTO(new_pc);                                         \
   } while (0)
 
-#define BINOP_SIGNED(rtype, type, op)                     \
-  do {                                                    \
-    VALUE_TYPE_##type rhs = POP_##type();                 \
-    VALUE_TYPE_##type lhs = POP_##type();                 \
-    PUSH_##rtype(BITCAST_##type##_TO_SIGNED(lhs)          \
-                     op BITCAST_##type##_TO_SIGNED(rhs)); \
+#define BINOP_SIGNED(rtype, type, op)                      \
+  do {                                                     \
+    VALUE_TYPE_##type rhs = POP_##type();                  \
+    VALUE_TYPE_##type lhs = TOP().TYPE_FIELD_NAME_##type;  \
+    SET_TOP(rtype, BITCAST_##type##_TO_SIGNED(lhs)         \
+                       op BITCAST_##type##_TO_SIGNED(rhs)); \
   } while (0)
 
 #define SHIFT_MASK_I32 31
 #define SHIFT_MASK_I64 63
 
-#define BINOP_SHIFT(type, op, sign)                                          \
-  do {                                                                       \
-    VALUE_TYPE_##type rhs = POP_##type();                                    \
-    VALUE_TYPE_##type lhs = POP_##type();                                    \
-    PUSH_##type(BITCAST_##type##_TO_##sign(lhs) op(rhs& SHIFT_MASK_##type)); \
+#define BINOP_SHIFT(type, op, sign)                                         \
+  do {                                                                      \
+    VALUE_TYPE_##type rhs = POP_##type();                                   \
+    VALUE_TYPE_##type lhs = TOP().TYPE_FIELD_NAME_##type;                   \
+    SET_TOP(type, BITCAST_##type##_TO_##sign(lhs) op(rhs& SHIFT_MASK_##type)); \
+  } while (0)
+
+#define REGISTER_BINOP_RESULT_BINOP(sign, op, lhs, rhs) \
+  (BITCAST_I32_TO_##sign(lhs) op BITCAST_I32_TO_##sign(rhs))
+#define REGISTER_BINOP_RESULT_SHIFT(sign, op, lhs, rhs) \
+  (BITCAST_I32_TO_##sign(lhs) op((rhs)&SHIFT_MASK_I32))
+
+/* the sources are read before popping, so they can be any slot below the top
+ * of the stack. A destination depth of 0 pushes the result. */
+#define REGISTER_BINOP(kind, sign, op)                                   \
+  do {                                                                   \
+    uint32_t dst_depth = read_u32(&pc);                                  \
+    VALUE_TYPE_I32 lhs = PICK(read_u32(&pc)).i32;                        \
+    VALUE_TYPE_I32 rhs = PICK(read_u32(&pc)).i32;                        \
+    value_stack_top -= *pc++;                                            \
+    VALUE_TYPE_I32 result = REGISTER_BINOP_RESULT_##kind(sign, op, lhs, rhs); \
+    if (dst_depth == 0)                                                  \
+      PUSH_I32(result);                                                  \
+    else                                                                 \
+      PICK(dst_depth).i32 = result;                                      \
   } while (0)
 
 #define ROT_LEFT_0_SHIFT_OP <<
@@ -642,11 +1604,11 @@ DEFINE_BITCAST(bitcast_u64_to_f64, uint64_t, double)
     break;                                                     \
   } while (0)
 
-#define BINOP_FLOAT(type, op)                                \
-  do {                                                       \
-    FLOAT_TYPE_##type rhs = BITCAST_TO_##type(POP_##type()); \
-    FLOAT_TYPE_##type lhs = BITCAST_TO_##type(POP_##type()); \
-    PUSH_##type(BITCAST_FROM_##type(lhs op rhs));            \
+#define BINOP_FLOAT(type, op)                                              \
+  do {                                                                     \
+    FLOAT_TYPE_##type rhs = BITCAST_TO_##type(POP_##type());               \
+    FLOAT_TYPE_##type lhs = BITCAST_TO_##type(TOP().TYPE_FIELD_NAME_##type); \
+    SET_TOP(type, BITCAST_FROM_##type(lhs op rhs));                        \
   } while (0)
 
 #define BINOP_FLOAT_DIV(type)                                    \
@@ -669,11 +1631,11 @@ DEFINE_BITCAST(bitcast_u64_to_f64, uint64_t, double)
     }                                                            \
   } while (0)
 
-#define BINOP_FLOAT_COMPARE(type, op)                        \
-  do {                                                       \
-    FLOAT_TYPE_##type rhs = BITCAST_TO_##type(POP_##type()); \
-    FLOAT_TYPE_##type lhs = BITCAST_TO_##type(POP_##type()); \
-    PUSH_I32(lhs op rhs);                                    \
+#define BINOP_FLOAT_COMPARE(type, op)                                      \
+  do {                                                                     \
+    FLOAT_TYPE_##type rhs = BITCAST_TO_##type(POP_##type());               \
+    FLOAT_TYPE_##type lhs = BITCAST_TO_##type(TOP().TYPE_FIELD_NAME_##type); \
+    SET_TOP(I32, lhs op rhs);                                              \
   } while (0)
 
 #define MIN_OP <
@@ -726,6 +1688,25 @@ static WASM_INLINE uint64_t read_u64(const uint8_t** pc) {
   return result;
 }
 
+/* the operands of CALL_INDIRECT_QUICKEN and CALL_INDIRECT_CACHED that follow
+ * those of CALL_INDIRECT: the table entry, the function index and the table's
+ * epoch */
+#define CALL_INDIRECT_CACHE_SIZE (2 * sizeof(uint32_t) + sizeof(uint64_t))
+
+/* fills in the cache of the call_indirect at |instr|, and makes it use the
+ * cache from now on. The istream is written, so no other thread may be
+ * running it. */
+static void fill_call_indirect_cache(uint8_t* instr,
+                                     uint32_t entry_index,
+                                     uint32_t func_index,
+                                     uint64_t epoch) {
+  uint8_t* cache = instr + 1 + 2 * sizeof(uint32_t);
+  memcpy(cache, &entry_index, sizeof(uint32_t));
+  memcpy(cache + sizeof(uint32_t), &func_index, sizeof(uint32_t));
+  memcpy(cache + 2 * sizeof(uint32_t), &epoch, sizeof(uint64_t));
+  *instr = WASM_OPCODE_CALL_INDIRECT_CACHED;
+}
+
 static WASM_INLINE void read_table_entry_at(const uint8_t* pc,
                                             uint32_t* out_offset,
                                             uint32_t* out_drop,
@@ -735,24 +1716,217 @@ static WASM_INLINE void read_table_entry_at(const uint8_t* pc,
   *out_keep = *(pc + WASM_TABLE_ENTRY_KEEP_OFFSET);
 }
 
+uint32_t wasm_get_interpreter_instruction_size(const uint8_t* pc) {
+  uint8_t opcode = *pc;
+  switch (opcode) {
+    case WASM_OPCODE_BR:
+    case WASM_OPCODE_BR_IF:
+    case WASM_OPCODE_BR_UNLESS:
+#define V(NAME, sign, op, text) case WASM_OPCODE_BR_UNLESS_##NAME:
+      WASM_FOREACH_BR_UNLESS_COMPARE(V)
+#undef V
+    case WASM_OPCODE_I32_CONST:
+    case WASM_OPCODE_F32_CONST:
+    case WASM_OPCODE_GET_GLOBAL:
+    case WASM_OPCODE_SET_GLOBAL:
+    case WASM_OPCODE_GET_LOCAL:
+    case WASM_OPCODE_SET_LOCAL:
+    case WASM_OPCODE_TEE_LOCAL:
+    case WASM_OPCODE_CALL:
+    case WASM_OPCODE_CALL_HOST:
+    case WASM_OPCODE_CURRENT_MEMORY:
+    case WASM_OPCODE_GROW_MEMORY:
+    case WASM_OPCODE_I32_ADD_CONST:
+    case WASM_OPCODE_CHARGE_FUEL:
+#define V(NAME, type, mem_type, text) case WASM_OPCODE_##NAME##_MEM0:
+      WASM_FOREACH_MEMORY0_LOAD(V)
+      WASM_FOREACH_MEMORY0_STORE(V)
+#undef V
+      return 1 + sizeof(uint32_t);
+
+    case WASM_OPCODE_I64_CONST:
+    case WASM_OPCODE_F64_CONST:
+      return 1 + sizeof(uint64_t);
+
+    case WASM_OPCODE_BR_TABLE:
+    case WASM_OPCODE_CALL_INDIRECT:
+    case WASM_OPCODE_I32_ADD_LOCAL_LOCAL:
+    case WASM_OPCODE_TRANSLATE:
+    case WASM_OPCODE_I32_LOAD8_S:
+    case WASM_OPCODE_I32_LOAD8_U:
+    case WASM_OPCODE_I32_LOAD16_S:
+    case WASM_OPCODE_I32_LOAD16_U:
+    case WASM_OPCODE_I64_LOAD8_S:
+    case WASM_OPCODE_I64_LOAD8_U:
+    case WASM_OPCODE_I64_LOAD16_S:
+    case WASM_OPCODE_I64_LOAD16_U:
+    case WASM_OPCODE_I64_LOAD32_S:
+    case WASM_OPCODE_I64_LOAD32_U:
+    case WASM_OPCODE_I32_LOAD:
+    case WASM_OPCODE_I64_LOAD:
+    case WASM_OPCODE_F32_LOAD:
+    case WASM_OPCODE_F64_LOAD:
+    case WASM_OPCODE_I32_LOAD_CONST:
+    case WASM_OPCODE_I32_STORE8:
+    case WASM_OPCODE_I32_STORE16:
+    case WASM_OPCODE_I32_STORE:
+    case WASM_OPCODE_I64_STORE8:
+    case WASM_OPCODE_I64_STORE16:
+    case WASM_OPCODE_I64_STORE32:
+    case WASM_OPCODE_I64_STORE:
+    case WASM_OPCODE_F32_STORE:
+    case WASM_OPCODE_F64_STORE:
+      return 1 + 2 * sizeof(uint32_t);
+
+    case WASM_OPCODE_ALLOCA:
+    case WASM_OPCODE_JIT_ENTRY:
+      return 1 + 4 * sizeof(uint32_t);
+
+    case WASM_OPCODE_I32_LOAD_LOCAL:
+      return 1 + 3 * sizeof(uint32_t);
+
+#define V(NAME, kind, sign, op, text) case WASM_OPCODE_REG_##NAME:
+      WASM_FOREACH_REGISTER_BINOP(V)
+#undef V
+      return 1 + 3 * sizeof(uint32_t) + sizeof(uint8_t);
+
+    case WASM_OPCODE_DROP_KEEP:
+      return 1 + sizeof(uint32_t) + sizeof(uint8_t);
+
+    case WASM_OPCODE_DATA:
+      return 1 + sizeof(uint32_t) + read_u32_at(pc + 1);
+
+    case WASM_OPCODE_CALL_INDIRECT_QUICKEN:
+    case WASM_OPCODE_CALL_INDIRECT_CACHED:
+      return 1 + 2 * sizeof(uint32_t) + CALL_INDIRECT_CACHE_SIZE;
+
+    default:
+      return 1;
+  }
+}
+
 WasmBool wasm_func_signatures_are_equal(WasmInterpreterEnvironment* env,
                                         uint32_t sig_index_0,
                                         uint32_t sig_index_1) {
-  if (sig_index_0 == sig_index_1)
-    return WASM_TRUE;
-  WasmInterpreterFuncSignature* sig_0 = &env->sigs.data[sig_index_0];
-  WasmInterpreterFuncSignature* sig_1 = &env->sigs.data[sig_index_1];
-  return wasm_type_vectors_are_equal(&sig_0->param_types,
-                                     &sig_1->param_types) &&
-         wasm_type_vectors_are_equal(&sig_0->result_types,
-                                     &sig_1->result_types);
+  /* signatures are interned */
+  assert(sig_index_0 < env->sigs.size && sig_index_1 < env->sigs.size);
+  return sig_index_0 == sig_index_1;
 }
 
-WasmInterpreterResult wasm_call_host(WasmInterpreterThread* thread,
-                                     WasmInterpreterFunc* func) {
-  assert(func->is_host);
+#define HOST_FUNC_TYPE_NONE WASM_TYPE_VOID
+#define HOST_FUNC_TYPE_I32 WASM_TYPE_I32
+#define HOST_FUNC_TYPE_I64 WASM_TYPE_I64
+#define HOST_FUNC_COUNT_NONE 0
+#define HOST_FUNC_COUNT_I32 1
+#define HOST_FUNC_COUNT_I64 1
+/* the param at |index| is read from |args|, and the result is written over
+ * the first param */
+#define HOST_FUNC_ARG_NONE(index)
+#define HOST_FUNC_ARG_I32(index) , args[index].i32
+#define HOST_FUNC_ARG_I64(index) , args[index].i64
+#define HOST_FUNC_OUT_NONE
+#define HOST_FUNC_OUT_I32 , &args[0].i32
+#define HOST_FUNC_OUT_I64 , &args[0].i64
+
+/* |types| is the result type and then the param types, ending at the first
+ * WASM_TYPE_VOID after the result */
+static WasmBool host_func_signature_matches(
+    const WasmInterpreterFuncSignature* sig,
+    const WasmType* types) {
+  if (types[0] == WASM_TYPE_VOID ? sig->result_types.size != 0
+                                 : sig->result_types.size != 1 ||
+                                       sig->result_types.data[0] != types[0])
+    return WASM_FALSE;
+  size_t i;
+  for (i = 0; i < sig->param_types.size; ++i) {
+    if (sig->param_types.data[i] != types[i + 1])
+      return WASM_FALSE;
+  }
+  return i == 3 || types[i + 1] == WASM_TYPE_VOID;
+}
+
+#define V(name, result, param0, param1, param2)                               \
+  static WasmInterpreterResult call_host_func_##name(                         \
+      WasmInterpreterThread* thread, const WasmInterpreterFunc* func) {       \
+    enum {                                                                    \
+      param_count = HOST_FUNC_COUNT_##param0 + HOST_FUNC_COUNT_##param1 +     \
+                    HOST_FUNC_COUNT_##param2,                                 \
+    };                                                                        \
+    WasmInterpreterValue* args = thread->value_stack_top - param_count;       \
+    if (HOST_FUNC_COUNT_##result > param_count &&                             \
+        args >= thread->value_stack_end)                                      \
+      return WASM_INTERPRETER_TRAP_VALUE_STACK_EXHAUSTED;                     \
+    WasmResult call_result = func->host.direct.name(                          \
+        func->host.user_data HOST_FUNC_ARG_##param0(0)                        \
+            HOST_FUNC_ARG_##param1(1) HOST_FUNC_ARG_##param2(2)               \
+                HOST_FUNC_OUT_##result);                                      \
+    if (call_result != WASM_OK)                                               \
+      return WASM_INTERPRETER_TRAP_HOST_TRAPPED;                              \
+    if (thread->suspended_sig_index != WASM_INVALID_INDEX) {                  \
+      thread->value_stack_top = args;                                         \
+      return WASM_INTERPRETER_SUSPENDED;                                      \
+    }                                                                         \
+    thread->value_stack_top = args + HOST_FUNC_COUNT_##result;                \
+    return WASM_INTERPRETER_OK;                                               \
+  }                                                                           \
+                                                                              \
+  WasmResult wasm_set_host_func_##name(                                       \
+      WasmInterpreterFunc* func, const WasmInterpreterFuncSignature* sig,     \
+      WasmInterpreterHostFunc_##name callback, void* user_data) {             \
+    static const WasmType s_types[] = {                                       \
+        HOST_FUNC_TYPE_##result, HOST_FUNC_TYPE_##param0,                     \
+        HOST_FUNC_TYPE_##param1, HOST_FUNC_TYPE_##param2};                    \
+    assert(func->is_host);                                                    \
+    if (!host_func_signature_matches(sig, s_types))                           \
+      return WASM_ERROR;                                                      \
+    func->host.trampoline = call_host_func_##name;                            \
+    func->host.direct.name = callback;                                        \
+    func->host.user_data = user_data;                                         \
+    return WASM_OK;                                                           \
+  }
+WASM_FOREACH_HOST_FUNC_SIGNATURE(V)
+#undef V
+
+/* the host function being called on this OS thread, and the thread calling
+ * it, for wasm_suspend_host_call */
+static WASM_THREAD_LOCAL WasmInterpreterThread* s_host_call_thread;
+static WASM_THREAD_LOCAL const WasmInterpreterFunc* s_host_call_func;
+
+WasmInterpreterThread* wasm_suspend_host_call(void) {
+  WasmInterpreterThread* thread = s_host_call_thread;
+  assert(thread && thread->suspended_sig_index == WASM_INVALID_INDEX);
+  thread->suspended_sig_index = s_host_call_func->sig_index;
+  return thread;
+}
+
+WasmInterpreterResult wasm_resume_host_call(
+    WasmInterpreterThread* thread,
+    const WasmInterpreterTypedValue* results,
+    uint32_t num_results) {
+  assert(thread->suspended_sig_index < thread->env->sigs.size);
+  WasmInterpreterFuncSignature* sig =
+      &thread->env->sigs.data[thread->suspended_sig_index];
+  thread->suspended_sig_index = WASM_INVALID_INDEX;
+  if (num_results != sig->result_types.size)
+    return WASM_INTERPRETER_TRAP_HOST_RESULT_TYPE_MISMATCH;
+  uint32_t i;
+  for (i = 0; i < num_results; ++i) {
+    if (results[i].type != sig->result_types.data[i])
+      return WASM_INTERPRETER_TRAP_HOST_RESULT_TYPE_MISMATCH;
+    WasmInterpreterResult result =
+        wasm_push_thread_value(thread, results[i].value);
+    if (result != WASM_INTERPRETER_OK)
+      return result;
+  }
+  return WASM_INTERPRETER_OK;
+}
+
+static WasmInterpreterResult call_host_callback(WasmInterpreterThread* thread,
+                                                WasmInterpreterFunc* func) {
   assert(func->sig_index < thread->env->sigs.size);
   WasmInterpreterFuncSignature* sig = &thread->env->sigs.data[func->sig_index];
+  WasmInterpreterValue* value_stack_top = thread->value_stack_top;
+  WasmInterpreterValue* value_stack_end = thread->value_stack_end;
 
   uint32_t num_args = sig->param_types.size;
   if (thread->host_args.size < num_args) {
@@ -776,50 +1950,117 @@ WasmInterpreterResult wasm_call_host(WasmInterpreterThread* thread,
       func, sig, num_args, thread->host_args.data, num_results,
       call_result_values, func->host.user_data);
   TRAP_IF(call_result != WASM_OK, HOST_TRAPPED);
+  if (thread->suspended_sig_index != WASM_INVALID_INDEX) {
+    SAVE_VALUE_STACK_TOP();
+    return WASM_INTERPRETER_SUSPENDED;
+  }
 
   for (i = 0; i < num_results; ++i) {
     TRAP_IF(call_result_values[i].type != sig->result_types.data[i],
             HOST_RESULT_TYPE_MISMATCH);
+    /* a host function can be called directly, without an ALLOCA */
+    CHECK_STACK();
     PUSH(call_result_values[i].value);
   }
 
+  SAVE_VALUE_STACK_TOP();
   return WASM_INTERPRETER_OK;
 }
 
-WasmInterpreterResult wasm_run_interpreter(WasmInterpreterThread* thread,
-                                           uint32_t num_instructions,
-                                           uint32_t* call_stack_return_top) {
+WasmInterpreterResult wasm_call_host(WasmInterpreterThread* thread,
+                                     WasmInterpreterFunc* func) {
+  assert(func->is_host);
+  WasmInterpreterThread* prev_thread = s_host_call_thread;
+  const WasmInterpreterFunc* prev_func = s_host_call_func;
+  s_host_call_thread = thread;
+  s_host_call_func = func;
+  WasmInterpreterResult result = func->host.trampoline
+                                     ? func->host.trampoline(thread, func)
+                                     : call_host_callback(thread, func);
+  s_host_call_thread = prev_thread;
+  s_host_call_func = prev_func;
+  return result;
+}
+
+/* |single_step| is a constant at each call site, so once inlined the check in
+ * NEXT() disappears from the run-to-completion loop */
+static WASM_INLINE WasmInterpreterResult
+run_interpreter(WasmInterpreterThread* thread,
+                WasmBool single_step,
+                uint32_t* call_stack_return_top) {
   WasmInterpreterResult result = WASM_INTERPRETER_OK;
   assert(call_stack_return_top < thread->call_stack_end);
 
   WasmInterpreterEnvironment* env = thread->env;
+  WasmInterpreterInstance* instance = thread->instance;
+  void* memory0_data = NULL;
+  uint32_t memory0_size = 0;
+  LOAD_MEMORY0();
 
   const uint8_t* istream = env->istream.start;
   const uint8_t* pc = &istream[thread->pc];
-  uint32_t i;
-  for (i = 0; i < num_instructions; ++i) {
-    uint8_t opcode = *pc++;
+  WasmInterpreterValue* value_stack_top = thread->value_stack_top;
+  WasmInterpreterValue* const value_stack_end = thread->value_stack_end;
+#if WASM_INTERPRETER_USE_COMPUTED_GOTO
+  static const void* const s_opcode_targets[WASM_NUM_INTERPRETER_OPCODES] = {
+#define V(rtype, type1, type2, mem_size, code, NAME, text) \
+  [code] = &&op_##NAME,
+      WASM_FOREACH_OPCODE(V)
+#undef V
+      [WASM_OPCODE_ALLOCA] = &&op_ALLOCA,
+      [WASM_OPCODE_JIT_ENTRY] = &&op_JIT_ENTRY,
+      [WASM_OPCODE_CHARGE_FUEL] = &&op_CHARGE_FUEL,
+      [WASM_OPCODE_BR_UNLESS] = &&op_BR_UNLESS,
+#define V(NAME, sign, op, text) \
+  [WASM_OPCODE_BR_UNLESS_##NAME] = &&op_BR_UNLESS_##NAME,
+      WASM_FOREACH_BR_UNLESS_COMPARE(V)
+#undef V
+      [WASM_OPCODE_I32_ADD_LOCAL_LOCAL] = &&op_I32_ADD_LOCAL_LOCAL,
+      [WASM_OPCODE_I32_ADD_CONST] = &&op_I32_ADD_CONST,
+      [WASM_OPCODE_I32_LOAD_LOCAL] = &&op_I32_LOAD_LOCAL,
+      [WASM_OPCODE_I32_LOAD_CONST] = &&op_I32_LOAD_CONST,
+#define V(NAME, kind, sign, op, text) \
+  [WASM_OPCODE_REG_##NAME] = &&op_REG_##NAME,
+      WASM_FOREACH_REGISTER_BINOP(V)
+#undef V
+#define V(NAME, type, mem_type, text) \
+  [WASM_OPCODE_##NAME##_MEM0] = &&op_##NAME##_MEM0,
+      WASM_FOREACH_MEMORY0_LOAD(V)
+      WASM_FOREACH_MEMORY0_STORE(V)
+#undef V
+      [WASM_OPCODE_CALL_HOST] = &&op_CALL_HOST,
+      [WASM_OPCODE_DATA] = &&op_DATA,
+      [WASM_OPCODE_DROP_KEEP] = &&op_DROP_KEEP,
+      [WASM_OPCODE_TRANSLATE] = &&op_TRANSLATE,
+      [WASM_OPCODE_CALL_INDIRECT_QUICKEN] = &&op_CALL_INDIRECT_QUICKEN,
+      [WASM_OPCODE_CALL_INDIRECT_CACHED] = &&op_CALL_INDIRECT_CACHED,
+  };
+#endif
+
+  uint8_t opcode;
+  do {
+    opcode = *pc++;
     switch (opcode) {
-      case WASM_OPCODE_SELECT: {
+      TARGET(SELECT) {
         VALUE_TYPE_I32 cond = POP_I32();
         WasmInterpreterValue false_ = POP();
         WasmInterpreterValue true_ = POP();
         PUSH(cond ? true_ : false_);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_BR:
+      TARGET(BR)
         GOTO(read_u32(&pc));
-        break;
+        NEXT();
 
-      case WASM_OPCODE_BR_IF: {
+      TARGET(BR_IF) {
         uint32_t new_pc = read_u32(&pc);
         if (POP_I32())
           GOTO(new_pc);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_BR_TABLE: {
+      TARGET(BR_TABLE) {
         uint32_t num_targets = read_u32(&pc);
         uint32_t table_offset = read_u32(&pc);
         VALUE_TYPE_I32 key = POP_I32();
@@ -832,207 +2073,259 @@ WasmInterpreterResult wasm_run_interpreter(WasmInterpreterThread* thread,
         read_table_entry_at(entry, &new_pc, &drop_count, &keep_count);
         DROP_KEEP(drop_count, keep_count);
         GOTO(new_pc);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_RETURN:
+      TARGET(RETURN) {
         if (thread->call_stack_top == call_stack_return_top) {
           result = WASM_INTERPRETER_RETURNED;
           goto exit_loop;
         }
-        GOTO(POP_CALL());
-        break;
+        uint32_t return_offset = POP_CALL();
+#if WASM_INTERPRETER_JIT
+        if (return_offset & WASM_JIT_RESUME_POINT_BIT) {
+          RUN_JIT_CODE(wasm_resume_jit_code,
+                       return_offset & ~WASM_JIT_RESUME_POINT_BIT);
+          NEXT();
+        }
+#endif
+        GOTO(return_offset);
+        NEXT();
+      }
 
-      case WASM_OPCODE_UNREACHABLE:
+      TARGET(UNREACHABLE)
         TRAP(UNREACHABLE);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_CONST:
+      TARGET(I32_CONST)
         PUSH_I32(read_u32(&pc));
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_CONST:
+      TARGET(I64_CONST)
         PUSH_I64(read_u64(&pc));
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_CONST:
+      TARGET(F32_CONST)
         PUSH_F32(read_u32(&pc));
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_CONST:
+      TARGET(F64_CONST)
         PUSH_F64(read_u64(&pc));
-        break;
+        NEXT();
 
-      case WASM_OPCODE_GET_GLOBAL: {
+      TARGET(GET_GLOBAL) {
         uint32_t index = read_u32(&pc);
-        assert(index < env->globals.size);
-        PUSH(env->globals.data[index].typed_value.value);
-        break;
+        assert(index < instance->globals.size);
+        PUSH(instance->globals.data[index].typed_value.value);
+        NEXT();
       }
 
-      case WASM_OPCODE_SET_GLOBAL: {
+      TARGET(SET_GLOBAL) {
         uint32_t index = read_u32(&pc);
-        assert(index < env->globals.size);
-        env->globals.data[index].typed_value.value = POP();
-        break;
+        assert(index < instance->globals.size);
+        instance->globals.data[index].typed_value.value = POP();
+        NEXT();
       }
 
-      case WASM_OPCODE_GET_LOCAL: {
+      TARGET(GET_LOCAL) {
         WasmInterpreterValue value = PICK(read_u32(&pc));
         PUSH(value);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_SET_LOCAL: {
+      TARGET(SET_LOCAL) {
         WasmInterpreterValue value = POP();
         PICK(read_u32(&pc)) = value;
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_TEE_LOCAL:
+      TARGET(TEE_LOCAL)
         PICK(read_u32(&pc)) = TOP();
-        break;
+        NEXT();
 
-      case WASM_OPCODE_CALL: {
+      TARGET(CALL) {
         uint32_t offset = read_u32(&pc);
         PUSH_CALL();
         GOTO(offset);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_CALL_INDIRECT: {
+      TARGET(CALL_INDIRECT) {
         uint32_t table_index = read_u32(&pc);
-        assert(table_index < env->tables.size);
-        WasmInterpreterTable* table = &env->tables.data[table_index];
+        assert(table_index < instance->tables.size);
+        WasmInterpreterTable* table = &instance->tables.data[table_index];
         uint32_t sig_index = read_u32(&pc);
         assert(sig_index < env->sigs.size);
         VALUE_TYPE_I32 entry_index = POP_I32();
-        TRAP_IF(entry_index >= table->func_indexes.size, UNDEFINED_TABLE_INDEX);
-        uint32_t func_index = table->func_indexes.data[entry_index];
-        TRAP_IF(func_index == WASM_INVALID_INDEX, UNINITIALIZED_TABLE_ELEMENT);
-        WasmInterpreterFunc* func = &env->funcs.data[func_index];
-        TRAP_UNLESS(
-            wasm_func_signatures_are_equal(env, func->sig_index, sig_index),
-            INDIRECT_CALL_SIGNATURE_MISMATCH);
-        if (func->is_host) {
-          wasm_call_host(thread, func);
+        uint32_t func_index;
+        GET_INDIRECT_FUNC_INDEX(table, sig_index, entry_index, func_index);
+        CALL_FUNC(&env->funcs.data[func_index]);
+        NEXT();
+      }
+
+      TARGET(CALL_INDIRECT_QUICKEN) {
+        uint8_t* instr = (uint8_t*)pc - 1;
+        uint32_t table_index = read_u32(&pc);
+        assert(table_index < instance->tables.size);
+        WasmInterpreterTable* table = &instance->tables.data[table_index];
+        uint32_t sig_index = read_u32(&pc);
+        assert(sig_index < env->sigs.size);
+        VALUE_TYPE_I32 entry_index = POP_I32();
+        uint32_t func_index;
+        GET_INDIRECT_FUNC_INDEX(table, sig_index, entry_index, func_index);
+        fill_call_indirect_cache(instr, entry_index, func_index, table->epoch);
+        pc += CALL_INDIRECT_CACHE_SIZE;
+        CALL_FUNC(&env->funcs.data[func_index]);
+        NEXT();
+      }
+
+      TARGET(CALL_INDIRECT_CACHED) {
+        uint8_t* instr = (uint8_t*)pc - 1;
+        uint32_t table_index = read_u32(&pc);
+        assert(table_index < instance->tables.size);
+        WasmInterpreterTable* table = &instance->tables.data[table_index];
+        uint32_t sig_index = read_u32(&pc);
+        VALUE_TYPE_I32 entry_index = POP_I32();
+        uint32_t func_index;
+        /* the table is unchanged since the function at the entry was found to
+         * have the right signature, so it needn't be looked up again */
+        if (WASM_LIKELY(entry_index == read_u32_at(pc) &&
+                        table->epoch ==
+                            read_u64_at(pc + 2 * sizeof(uint32_t)))) {
+          func_index = read_u32_at(pc + sizeof(uint32_t));
         } else {
-          PUSH_CALL();
-          GOTO(func->defined.offset);
+          GET_INDIRECT_FUNC_INDEX(table, sig_index, entry_index, func_index);
+          fill_call_indirect_cache(instr, entry_index, func_index,
+                                   table->epoch);
         }
-        break;
+        pc += CALL_INDIRECT_CACHE_SIZE;
+        CALL_FUNC(&env->funcs.data[func_index]);
+        NEXT();
       }
 
-      case WASM_OPCODE_CALL_HOST: {
+      TARGET(CALL_HOST) {
         uint32_t func_index = read_u32(&pc);
         assert(func_index < env->funcs.size);
-        WasmInterpreterFunc* func = &env->funcs.data[func_index];
-        wasm_call_host(thread, func);
-        break;
+        CALL_HOST(&env->funcs.data[func_index]);
+        NEXT();
       }
 
-      case WASM_OPCODE_I32_LOAD8_S:
+      TARGET(I32_LOAD8_S)
         LOAD(I32, I8);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_LOAD8_U:
+      TARGET(I32_LOAD8_U)
         LOAD(I32, U8);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_LOAD16_S:
+      TARGET(I32_LOAD16_S)
         LOAD(I32, I16);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_LOAD16_U:
+      TARGET(I32_LOAD16_U)
         LOAD(I32, U16);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_LOAD8_S:
+      TARGET(I64_LOAD8_S)
         LOAD(I64, I8);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_LOAD8_U:
+      TARGET(I64_LOAD8_U)
         LOAD(I64, U8);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_LOAD16_S:
+      TARGET(I64_LOAD16_S)
         LOAD(I64, I16);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_LOAD16_U:
+      TARGET(I64_LOAD16_U)
         LOAD(I64, U16);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_LOAD32_S:
+      TARGET(I64_LOAD32_S)
         LOAD(I64, I32);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_LOAD32_U:
+      TARGET(I64_LOAD32_U)
         LOAD(I64, U32);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_LOAD:
+      TARGET(I32_LOAD)
         LOAD(I32, U32);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_LOAD:
+      TARGET(I64_LOAD)
         LOAD(I64, U64);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_LOAD:
+      TARGET(F32_LOAD)
         LOAD(F32, F32);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_LOAD:
+      TARGET(F64_LOAD)
         LOAD(F64, F64);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_STORE8:
+      TARGET(I32_STORE8)
         STORE(I32, U8);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_STORE16:
+      TARGET(I32_STORE16)
         STORE(I32, U16);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_STORE8:
+      TARGET(I64_STORE8)
         STORE(I64, U8);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_STORE16:
+      TARGET(I64_STORE16)
         STORE(I64, U16);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_STORE32:
+      TARGET(I64_STORE32)
         STORE(I64, U32);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_STORE:
+      TARGET(I32_STORE)
         STORE(I32, U32);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_STORE:
+      TARGET(I64_STORE)
         STORE(I64, U64);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_STORE:
+      TARGET(F32_STORE)
         STORE(F32, F32);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_STORE:
+      TARGET(F64_STORE)
         STORE(F64, F64);
-        break;
+        NEXT();
+
+#define V(NAME, type, mem_type, text)                                  \
+  TARGET(NAME##_MEM0)                                                 \
+    LOAD_FROM_MEMORY(memory0_data, memory0_size, type, mem_type,      \
+                     POP_I32());                                      \
+    NEXT();
+      WASM_FOREACH_MEMORY0_LOAD(V)
+#undef V
 
-      case WASM_OPCODE_CURRENT_MEMORY: {
+#define V(NAME, type, mem_type, text)                                 \
+  TARGET(NAME##_MEM0)                                                \
+    STORE_TO_MEMORY(memory0_data, memory0_size, type, mem_type);     \
+    NEXT();
+      WASM_FOREACH_MEMORY0_STORE(V)
+#undef V
+
+      TARGET(CURRENT_MEMORY) {
         GET_MEMORY(memory);
         PUSH_I32(memory->page_limits.initial);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_GROW_MEMORY: {
+      TARGET(GROW_MEMORY) {
         GET_MEMORY(memory);
         uint32_t old_page_size = memory->page_limits.initial;
-        uint32_t old_byte_size = memory->byte_size;
         VALUE_TYPE_I32 grow_pages = POP_I32();
         uint32_t new_page_size = old_page_size + grow_pages;
         uint32_t max_page_size = memory->page_limits.has_max
@@ -1041,519 +2334,512 @@ WasmInterpreterResult wasm_run_interpreter(WasmInterpreterThread* thread,
         PUSH_NEG_1_AND_BREAK_IF(new_page_size > max_page_size);
         PUSH_NEG_1_AND_BREAK_IF((uint64_t)new_page_size * WASM_PAGE_SIZE >
                                 UINT32_MAX);
-        uint32_t new_byte_size = new_page_size * WASM_PAGE_SIZE;
-        WasmAllocator* allocator = memory->allocator;
-        void* new_data = wasm_realloc(allocator, memory->data, new_byte_size,
-                                      WASM_DEFAULT_ALIGN);
-        PUSH_NEG_1_AND_BREAK_IF(new_data == NULL);
-        memset((void*)((intptr_t)new_data + old_byte_size), 0,
-               new_byte_size - old_byte_size);
-        memory->data = new_data;
-        memory->page_limits.initial = new_page_size;
-        memory->byte_size = new_byte_size;
+        PUSH_NEG_1_AND_BREAK_IF(
+            WASM_FAILED(wasm_grow_interpreter_memory(memory, new_page_size)));
+        LOAD_MEMORY0();
         PUSH_I32(old_page_size);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I32_ADD:
+      TARGET(I32_ADD)
         BINOP(I32, I32, +);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_SUB:
+      TARGET(I32_SUB)
         BINOP(I32, I32, -);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_MUL:
+      TARGET(I32_MUL)
         BINOP(I32, I32, *);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_DIV_S:
+      TARGET(I32_DIV_S)
         BINOP_DIV_S(I32);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_DIV_U:
+      TARGET(I32_DIV_U)
         BINOP_DIV_REM_U(I32, / );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_REM_S:
+      TARGET(I32_REM_S)
         BINOP_REM_S(I32);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_REM_U:
+      TARGET(I32_REM_U)
         BINOP_DIV_REM_U(I32, % );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_AND:
+      TARGET(I32_AND)
         BINOP(I32, I32, &);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_OR:
+      TARGET(I32_OR)
         BINOP(I32, I32, | );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_XOR:
+      TARGET(I32_XOR)
         BINOP(I32, I32, ^);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_SHL:
+      TARGET(I32_SHL)
         BINOP_SHIFT(I32, <<, UNSIGNED);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_SHR_U:
+      TARGET(I32_SHR_U)
         BINOP_SHIFT(I32, >>, UNSIGNED);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_SHR_S:
+      TARGET(I32_SHR_S)
         BINOP_SHIFT(I32, >>, SIGNED);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_EQ:
+      TARGET(I32_EQ)
         BINOP(I32, I32, == );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_NE:
+      TARGET(I32_NE)
         BINOP(I32, I32, != );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_LT_S:
+      TARGET(I32_LT_S)
         BINOP_SIGNED(I32, I32, < );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_LE_S:
+      TARGET(I32_LE_S)
         BINOP_SIGNED(I32, I32, <= );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_LT_U:
+      TARGET(I32_LT_U)
         BINOP(I32, I32, < );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_LE_U:
+      TARGET(I32_LE_U)
         BINOP(I32, I32, <= );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_GT_S:
+      TARGET(I32_GT_S)
         BINOP_SIGNED(I32, I32, > );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_GE_S:
+      TARGET(I32_GE_S)
         BINOP_SIGNED(I32, I32, >= );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_GT_U:
+      TARGET(I32_GT_U)
         BINOP(I32, I32, > );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_GE_U:
+      TARGET(I32_GE_U)
         BINOP(I32, I32, >= );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_CLZ: {
+      TARGET(I32_CLZ) {
         VALUE_TYPE_I32 value = POP_I32();
         PUSH_I32(value != 0 ? wasm_clz_u32(value) : 32);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I32_CTZ: {
+      TARGET(I32_CTZ) {
         VALUE_TYPE_I32 value = POP_I32();
         PUSH_I32(value != 0 ? wasm_ctz_u32(value) : 32);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I32_POPCNT: {
+      TARGET(I32_POPCNT) {
         VALUE_TYPE_I32 value = POP_I32();
         PUSH_I32(wasm_popcount_u32(value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I32_EQZ: {
+      TARGET(I32_EQZ) {
         VALUE_TYPE_I32 value = POP_I32();
         PUSH_I32(value == 0);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I64_ADD:
+      TARGET(I64_ADD)
         BINOP(I64, I64, +);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_SUB:
+      TARGET(I64_SUB)
         BINOP(I64, I64, -);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_MUL:
+      TARGET(I64_MUL)
         BINOP(I64, I64, *);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_DIV_S:
+      TARGET(I64_DIV_S)
         BINOP_DIV_S(I64);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_DIV_U:
+      TARGET(I64_DIV_U)
         BINOP_DIV_REM_U(I64, / );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_REM_S:
+      TARGET(I64_REM_S)
         BINOP_REM_S(I64);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_REM_U:
+      TARGET(I64_REM_U)
         BINOP_DIV_REM_U(I64, % );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_AND:
+      TARGET(I64_AND)
         BINOP(I64, I64, &);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_OR:
+      TARGET(I64_OR)
         BINOP(I64, I64, | );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_XOR:
+      TARGET(I64_XOR)
         BINOP(I64, I64, ^);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_SHL:
+      TARGET(I64_SHL)
         BINOP_SHIFT(I64, <<, UNSIGNED);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_SHR_U:
+      TARGET(I64_SHR_U)
         BINOP_SHIFT(I64, >>, UNSIGNED);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_SHR_S:
+      TARGET(I64_SHR_S)
         BINOP_SHIFT(I64, >>, SIGNED);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_EQ:
+      TARGET(I64_EQ)
         BINOP(I32, I64, == );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_NE:
+      TARGET(I64_NE)
         BINOP(I32, I64, != );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_LT_S:
+      TARGET(I64_LT_S)
         BINOP_SIGNED(I32, I64, < );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_LE_S:
+      TARGET(I64_LE_S)
         BINOP_SIGNED(I32, I64, <= );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_LT_U:
+      TARGET(I64_LT_U)
         BINOP(I32, I64, < );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_LE_U:
+      TARGET(I64_LE_U)
         BINOP(I32, I64, <= );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_GT_S:
+      TARGET(I64_GT_S)
         BINOP_SIGNED(I32, I64, > );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_GE_S:
+      TARGET(I64_GE_S)
         BINOP_SIGNED(I32, I64, >= );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_GT_U:
+      TARGET(I64_GT_U)
         BINOP(I32, I64, > );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_GE_U:
+      TARGET(I64_GE_U)
         BINOP(I32, I64, >= );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_CLZ: {
+      TARGET(I64_CLZ) {
         VALUE_TYPE_I64 value = POP_I64();
         PUSH_I64(value != 0 ? wasm_clz_u64(value) : 64);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I64_CTZ: {
+      TARGET(I64_CTZ) {
         VALUE_TYPE_I64 value = POP_I64();
         PUSH_I64(value != 0 ? wasm_ctz_u64(value) : 64);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I64_POPCNT: {
+      TARGET(I64_POPCNT) {
         VALUE_TYPE_I64 value = POP_I64();
         PUSH_I64(wasm_popcount_u64(value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F32_ADD:
+      TARGET(F32_ADD)
         BINOP_FLOAT(F32, +);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_SUB:
+      TARGET(F32_SUB)
         BINOP_FLOAT(F32, -);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_MUL:
+      TARGET(F32_MUL)
         BINOP_FLOAT(F32, *);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_DIV:
+      TARGET(F32_DIV)
         BINOP_FLOAT_DIV(F32);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_MIN:
+      TARGET(F32_MIN)
         MINMAX_FLOAT(F32, MIN);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_MAX:
+      TARGET(F32_MAX)
         MINMAX_FLOAT(F32, MAX);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_ABS:
+      TARGET(F32_ABS)
         TOP().f32_bits &= ~F32_SIGN_MASK;
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_NEG:
+      TARGET(F32_NEG)
         TOP().f32_bits ^= F32_SIGN_MASK;
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_COPYSIGN: {
+      TARGET(F32_COPYSIGN) {
         VALUE_TYPE_F32 rhs = POP_F32();
         VALUE_TYPE_F32 lhs = POP_F32();
         PUSH_F32((lhs & ~F32_SIGN_MASK) | (rhs & F32_SIGN_MASK));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F32_CEIL:
+      TARGET(F32_CEIL)
         UNOP_FLOAT(F32, ceilf);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_FLOOR:
+      TARGET(F32_FLOOR)
         UNOP_FLOAT(F32, floorf);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_TRUNC:
+      TARGET(F32_TRUNC)
         UNOP_FLOAT(F32, truncf);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_NEAREST:
+      TARGET(F32_NEAREST)
         UNOP_FLOAT(F32, nearbyintf);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_SQRT:
+      TARGET(F32_SQRT)
         UNOP_FLOAT(F32, sqrtf);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_EQ:
+      TARGET(F32_EQ)
         BINOP_FLOAT_COMPARE(F32, == );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_NE:
+      TARGET(F32_NE)
         BINOP_FLOAT_COMPARE(F32, != );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_LT:
+      TARGET(F32_LT)
         BINOP_FLOAT_COMPARE(F32, < );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_LE:
+      TARGET(F32_LE)
         BINOP_FLOAT_COMPARE(F32, <= );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_GT:
+      TARGET(F32_GT)
         BINOP_FLOAT_COMPARE(F32, > );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F32_GE:
+      TARGET(F32_GE)
         BINOP_FLOAT_COMPARE(F32, >= );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_ADD:
+      TARGET(F64_ADD)
         BINOP_FLOAT(F64, +);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_SUB:
+      TARGET(F64_SUB)
         BINOP_FLOAT(F64, -);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_MUL:
+      TARGET(F64_MUL)
         BINOP_FLOAT(F64, *);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_DIV:
+      TARGET(F64_DIV)
         BINOP_FLOAT_DIV(F64);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_MIN:
+      TARGET(F64_MIN)
         MINMAX_FLOAT(F64, MIN);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_MAX:
+      TARGET(F64_MAX)
         MINMAX_FLOAT(F64, MAX);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_ABS:
+      TARGET(F64_ABS)
         TOP().f64_bits &= ~F64_SIGN_MASK;
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_NEG:
+      TARGET(F64_NEG)
         TOP().f64_bits ^= F64_SIGN_MASK;
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_COPYSIGN: {
+      TARGET(F64_COPYSIGN) {
         VALUE_TYPE_F64 rhs = POP_F64();
         VALUE_TYPE_F64 lhs = POP_F64();
         PUSH_F64((lhs & ~F64_SIGN_MASK) | (rhs & F64_SIGN_MASK));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F64_CEIL:
+      TARGET(F64_CEIL)
         UNOP_FLOAT(F64, ceil);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_FLOOR:
+      TARGET(F64_FLOOR)
         UNOP_FLOAT(F64, floor);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_TRUNC:
+      TARGET(F64_TRUNC)
         UNOP_FLOAT(F64, trunc);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_NEAREST:
+      TARGET(F64_NEAREST)
         UNOP_FLOAT(F64, nearbyint);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_SQRT:
+      TARGET(F64_SQRT)
         UNOP_FLOAT(F64, sqrt);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_EQ:
+      TARGET(F64_EQ)
         BINOP_FLOAT_COMPARE(F64, == );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_NE:
+      TARGET(F64_NE)
         BINOP_FLOAT_COMPARE(F64, != );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_LT:
+      TARGET(F64_LT)
         BINOP_FLOAT_COMPARE(F64, < );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_LE:
+      TARGET(F64_LE)
         BINOP_FLOAT_COMPARE(F64, <= );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_GT:
+      TARGET(F64_GT)
         BINOP_FLOAT_COMPARE(F64, > );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_F64_GE:
+      TARGET(F64_GE)
         BINOP_FLOAT_COMPARE(F64, >= );
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_TRUNC_S_F32: {
+      TARGET(I32_TRUNC_S_F32) {
         VALUE_TYPE_F32 value = POP_F32();
         TRAP_IF(is_nan_f32(value), INVALID_CONVERSION_TO_INTEGER);
         TRAP_UNLESS(is_in_range_i32_trunc_s_f32(value), INTEGER_OVERFLOW);
         PUSH_I32((int32_t)BITCAST_TO_F32(value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I32_TRUNC_S_F64: {
+      TARGET(I32_TRUNC_S_F64) {
         VALUE_TYPE_F64 value = POP_F64();
         TRAP_IF(is_nan_f64(value), INVALID_CONVERSION_TO_INTEGER);
         TRAP_UNLESS(is_in_range_i32_trunc_s_f64(value), INTEGER_OVERFLOW);
         PUSH_I32((int32_t)BITCAST_TO_F64(value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I32_TRUNC_U_F32: {
+      TARGET(I32_TRUNC_U_F32) {
         VALUE_TYPE_F32 value = POP_F32();
         TRAP_IF(is_nan_f32(value), INVALID_CONVERSION_TO_INTEGER);
         TRAP_UNLESS(is_in_range_i32_trunc_u_f32(value), INTEGER_OVERFLOW);
         PUSH_I32((uint32_t)BITCAST_TO_F32(value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I32_TRUNC_U_F64: {
+      TARGET(I32_TRUNC_U_F64) {
         VALUE_TYPE_F64 value = POP_F64();
         TRAP_IF(is_nan_f64(value), INVALID_CONVERSION_TO_INTEGER);
         TRAP_UNLESS(is_in_range_i32_trunc_u_f64(value), INTEGER_OVERFLOW);
         PUSH_I32((uint32_t)BITCAST_TO_F64(value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I32_WRAP_I64: {
+      TARGET(I32_WRAP_I64) {
         VALUE_TYPE_I64 value = POP_I64();
         PUSH_I32((uint32_t)value);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I64_TRUNC_S_F32: {
+      TARGET(I64_TRUNC_S_F32) {
         VALUE_TYPE_F32 value = POP_F32();
         TRAP_IF(is_nan_f32(value), INVALID_CONVERSION_TO_INTEGER);
         TRAP_UNLESS(is_in_range_i64_trunc_s_f32(value), INTEGER_OVERFLOW);
         PUSH_I64((int64_t)BITCAST_TO_F32(value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I64_TRUNC_S_F64: {
+      TARGET(I64_TRUNC_S_F64) {
         VALUE_TYPE_F64 value = POP_F64();
         TRAP_IF(is_nan_f64(value), INVALID_CONVERSION_TO_INTEGER);
         TRAP_UNLESS(is_in_range_i64_trunc_s_f64(value), INTEGER_OVERFLOW);
         PUSH_I64((int64_t)BITCAST_TO_F64(value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I64_TRUNC_U_F32: {
+      TARGET(I64_TRUNC_U_F32) {
         VALUE_TYPE_F32 value = POP_F32();
         TRAP_IF(is_nan_f32(value), INVALID_CONVERSION_TO_INTEGER);
         TRAP_UNLESS(is_in_range_i64_trunc_u_f32(value), INTEGER_OVERFLOW);
         PUSH_I64((uint64_t)BITCAST_TO_F32(value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I64_TRUNC_U_F64: {
+      TARGET(I64_TRUNC_U_F64) {
         VALUE_TYPE_F64 value = POP_F64();
         TRAP_IF(is_nan_f64(value), INVALID_CONVERSION_TO_INTEGER);
         TRAP_UNLESS(is_in_range_i64_trunc_u_f64(value), INTEGER_OVERFLOW);
         PUSH_I64((uint64_t)BITCAST_TO_F64(value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I64_EXTEND_S_I32: {
+      TARGET(I64_EXTEND_S_I32) {
         VALUE_TYPE_I32 value = POP_I32();
         PUSH_I64((int64_t)BITCAST_I32_TO_SIGNED(value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I64_EXTEND_U_I32: {
+      TARGET(I64_EXTEND_U_I32) {
         VALUE_TYPE_I32 value = POP_I32();
         PUSH_I64((uint64_t)value);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F32_CONVERT_S_I32: {
+      TARGET(F32_CONVERT_S_I32) {
         VALUE_TYPE_I32 value = POP_I32();
         PUSH_F32(BITCAST_FROM_F32((float)BITCAST_I32_TO_SIGNED(value)));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F32_CONVERT_U_I32: {
+      TARGET(F32_CONVERT_U_I32) {
         VALUE_TYPE_I32 value = POP_I32();
         PUSH_F32(BITCAST_FROM_F32((float)value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F32_CONVERT_S_I64: {
+      TARGET(F32_CONVERT_S_I64) {
         VALUE_TYPE_I64 value = POP_I64();
         PUSH_F32(BITCAST_FROM_F32((float)BITCAST_I64_TO_SIGNED(value)));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F32_CONVERT_U_I64: {
+      TARGET(F32_CONVERT_U_I64) {
         VALUE_TYPE_I64 value = POP_I64();
         PUSH_F32(BITCAST_FROM_F32((float)value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F32_DEMOTE_F64: {
+      TARGET(F32_DEMOTE_F64) {
         VALUE_TYPE_F64 value = POP_F64();
         if (WASM_LIKELY(is_in_range_f64_demote_f32(value))) {
           PUSH_F32(BITCAST_FROM_F32((float)BITCAST_TO_F64(value)));
@@ -1570,136 +2856,268 @@ WasmInterpreterResult wasm_run_interpreter(WasmInterpreterThread* thread,
           }
           PUSH_F32(sign | F32_INF | tag);
         }
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F32_REINTERPRET_I32: {
+      TARGET(F32_REINTERPRET_I32) {
         VALUE_TYPE_I32 value = POP_I32();
         PUSH_F32(value);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F64_CONVERT_S_I32: {
+      TARGET(F64_CONVERT_S_I32) {
         VALUE_TYPE_I32 value = POP_I32();
         PUSH_F64(BITCAST_FROM_F64((double)BITCAST_I32_TO_SIGNED(value)));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F64_CONVERT_U_I32: {
+      TARGET(F64_CONVERT_U_I32) {
         VALUE_TYPE_I32 value = POP_I32();
         PUSH_F64(BITCAST_FROM_F64((double)value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F64_CONVERT_S_I64: {
+      TARGET(F64_CONVERT_S_I64) {
         VALUE_TYPE_I64 value = POP_I64();
         PUSH_F64(BITCAST_FROM_F64((double)BITCAST_I64_TO_SIGNED(value)));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F64_CONVERT_U_I64: {
+      TARGET(F64_CONVERT_U_I64) {
         VALUE_TYPE_I64 value = POP_I64();
         PUSH_F64(BITCAST_FROM_F64((double)value));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F64_PROMOTE_F32: {
+      TARGET(F64_PROMOTE_F32) {
         VALUE_TYPE_F32 value = POP_F32();
         PUSH_F64(BITCAST_FROM_F64((double)BITCAST_TO_F32(value)));
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_F64_REINTERPRET_I64: {
+      TARGET(F64_REINTERPRET_I64) {
         VALUE_TYPE_I64 value = POP_I64();
         PUSH_F64(value);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I32_REINTERPRET_F32: {
+      TARGET(I32_REINTERPRET_F32) {
         VALUE_TYPE_F32 value = POP_F32();
         PUSH_I32(value);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I64_REINTERPRET_F64: {
+      TARGET(I64_REINTERPRET_F64) {
         VALUE_TYPE_F64 value = POP_F64();
         PUSH_I64(value);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_I32_ROTR:
+      TARGET(I32_ROTR)
         BINOP_ROT(I32, RIGHT);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I32_ROTL:
+      TARGET(I32_ROTL)
         BINOP_ROT(I32, LEFT);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_ROTR:
+      TARGET(I64_ROTR)
         BINOP_ROT(I64, RIGHT);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_ROTL:
+      TARGET(I64_ROTL)
         BINOP_ROT(I64, LEFT);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_I64_EQZ: {
+      TARGET(I64_EQZ) {
         VALUE_TYPE_I64 value = POP_I64();
         PUSH_I64(value == 0);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_ALLOCA: {
-        WasmInterpreterValue* old_value_stack_top = thread->value_stack_top;
-        thread->value_stack_top += read_u32(&pc);
-        CHECK_STACK();
-        memset(old_value_stack_top, 0,
-               (thread->value_stack_top - old_value_stack_top) *
-                   sizeof(WasmInterpreterValue));
-        break;
+      TARGET(ALLOCA) {
+        CHARGE_FUEL(pc - 1, read_u32_at(pc + 3 * sizeof(uint32_t)));
+        uint32_t local_count = read_u32(&pc);
+        uint32_t max_stack_height = read_u32(&pc);
+#if WASM_INTERPRETER_JIT
+        uint32_t func_index = read_u32(&pc);
+        WasmInterpreterFunc* func = &env->funcs.data[func_index];
+        if (WASM_UNLIKELY(++func->defined.call_count ==
+                          WASM_INTERPRETER_JIT_THRESHOLD) &&
+            !func->defined.jit_code &&
+            wasm_compile_jit_func(thread->allocator, env, func_index)) {
+          /* later calls go straight to the native code */
+          ((uint8_t*)istream)[func->defined.offset] = WASM_OPCODE_JIT_ENTRY;
+          RUN_JIT_CODE(wasm_run_jit_func, func);
+          NEXT();
+        }
+        pc += sizeof(uint32_t);
+#else
+        pc += 2 * sizeof(uint32_t);
+#endif
+        TRAP_IF((size_t)(value_stack_end - value_stack_top) < max_stack_height,
+                VALUE_STACK_EXHAUSTED);
+        memset(value_stack_top, 0, local_count * sizeof(WasmInterpreterValue));
+        value_stack_top += local_count;
+        NEXT();
+      }
+
+      TARGET(JIT_ENTRY) {
+        CHARGE_FUEL(pc - 1, read_u32_at(pc + 3 * sizeof(uint32_t)));
+#if WASM_INTERPRETER_JIT
+        uint32_t func_index = read_u32_at(pc + 2 * sizeof(uint32_t));
+        RUN_JIT_CODE(wasm_run_jit_func, &env->funcs.data[func_index]);
+#else
+        assert(0);
+#endif
+        NEXT();
       }
 
-      case WASM_OPCODE_BR_UNLESS: {
+      TARGET(CHARGE_FUEL)
+        CHARGE_FUEL(pc - 1, read_u32(&pc));
+        NEXT();
+
+      TARGET(BR_UNLESS) {
         uint32_t new_pc = read_u32(&pc);
         if (!POP_I32())
           GOTO(new_pc);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_DROP:
+#define V(NAME, sign, op, text)          \
+  TARGET(BR_UNLESS_##NAME)               \
+    BR_UNLESS_COMPARE(I32, sign, op);    \
+    NEXT();
+      WASM_FOREACH_BR_UNLESS_COMPARE(V)
+#undef V
+
+      TARGET(I32_ADD_LOCAL_LOCAL) {
+        VALUE_TYPE_I32 lhs = PICK(read_u32(&pc)).i32;
+        VALUE_TYPE_I32 rhs = PICK(read_u32(&pc)).i32;
+        PUSH_I32(lhs + rhs);
+        NEXT();
+      }
+
+      TARGET(I32_ADD_CONST)
+        TOP().i32 += read_u32(&pc);
+        NEXT();
+
+      TARGET(I32_LOAD_LOCAL)
+        LOAD_FROM(I32, U32, PICK(read_u32(&pc)).i32);
+        NEXT();
+
+      TARGET(I32_LOAD_CONST)
+        LOAD_FROM(I32, U32, 0);
+        NEXT();
+
+#define V(NAME, kind, sign, op, text)    \
+  TARGET(REG_##NAME)                     \
+    REGISTER_BINOP(kind, sign, op);      \
+    NEXT();
+      WASM_FOREACH_REGISTER_BINOP(V)
+#undef V
+
+      TARGET(DROP)
         (void)POP();
-        break;
+        NEXT();
 
-      case WASM_OPCODE_DROP_KEEP: {
+      TARGET(DROP_KEEP) {
         uint32_t drop_count = read_u32(&pc);
         uint8_t keep_count = *pc++;
         DROP_KEEP(drop_count, keep_count);
-        break;
+        NEXT();
       }
 
-      case WASM_OPCODE_DATA:
+      TARGET(DATA)
         /* shouldn't ever execute this */
         assert(0);
-        break;
+        NEXT();
 
-      case WASM_OPCODE_NOP:
-        break;
+      TARGET(TRANSLATE) {
+        uint32_t func_index = read_u32(&pc);
+        uint32_t module_index = read_u32(&pc);
+        if (WASM_FAILED(wasm_translate_lazy_interpreter_func(env, module_index,
+                                                             func_index)))
+          TRAP(INVALID_FUNCTION_BODY);
+        /* the body was appended to the istream, which may have moved */
+        istream = env->istream.start;
+        GOTO(env->funcs.data[func_index].defined.offset);
+        NEXT();
+      }
 
+      TARGET(NOP)
+        NEXT();
+
+      /* structured control flow is lowered to branches by the translator */
+      TARGET(BLOCK)
+      TARGET(LOOP)
+      TARGET(IF)
+      TARGET(ELSE)
+      TARGET(END)
       default:
         assert(0);
-        break;
+        NEXT();
     }
-  }
+  } while (!single_step);
 
 exit_loop:
+  SAVE_VALUE_STACK_TOP();
   thread->pc = pc - istream;
   return result;
 }
 
+static WasmInterpreterResult run_interpreter_with_trap_handler(
+    WasmInterpreterThread* thread,
+    WasmBool single_step,
+    uint32_t* call_stack_return_top) {
+#if WASM_INTERPRETER_GUARD_PAGES
+  /* an out of bounds access faults, and handle_sigsegv jumps back here. Like
+   * the other traps, this leaves the thread's pc where it was on entry. The
+   * value stack top that run_interpreter keeps in a local is lost, so it is
+   * put back where it was on entry too; the call stack top is always kept in
+   * the thread. */
+  sigjmp_buf jmp_buf;
+  sigjmp_buf* prev_jmp_buf = s_trap_jmp_buf;
+  WasmInterpreterInstance* prev_instance = s_trap_instance;
+  WasmInterpreterValue* value_stack_top = thread->value_stack_top;
+  if (sigsetjmp(jmp_buf, 0)) {
+    s_trap_jmp_buf = prev_jmp_buf;
+    s_trap_instance = prev_instance;
+    thread->value_stack_top = value_stack_top;
+    return WASM_INTERPRETER_TRAP_MEMORY_ACCESS_OUT_OF_BOUNDS;
+  }
+  s_trap_jmp_buf = &jmp_buf;
+  s_trap_instance = thread->instance;
+  WasmInterpreterResult result =
+      single_step ? run_interpreter(thread, WASM_TRUE, call_stack_return_top)
+                  : run_interpreter(thread, WASM_FALSE, call_stack_return_top);
+  s_trap_jmp_buf = prev_jmp_buf;
+  s_trap_instance = prev_instance;
+  return result;
+#else
+  return single_step
+             ? run_interpreter(thread, WASM_TRUE, call_stack_return_top)
+             : run_interpreter(thread, WASM_FALSE, call_stack_return_top);
+#endif
+}
+
+WasmInterpreterResult wasm_run_interpreter(WasmInterpreterThread* thread,
+                                           uint32_t* call_stack_return_top) {
+  return run_interpreter_with_trap_handler(thread, WASM_FALSE,
+                                           call_stack_return_top);
+}
+
+WasmInterpreterResult wasm_step_interpreter(WasmInterpreterThread* thread,
+                                            uint32_t* call_stack_return_top) {
+  return run_interpreter_with_trap_handler(thread, WASM_TRUE,
+                                           call_stack_return_top);
+}
+
 void wasm_trace_pc(WasmInterpreterThread* thread, WasmStream* stream) {
   const uint8_t* istream = thread->env->istream.start;
   const uint8_t* pc = &istream[thread->pc];
-  size_t value_stack_depth = thread->value_stack_top - thread->value_stack.data;
+  const WasmInterpreterValue* value_stack_top = thread->value_stack_top;
+  size_t value_stack_depth = value_stack_top - thread->value_stack.data;
   size_t call_stack_depth = thread->call_stack_top - thread->call_stack.data;
 
   wasm_writef(stream, "#%" PRIzd ". %4" PRIzd ": V:%-3" PRIzd "| ",
@@ -1789,6 +3207,8 @@ void wasm_trace_pc(WasmInterpreterThread* thread, WasmStream* stream) {
       break;
 
     case WASM_OPCODE_CALL_INDIRECT:
+    case WASM_OPCODE_CALL_INDIRECT_QUICKEN:
+    case WASM_OPCODE_CALL_INDIRECT_CACHED:
       wasm_writef(stream, "%s $%u, %u\n",
                   wasm_get_interpreter_opcode_name(opcode), read_u32_at(pc),
                   TOP().i32);
@@ -1859,6 +3279,40 @@ void wasm_trace_pc(WasmInterpreterThread* thread, WasmStream* stream) {
       break;
     }
 
+#define V(NAME, type, mem_type, text) case WASM_OPCODE_##NAME##_MEM0:
+    WASM_FOREACH_MEMORY0_LOAD(V)
+#undef V
+      wasm_writef(stream, "%s %u+$%u\n",
+                  wasm_get_interpreter_opcode_name(opcode), TOP().i32,
+                  read_u32_at(pc));
+      break;
+
+    case WASM_OPCODE_I32_STORE8_MEM0:
+    case WASM_OPCODE_I32_STORE16_MEM0:
+    case WASM_OPCODE_I32_STORE_MEM0:
+      wasm_writef(stream, "%s %u+$%u, %u\n",
+                  wasm_get_interpreter_opcode_name(opcode), PICK(2).i32,
+                  read_u32_at(pc), PICK(1).i32);
+      break;
+
+    case WASM_OPCODE_I64_STORE_MEM0:
+      wasm_writef(stream, "%s %u+$%u, %" PRIu64 "\n",
+                  wasm_get_interpreter_opcode_name(opcode), PICK(2).i32,
+                  read_u32_at(pc), PICK(1).i64);
+      break;
+
+    case WASM_OPCODE_F32_STORE_MEM0:
+      wasm_writef(stream, "%s %u+$%u, %g\n",
+                  wasm_get_interpreter_opcode_name(opcode), PICK(2).i32,
+                  read_u32_at(pc), bitcast_u32_to_f32(PICK(1).f32_bits));
+      break;
+
+    case WASM_OPCODE_F64_STORE_MEM0:
+      wasm_writef(stream, "%s %u+$%u, %g\n",
+                  wasm_get_interpreter_opcode_name(opcode), PICK(2).i32,
+                  read_u32_at(pc), bitcast_u64_to_f64(PICK(1).f64_bits));
+      break;
+
     case WASM_OPCODE_GROW_MEMORY: {
       uint32_t memory_index = read_u32(&pc);
       wasm_writef(stream, "%s $%u:%u\n",
@@ -2043,6 +3497,14 @@ void wasm_trace_pc(WasmInterpreterThread* thread, WasmStream* stream) {
       break;
 
     case WASM_OPCODE_ALLOCA:
+    case WASM_OPCODE_JIT_ENTRY:
+      wasm_writef(stream, "%s $%u, $%u, $%u, $%u\n",
+                  wasm_get_interpreter_opcode_name(opcode), read_u32_at(pc),
+                  read_u32_at(pc + 4), read_u32_at(pc + 8),
+                  read_u32_at(pc + 12));
+      break;
+
+    case WASM_OPCODE_CHARGE_FUEL:
       wasm_writef(stream, "%s $%u\n", wasm_get_interpreter_opcode_name(opcode),
                   read_u32_at(pc));
       break;
@@ -2053,6 +3515,48 @@ void wasm_trace_pc(WasmInterpreterThread* thread, WasmStream* stream) {
                   TOP().i32);
       break;
 
+#define V(NAME, sign, op, text) case WASM_OPCODE_BR_UNLESS_##NAME:
+    WASM_FOREACH_BR_UNLESS_COMPARE(V)
+#undef V
+      wasm_writef(stream, "%s @%u, %u, %u\n",
+                  wasm_get_interpreter_opcode_name(opcode), read_u32_at(pc),
+                  PICK(2).i32, PICK(1).i32);
+      break;
+
+    case WASM_OPCODE_I32_ADD_LOCAL_LOCAL:
+      wasm_writef(stream, "%s $%u, $%u\n",
+                  wasm_get_interpreter_opcode_name(opcode), read_u32_at(pc),
+                  read_u32_at(pc + 4));
+      break;
+
+    case WASM_OPCODE_I32_ADD_CONST:
+      wasm_writef(stream, "%s %u, $%u\n",
+                  wasm_get_interpreter_opcode_name(opcode), TOP().i32,
+                  read_u32_at(pc));
+      break;
+
+    case WASM_OPCODE_I32_LOAD_LOCAL: {
+      uint32_t memory_index = read_u32(&pc);
+      wasm_writef(stream, "%s $%u:%u+$%u\n",
+                  wasm_get_interpreter_opcode_name(opcode), memory_index,
+                  PICK(read_u32_at(pc)).i32, read_u32_at(pc + 4));
+      break;
+    }
+
+    case WASM_OPCODE_I32_LOAD_CONST:
+      wasm_writef(stream, "%s $%u:$%u\n",
+                  wasm_get_interpreter_opcode_name(opcode), read_u32_at(pc),
+                  read_u32_at(pc + 4));
+      break;
+
+#define V(NAME, kind, sign, op, text) case WASM_OPCODE_REG_##NAME:
+    WASM_FOREACH_REGISTER_BINOP(V)
+#undef V
+      wasm_writef(stream, "%s $%u, %u, %u\n",
+                  wasm_get_interpreter_opcode_name(opcode), read_u32_at(pc),
+                  PICK(read_u32_at(pc + 4)).i32, PICK(read_u32_at(pc + 8)).i32);
+      break;
+
     case WASM_OPCODE_DROP_KEEP:
       wasm_writef(stream, "%s $%u $%u\n",
                   wasm_get_interpreter_opcode_name(opcode), read_u32_at(pc),
@@ -2064,6 +3568,12 @@ void wasm_trace_pc(WasmInterpreterThread* thread, WasmStream* stream) {
       assert(0);
       break;
 
+    case WASM_OPCODE_TRANSLATE:
+      wasm_writef(stream, "%s $%u, $%u\n",
+                  wasm_get_interpreter_opcode_name(opcode), read_u32_at(pc),
+                  read_u32_at(pc + 4));
+      break;
+
     default:
       assert(0);
       break;
@@ -2174,6 +3684,25 @@ void wasm_disassemble(WasmInterpreterEnvironment* env,
         break;
       }
 
+      case WASM_OPCODE_CALL_INDIRECT_QUICKEN:
+      case WASM_OPCODE_CALL_INDIRECT_CACHED: {
+        uint32_t table_index = read_u32(&pc);
+        uint32_t sig_index = read_u32(&pc);
+        uint32_t entry_index = read_u32(&pc);
+        uint32_t func_index = read_u32(&pc);
+        pc += sizeof(uint64_t);
+        if (opcode == WASM_OPCODE_CALL_INDIRECT_CACHED) {
+          wasm_writef(stream, "%s $%u:%u, %%[-1], cache: $%u => $%u\n",
+                      wasm_get_interpreter_opcode_name(opcode), table_index,
+                      sig_index, entry_index, func_index);
+        } else {
+          wasm_writef(stream, "%s $%u:%u, %%[-1]\n",
+                      wasm_get_interpreter_opcode_name(opcode), table_index,
+                      sig_index);
+        }
+        break;
+      }
+
       case WASM_OPCODE_CALL_HOST:
         wasm_writef(stream, "%s $%u\n",
                     wasm_get_interpreter_opcode_name(opcode), read_u32(&pc));
@@ -2216,6 +3745,20 @@ void wasm_disassemble(WasmInterpreterEnvironment* env,
         break;
       }
 
+#define V(NAME, type, mem_type, text) case WASM_OPCODE_##NAME##_MEM0:
+      WASM_FOREACH_MEMORY0_LOAD(V)
+#undef V
+        wasm_writef(stream, "%s %%[-1]+$%u\n",
+                    wasm_get_interpreter_opcode_name(opcode), read_u32(&pc));
+        break;
+
+#define V(NAME, type, mem_type, text) case WASM_OPCODE_##NAME##_MEM0:
+      WASM_FOREACH_MEMORY0_STORE(V)
+#undef V
+        wasm_writef(stream, "%s %%[-2]+$%u, %%[-1]\n",
+                    wasm_get_interpreter_opcode_name(opcode), read_u32(&pc));
+        break;
+
       case WASM_OPCODE_I32_ADD:
       case WASM_OPCODE_I32_SUB:
       case WASM_OPCODE_I32_MUL:
@@ -2355,6 +3898,17 @@ void wasm_disassemble(WasmInterpreterEnvironment* env,
       }
 
       case WASM_OPCODE_ALLOCA:
+      case WASM_OPCODE_JIT_ENTRY: {
+        uint32_t local_count = read_u32(&pc);
+        uint32_t max_stack_height = read_u32(&pc);
+        uint32_t func_index = read_u32(&pc);
+        wasm_writef(stream, "%s $%u, $%u, $%u, $%u\n",
+                    wasm_get_interpreter_opcode_name(opcode), local_count,
+                    max_stack_height, func_index, read_u32(&pc));
+        break;
+      }
+
+      case WASM_OPCODE_CHARGE_FUEL:
         wasm_writef(stream, "%s $%u\n",
                     wasm_get_interpreter_opcode_name(opcode), read_u32(&pc));
         break;
@@ -2364,6 +3918,58 @@ void wasm_disassemble(WasmInterpreterEnvironment* env,
                     wasm_get_interpreter_opcode_name(opcode), read_u32(&pc));
         break;
 
+#define V(NAME, sign, op, text) case WASM_OPCODE_BR_UNLESS_##NAME:
+      WASM_FOREACH_BR_UNLESS_COMPARE(V)
+#undef V
+        wasm_writef(stream, "%s @%u, %%[-2], %%[-1]\n",
+                    wasm_get_interpreter_opcode_name(opcode), read_u32(&pc));
+        break;
+
+      case WASM_OPCODE_I32_ADD_LOCAL_LOCAL: {
+        uint32_t lhs_depth = read_u32(&pc);
+        uint32_t rhs_depth = read_u32(&pc);
+        wasm_writef(stream, "%s $%u, $%u\n",
+                    wasm_get_interpreter_opcode_name(opcode), lhs_depth,
+                    rhs_depth);
+        break;
+      }
+
+      case WASM_OPCODE_I32_ADD_CONST:
+        wasm_writef(stream, "%s %%[-1], $%u\n",
+                    wasm_get_interpreter_opcode_name(opcode), read_u32(&pc));
+        break;
+
+      case WASM_OPCODE_I32_LOAD_LOCAL: {
+        uint32_t memory_index = read_u32(&pc);
+        uint32_t depth = read_u32(&pc);
+        wasm_writef(stream, "%s $%u:$%u+$%u\n",
+                    wasm_get_interpreter_opcode_name(opcode), memory_index,
+                    depth, read_u32(&pc));
+        break;
+      }
+
+      case WASM_OPCODE_I32_LOAD_CONST: {
+        uint32_t memory_index = read_u32(&pc);
+        wasm_writef(stream, "%s $%u:$%u\n",
+                    wasm_get_interpreter_opcode_name(opcode), memory_index,
+                    read_u32(&pc));
+        break;
+      }
+
+#define V(NAME, kind, sign, op, text) case WASM_OPCODE_REG_##NAME:
+      WASM_FOREACH_REGISTER_BINOP(V)
+#undef V
+      {
+        uint32_t dst_depth = read_u32(&pc);
+        uint32_t lhs_depth = read_u32(&pc);
+        uint32_t rhs_depth = read_u32(&pc);
+        uint8_t drop = *pc++;
+        wasm_writef(stream, "%s $%u, $%u, $%u, %u\n",
+                    wasm_get_interpreter_opcode_name(opcode), dst_depth,
+                    lhs_depth, rhs_depth, drop);
+        break;
+      }
+
       case WASM_OPCODE_DROP_KEEP: {
         uint32_t drop = read_u32(&pc);
         uint32_t keep = *pc++;
@@ -2372,6 +3978,14 @@ void wasm_disassemble(WasmInterpreterEnvironment* env,
         break;
       }
 
+      case WASM_OPCODE_TRANSLATE: {
+        uint32_t func_index = read_u32(&pc);
+        wasm_writef(stream, "%s $%u, $%u\n",
+                    wasm_get_interpreter_opcode_name(opcode), func_index,
+                    read_u32(&pc));
+        break;
+      }
+
       case WASM_OPCODE_DATA: {
         uint32_t num_bytes = read_u32(&pc);
         wasm_writef(stream, "%s $%u\n",
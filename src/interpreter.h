@@ -31,6 +31,11 @@ struct WasmStream;
   V(OK, "ok")                                                                  \
   /* returned from the top-most function */                                    \
   V(RETURNED, "returned")                                                      \
+  /* the thread ran out of fuel; it can be given more and run again */         \
+  V(FUEL_EXHAUSTED, "fuel exhausted")                                          \
+  /* a host function suspended the thread; it continues after the call once */ \
+  /* the results are passed to wasm_resume_host_call */                        \
+  V(SUSPENDED, "suspended")                                                    \
   /* memory access is out of bounds */                                         \
   V(TRAP_MEMORY_ACCESS_OUT_OF_BOUNDS, "out of bounds memory access")           \
   /* converting from float -> int would overflow int */                        \
@@ -56,6 +61,9 @@ struct WasmStream;
   V(TRAP_HOST_RESULT_TYPE_MISMATCH, "host result type mismatch")               \
   /* we called an import function, but it didn't complete succesfully */       \
   V(TRAP_HOST_TRAPPED, "host function trapped")                                \
+  /* a function body that was translated lazily, on its first call, is */     \
+  /* invalid */                                                                \
+  V(TRAP_INVALID_FUNCTION_BODY, "invalid function body")                       \
   /* we attempted to call a function with the an argument list that doesn't    \
    * match the function signature */                                           \
   V(ARGUMENT_TYPE_MISMATCH, "argument type mismatch")                          \
@@ -77,17 +85,127 @@ typedef enum WasmInterpreterResult {
 #define WASM_TABLE_ENTRY_DROP_OFFSET sizeof(uint32_t)
 #define WASM_TABLE_ENTRY_KEEP_OFFSET (sizeof(uint32_t) * 2)
 
+/* i32 comparisons that are fused with the BR_UNLESS that consumes them. The
+ * fused opcode branches unless the comparison is true. */
+#define WASM_FOREACH_BR_UNLESS_COMPARE(V) \
+  V(I32_EQ, UNSIGNED, ==, "i32.eq")       \
+  V(I32_NE, UNSIGNED, !=, "i32.ne")       \
+  V(I32_LT_S, SIGNED, <, "i32.lt_s")      \
+  V(I32_LT_U, UNSIGNED, <, "i32.lt_u")    \
+  V(I32_GT_S, SIGNED, >, "i32.gt_s")      \
+  V(I32_GT_U, UNSIGNED, >, "i32.gt_u")    \
+  V(I32_LE_S, SIGNED, <=, "i32.le_s")     \
+  V(I32_LE_U, UNSIGNED, <=, "i32.le_u")   \
+  V(I32_GE_S, SIGNED, >=, "i32.ge_s")     \
+  V(I32_GE_U, UNSIGNED, >=, "i32.ge_u")
+
+/* i32 binary operators that have a register form, used by the register-based
+ * translation mode. The register form reads its operands from arbitrary value
+ * stack slots (usually locals) and can write its result directly to a slot
+ * instead of pushing it. */
+#define WASM_FOREACH_REGISTER_BINOP(V)         \
+  V(I32_ADD, BINOP, UNSIGNED, +, "i32.add")    \
+  V(I32_SUB, BINOP, UNSIGNED, -, "i32.sub")    \
+  V(I32_MUL, BINOP, UNSIGNED, *, "i32.mul")    \
+  V(I32_AND, BINOP, UNSIGNED, &, "i32.and")    \
+  V(I32_OR, BINOP, UNSIGNED, |, "i32.or")      \
+  V(I32_XOR, BINOP, UNSIGNED, ^, "i32.xor")    \
+  V(I32_SHL, SHIFT, UNSIGNED, <<, "i32.shl")   \
+  V(I32_SHR_S, SHIFT, SIGNED, >>, "i32.shr_s") \
+  V(I32_SHR_U, SHIFT, UNSIGNED, >>, "i32.shr_u") \
+  V(I32_EQ, BINOP, UNSIGNED, ==, "i32.eq")     \
+  V(I32_NE, BINOP, UNSIGNED, !=, "i32.ne")     \
+  V(I32_LT_S, BINOP, SIGNED, <, "i32.lt_s")    \
+  V(I32_LT_U, BINOP, UNSIGNED, <, "i32.lt_u")  \
+  V(I32_GT_S, BINOP, SIGNED, >, "i32.gt_s")    \
+  V(I32_GT_U, BINOP, UNSIGNED, >, "i32.gt_u")  \
+  V(I32_LE_S, BINOP, SIGNED, <=, "i32.le_s")   \
+  V(I32_LE_U, BINOP, UNSIGNED, <=, "i32.le_u") \
+  V(I32_GE_S, BINOP, SIGNED, >=, "i32.ge_s")   \
+  V(I32_GE_U, BINOP, UNSIGNED, >=, "i32.ge_u")
+
+/* loads and stores that have a form for memory 0 of the environment, whose
+ * only operand is the static offset. The interpreter keeps that memory's data
+ * and size in locals for them. The narrow i64 forms are left out, since the
+ * opcodes have to fit in a byte. */
+#define WASM_FOREACH_MEMORY0_LOAD(V)        \
+  V(I32_LOAD8_S, I32, I8, "i32.load8_s")    \
+  V(I32_LOAD8_U, I32, U8, "i32.load8_u")    \
+  V(I32_LOAD16_S, I32, I16, "i32.load16_s") \
+  V(I32_LOAD16_U, I32, U16, "i32.load16_u") \
+  V(I32_LOAD, I32, U32, "i32.load")         \
+  V(I64_LOAD, I64, U64, "i64.load")         \
+  V(F32_LOAD, F32, F32, "f32.load")         \
+  V(F64_LOAD, F64, F64, "f64.load")
+
+#define WASM_FOREACH_MEMORY0_STORE(V)     \
+  V(I32_STORE8, I32, U8, "i32.store8")    \
+  V(I32_STORE16, I32, U16, "i32.store16") \
+  V(I32_STORE, I32, U32, "i32.store")     \
+  V(I64_STORE, I64, U64, "i64.store")     \
+  V(F32_STORE, F32, F32, "f32.store")     \
+  V(F64_STORE, F64, F64, "f64.store")
+
 enum {
-  /* push space on the value stack for N entries */
+  /* function entry: charge the fourth operand's amount of fuel, check that the
+   * value stack has room for the second operand's number of entries, then
+   * push the first operand's number of zeroed entries for the locals. The
+   * third operand is the function's index in the environment. */
   WASM_OPCODE_ALLOCA = WASM_NUM_OPCODES,
+  /* replaces the ALLOCA of a function that has been compiled to native code,
+   * and has the same operands */
+  WASM_OPCODE_JIT_ENTRY,
+  /* loop entry: charge the operand's amount of fuel, the cost of one pass
+   * through the loop body */
+  WASM_OPCODE_CHARGE_FUEL,
   WASM_OPCODE_BR_UNLESS,
+  /* superinstructions, emitted by the translator in place of common
+   * sequences */
+#define V(NAME, sign, op, text) WASM_OPCODE_BR_UNLESS_##NAME,
+  WASM_FOREACH_BR_UNLESS_COMPARE(V)
+#undef V
+  /* get_local, get_local, i32.add */
+  WASM_OPCODE_I32_ADD_LOCAL_LOCAL,
+  /* i32.const, i32.add */
+  WASM_OPCODE_I32_ADD_CONST,
+  /* get_local, i32.load */
+  WASM_OPCODE_I32_LOAD_LOCAL,
+  /* i32.const, i32.load; the static offset is the whole address */
+  WASM_OPCODE_I32_LOAD_CONST,
+  /* register forms of the binary operators; operands are the destination
+   * depth (0 to push the result), the two source depths, and the number of
+   * values to pop after reading the sources */
+#define V(NAME, kind, sign, op, text) WASM_OPCODE_REG_##NAME,
+  WASM_FOREACH_REGISTER_BINOP(V)
+#undef V
+#define V(NAME, type, mem_type, text) WASM_OPCODE_##NAME##_MEM0,
+  WASM_FOREACH_MEMORY0_LOAD(V)
+  WASM_FOREACH_MEMORY0_STORE(V)
+#undef V
   WASM_OPCODE_CALL_HOST,
   WASM_OPCODE_DATA,
   WASM_OPCODE_DROP_KEEP,
+  /* the stub of a function that hasn't been translated yet; operands are the
+   * function's index and its module's index. It translates the body and jumps
+   * to it, and is then patched into a BR to the body. */
+  WASM_OPCODE_TRANSLATE,
+  /* call_indirect with an inline cache, emitted when quickening. The operands
+   * are those of CALL_INDIRECT, then the table entry, the function's index in
+   * the environment and the table's epoch that the cache was filled with. It
+   * runs like CALL_INDIRECT, then fills in the cache and is patched into a
+   * CALL_INDIRECT_CACHED. */
+  WASM_OPCODE_CALL_INDIRECT_QUICKEN,
+  /* calls the cached function without looking it up, if the entry and the
+   * table's epoch match the cache; otherwise it refills the cache */
+  WASM_OPCODE_CALL_INDIRECT_CACHED,
   WASM_NUM_INTERPRETER_OPCODES,
 };
 WASM_STATIC_ASSERT(WASM_NUM_INTERPRETER_OPCODES <= 256);
 
+/* changed whenever the istream that the translator emits for a module
+ * changes, so that code cached by another version isn't reused */
+#define WASM_INTERPRETER_ISTREAM_VERSION 6
+
 typedef uint32_t WasmUint32;
 WASM_DEFINE_ARRAY(uint32, WasmUint32);
 
@@ -101,14 +219,30 @@ WASM_DEFINE_VECTOR(interpreter_func_signature, WasmInterpreterFuncSignature);
 typedef struct WasmInterpreterTable {
   WasmLimits limits;
   WasmUint32Array func_indexes;
+  /* changed by wasm_new_interpreter_table_epoch whenever |func_indexes|
+   * changes, to a value no other table has had unless it has the same
+   * contents, so that call_indirect caches can tell that they are stale */
+  uint64_t epoch;
 } WasmInterpreterTable;
 WASM_DEFINE_VECTOR(interpreter_table, WasmInterpreterTable);
 
+/* With WASM_INTERPRETER_GUARD_PAGES, memory data is always reserved with this
+ * size by wasm_alloc_interpreter_memory, so any
+ * address + offset that the interpreter computes lands inside of it. The pages
+ * past byte_size are inaccessible, and an access to them traps. */
+#define WASM_GUARD_PAGES_RESERVATION_SIZE \
+  ((uint64_t)2 * (WASM_MAX_PAGES * (uint64_t)WASM_PAGE_SIZE) + WASM_PAGE_SIZE)
+
 typedef struct WasmInterpreterMemory {
   WasmAllocator* allocator;
   void* data;
   WasmLimits page_limits;
   uint32_t byte_size; /* Cached from page_limits. */
+  /* size of the address space reserved at |data|, or 0 if |data| was
+   * allocated with |allocator| */
+  uint64_t reserved_byte_size;
+  /* ask for the reservation to be backed by transparent huge pages */
+  WasmBool use_huge_pages;
 } WasmInterpreterMemory;
 WASM_DEFINE_VECTOR(interpreter_memory, WasmInterpreterMemory);
 
@@ -163,21 +297,90 @@ typedef WasmResult (*WasmInterpreterHostFuncCallback)(
     WasmInterpreterTypedValue* out_results,
     void* user_data);
 
+/* The C signatures that a host function can be registered with, using
+ * wasm_set_host_func_<name>, to be called without marshalling. Its arguments
+ * are read straight from the value stack, and it is called as
+ *
+ *   WasmResult callback(void* user_data, <params>..., <result>* out_result)
+ *
+ * with uint32_t for i32 and uint64_t for i64, and no |out_result| if there is
+ * no result. The names follow emscripten: the result, then the params, with v
+ * for no result, i for i32 and j for i64.
+ *
+ * V(name, result, param0, param1, param2), with NONE for the missing ones */
+#define WASM_FOREACH_HOST_FUNC_SIGNATURE(V) \
+  V(v, NONE, NONE, NONE, NONE)              \
+  V(vi, NONE, I32, NONE, NONE)              \
+  V(vii, NONE, I32, I32, NONE)              \
+  V(viii, NONE, I32, I32, I32)              \
+  V(i, I32, NONE, NONE, NONE)               \
+  V(ii, I32, I32, NONE, NONE)               \
+  V(iii, I32, I32, I32, NONE)               \
+  V(iiii, I32, I32, I32, I32)               \
+  V(j, I64, NONE, NONE, NONE)               \
+  V(jj, I64, I64, NONE, NONE)               \
+  V(jjj, I64, I64, I64, NONE)
+
+#define WASM_HOST_FUNC_PARAM_NONE
+#define WASM_HOST_FUNC_PARAM_I32 , uint32_t
+#define WASM_HOST_FUNC_PARAM_I64 , uint64_t
+#define WASM_HOST_FUNC_RESULT_NONE
+#define WASM_HOST_FUNC_RESULT_I32 , uint32_t*
+#define WASM_HOST_FUNC_RESULT_I64 , uint64_t*
+
+#define V(name, result, param0, param1, param2)                          \
+  typedef WasmResult (*WasmInterpreterHostFunc_##name)(                  \
+      void* user_data WASM_HOST_FUNC_PARAM_##param0                      \
+          WASM_HOST_FUNC_PARAM_##param1 WASM_HOST_FUNC_PARAM_##param2    \
+              WASM_HOST_FUNC_RESULT_##result);
+WASM_FOREACH_HOST_FUNC_SIGNATURE(V)
+#undef V
+
+struct WasmInterpreterThread;
+
+/* calls a host function registered with one of the signatures above */
+typedef WasmInterpreterResult (*WasmInterpreterHostFuncTrampoline)(
+    struct WasmInterpreterThread* thread,
+    const struct WasmInterpreterFunc* func);
+
+struct WasmInterpreterJitCode;
+
 typedef struct WasmInterpreterFunc {
   uint32_t sig_index;
   WasmBool is_host;
   union {
     struct {
       uint32_t offset;
+      uint32_t end_offset; /* just past the function's last instruction */
       uint32_t local_decl_count;
       uint32_t local_count;
+      /* the most values the body has on the value stack at once, including
+       * its locals but not its params */
+      uint32_t max_stack_height;
       WasmTypeVector param_and_local_types;
+      /* how many times the function has been entered, and the native code it
+       * is compiled to once that reaches the threshold; only used with
+       * WASM_INTERPRETER_JIT */
+      uint32_t call_count;
+      struct WasmInterpreterJitCode* jit_code;
+      /* the TRANSLATE stub of a function that is translated lazily, or
+       * WASM_INVALID_OFFSET */
+      uint32_t stub_offset;
     } defined;
     struct {
       WasmStringSlice module_name;
       WasmStringSlice field_name;
       WasmInterpreterHostFuncCallback callback;
       void* user_data;
+      /* set instead of |callback| by wasm_set_host_func_<name>, which also
+       * sets the member of |direct| with that name */
+      WasmInterpreterHostFuncTrampoline trampoline;
+      union {
+#define V(name, result, param0, param1, param2) \
+  WasmInterpreterHostFunc_##name name;
+        WASM_FOREACH_HOST_FUNC_SIGNATURE(V)
+#undef V
+      } direct;
     } host;
   };
 } WasmInterpreterFunc;
@@ -216,6 +419,8 @@ typedef struct WasmInterpreterHostImportDelegate {
                               void* user_data);
 } WasmInterpreterHostImportDelegate;
 
+struct WasmInterpreterLazyModule;
+
 typedef struct WasmInterpreterModule {
   WasmStringSlice name;
   WasmInterpreterExportVector exports;
@@ -229,6 +434,9 @@ typedef struct WasmInterpreterModule {
       uint32_t start_func_index; /* INVALID_INDEX if not defined */
       size_t istream_start;
       size_t istream_end;
+      /* what is needed to translate the function bodies, if they are
+       * translated lazily; NULL otherwise */
+      struct WasmInterpreterLazyModule* lazy;
     } defined;
     struct {
       WasmInterpreterHostImportDelegate import_delegate;
@@ -237,6 +445,62 @@ typedef struct WasmInterpreterModule {
 } WasmInterpreterModule;
 WASM_DEFINE_VECTOR(interpreter_module, WasmInterpreterModule);
 
+/* A call stack entry with this bit set is not an istream offset, but the index
+ * of a WasmInterpreterJitResumePoint: a direct call made from native code
+ * returns to the native code of the caller. */
+#define WASM_JIT_RESUME_POINT_BIT 0x80000000U
+
+typedef struct WasmInterpreterJitResumePoint {
+  uint32_t func_index;
+  uint32_t code_offset;
+} WasmInterpreterJitResumePoint;
+WASM_DEFINE_VECTOR(interpreter_jit_resume_point,
+                   WasmInterpreterJitResumePoint);
+
+/* The state that an instance of the code in an environment changes as it runs:
+ * its memories, tables and globals, indexed like the environment's. The
+ * environment's own instance is the one that modules are loaded into.
+ * wasm_init_interpreter_instance makes new ones, so that threads can run the
+ * same code against separate state at the same time. */
+typedef struct WasmInterpreterInstance {
+  WasmInterpreterMemoryVector memories;
+  WasmInterpreterTableVector tables;
+  WasmInterpreterGlobalVector globals;
+} WasmInterpreterInstance;
+
+WASM_DEFINE_VECTOR(limits, WasmLimits);
+
+/* The bytes of a data segment, copied to |address| in the memory at
+ * |memory_index| when an instance is initialized. */
+typedef struct WasmInterpreterDataSegment {
+  uint32_t memory_index;
+  uint32_t address;
+  uint32_t size;
+  void* data;
+} WasmInterpreterDataSegment;
+WASM_DEFINE_VECTOR(interpreter_data_segment, WasmInterpreterDataSegment);
+
+/* One function index of an elem segment, stored at |offset| in the table at
+ * |table_index| when an instance is initialized. */
+typedef struct WasmInterpreterElem {
+  uint32_t table_index;
+  uint32_t offset;
+  uint32_t func_index;
+} WasmInterpreterElem;
+WASM_DEFINE_VECTOR(interpreter_elem, WasmInterpreterElem);
+
+/* What wasm_init_interpreter_instance builds a new instance from, recorded as
+ * each module is read: the initial limits of the memories and tables, the
+ * initial values of the globals, and the segments that fill them in, in the
+ * order they were read. */
+typedef struct WasmInterpreterInstanceTemplate {
+  WasmLimitsVector memory_limits;
+  WasmLimitsVector table_limits;
+  WasmInterpreterGlobalVector globals;
+  WasmInterpreterDataSegmentVector data_segments;
+  WasmInterpreterElemVector elems;
+} WasmInterpreterInstanceTemplate;
+
 /* Used to track and reset the state of the environment. */
 typedef struct WasmInterpreterEnvironmentMark {
   size_t modules_size;
@@ -245,24 +509,73 @@ typedef struct WasmInterpreterEnvironmentMark {
   size_t memories_size;
   size_t tables_size;
   size_t globals_size;
+  size_t data_segments_size;
+  size_t elems_size;
   size_t istream_size;
 } WasmInterpreterEnvironmentMark;
 
+struct WasmInterpreterEnvironment;
+
+/* The state of an instance at some point, usually after its start function
+ * has run, that new instances can start from instead of the instance
+ * template. Where memfd_create is available, the memory contents are kept in
+ * an anonymous file that each new instance maps copy-on-write, so starting
+ * one copies no memory until it is written to; otherwise they are kept in
+ * |memory_data| and copied. */
+typedef struct WasmInterpreterSnapshot {
+  /* the environment that the snapshot was taken in, and its generation at
+   * the time; it can only be used while the environment has the same
+   * modules */
+  const struct WasmInterpreterEnvironment* env;
+  uint64_t generation;
+  /* the page limits of each memory, whose contents follow those of the
+   * memory before it in the file or |memory_data| */
+  WasmLimitsVector memory_limits;
+  WasmInterpreterTableVector tables;
+  WasmInterpreterGlobalVector globals;
+  int memory_fd; /* -1 if the contents are in |memory_data| */
+  void* memory_data;
+} WasmInterpreterSnapshot;
+
+/* The translated code of the loaded modules and what describes it. Running
+ * code doesn't change any of this, except that with WASM_INTERPRETER_JIT a
+ * hot function is compiled and patched in, a lazily translated function is
+ * translated on its first call, and a quickened call_indirect fills in its
+ * cache, so only threads without any of these may share an environment
+ * concurrently. */
 typedef struct WasmInterpreterEnvironment {
   WasmInterpreterModuleVector modules;
+  /* signatures are interned, so two signatures are equal iff their indexes
+   * are */
   WasmInterpreterFuncSignatureVector sigs;
   WasmInterpreterFuncVector funcs;
-  WasmInterpreterMemoryVector memories;
-  WasmInterpreterTableVector tables;
-  WasmInterpreterGlobalVector globals;
   WasmOutputBuffer istream;
   WasmBindingHash module_bindings;
   WasmBindingHash registered_module_bindings;
+  /* maps an encoded signature (see wasm_intern_interpreter_func_signature) to
+   * its index in |sigs| */
+  WasmBindingHash sig_bindings;
+  /* indexed by call stack entries that have WASM_JIT_RESUME_POINT_BIT set.
+   * Points are never removed, since compiled code refers to them by index;
+   * those of functions destroyed by a reset are just never used again. */
+  WasmInterpreterJitResumePointVector jit_resume_points;
+  /* the last epoch given to a table */
+  uint64_t last_table_epoch;
+  /* changed whenever a module is loaded or the environment is reset to a
+   * mark, so that a snapshot can tell it was taken of the same modules */
+  uint64_t generation;
+  /* the memories, tables and globals that modules are loaded into, and that
+   * threads use unless they are given another instance */
+  WasmInterpreterInstance instance;
+  WasmInterpreterInstanceTemplate instance_template;
 } WasmInterpreterEnvironment;
 
 typedef struct WasmInterpreterThread {
   WasmAllocator* allocator;
   WasmInterpreterEnvironment* env;
+  /* the state that the thread's code runs against; the environment's own
+   * instance by default */
+  WasmInterpreterInstance* instance;
   WasmInterpreterValueArray value_stack;
   WasmUint32Array call_stack;
   WasmInterpreterValue* value_stack_top;
@@ -270,20 +583,46 @@ typedef struct WasmInterpreterThread {
   uint32_t* call_stack_top;
   uint32_t* call_stack_end;
   uint32_t pc;
+  /* the budget left for running instructions. Each function entry and loop
+   * iteration charges the cost of its code, which the translator computes,
+   * so the same code with the same fuel always stops at the same place. A
+   * charge is only refused once the fuel is no longer positive, so it can go
+   * below zero by the cost of one function or loop body. */
+  int64_t fuel;
+  /* the signature of the host function that suspended the thread, whose
+   * results it is waiting for, or WASM_INVALID_INDEX */
+  uint32_t suspended_sig_index;
 
   /* a temporary buffer that is for passing args to host functions */
   WasmInterpreterTypedValueVector host_args;
 } WasmInterpreterThread;
 
-#define WASM_INTERPRETER_THREAD_OPTIONS_DEFAULT \
-  { 512 * 1024 / sizeof(WasmInterpreterValue), 64 * 1024, WASM_INVALID_OFFSET }
+#define WASM_INTERPRETER_UNLIMITED_FUEL INT64_MAX
+
+#define WASM_INTERPRETER_THREAD_OPTIONS_DEFAULT              \
+  {                                                          \
+    512 * 1024 / sizeof(WasmInterpreterValue), 64 * 1024,    \
+        WASM_INVALID_OFFSET, WASM_INTERPRETER_UNLIMITED_FUEL \
+  }
 
 typedef struct WasmInterpreterThreadOptions {
   uint32_t value_stack_size;
   uint32_t call_stack_size;
   uint32_t pc;
+  int64_t fuel;
 } WasmInterpreterThreadOptions;
 
+/* An exported function, looked up and checked once so that it can be called
+ * many times with wasm_call_interpreter_export without looking up its name or
+ * checking the types of its arguments. */
+typedef struct WasmInterpreterExportHandle {
+  uint32_t func_index;
+  uint32_t param_count;
+  uint32_t result_count;
+  /* if not 0, the thread's fuel is set to this before each call */
+  int64_t fuel_per_call;
+} WasmInterpreterExportHandle;
+
 WASM_EXTERN_C_BEGIN
 WasmBool is_nan_f32(uint32_t f32_bits);
 WasmBool is_nan_f64(uint64_t f64_bits);
@@ -304,6 +643,43 @@ void wasm_reset_interpreter_environment_to_mark(
 WasmInterpreterModule* wasm_append_host_module(WasmAllocator* allocator,
                                                WasmInterpreterEnvironment* env,
                                                WasmStringSlice name);
+uint32_t wasm_intern_interpreter_func_signature(
+    WasmAllocator* allocator,
+    WasmInterpreterEnvironment* env,
+    uint32_t param_count,
+    const WasmType* param_types,
+    uint32_t result_count,
+    const WasmType* result_types);
+WasmResult wasm_init_interpreter_instance(WasmAllocator* allocator,
+                                          WasmInterpreterEnvironment* env,
+                                          WasmInterpreterInstance* instance);
+void wasm_destroy_interpreter_instance(WasmAllocator* allocator,
+                                       WasmInterpreterInstance* instance);
+WasmResult wasm_snapshot_interpreter_instance(
+    WasmAllocator* allocator,
+    WasmInterpreterEnvironment* env,
+    const WasmInterpreterInstance* instance,
+    WasmInterpreterSnapshot* out_snapshot);
+WasmResult wasm_init_interpreter_instance_from_snapshot(
+    WasmAllocator* allocator,
+    WasmInterpreterEnvironment* env,
+    const WasmInterpreterSnapshot* snapshot,
+    WasmInterpreterInstance* instance);
+void wasm_destroy_interpreter_snapshot(WasmAllocator* allocator,
+                                       WasmInterpreterSnapshot* snapshot);
+void wasm_new_interpreter_table_epoch(WasmInterpreterEnvironment* env,
+                                      WasmInterpreterTable* table);
+/* registers |callback| as the host function |func|, which must have the
+ * signature |sig|; fails if |sig| doesn't match |name| */
+#define V(name, result, param0, param1, param2)                        \
+  WasmResult wasm_set_host_func_##name(                                \
+      WasmInterpreterFunc* func, const WasmInterpreterFuncSignature* sig, \
+      WasmInterpreterHostFunc_##name callback, void* user_data);
+WASM_FOREACH_HOST_FUNC_SIGNATURE(V)
+#undef V
+WasmResult wasm_alloc_interpreter_memory(WasmInterpreterMemory* memory);
+WasmResult wasm_grow_interpreter_memory(WasmInterpreterMemory* memory,
+                                        uint32_t new_page_size);
 void wasm_init_interpreter_thread(WasmAllocator* allocator,
                                   WasmInterpreterEnvironment* env,
                                   WasmInterpreterThread* thread,
@@ -314,9 +690,28 @@ void wasm_destroy_interpreter_thread(WasmAllocator* allocator,
                                      WasmInterpreterThread* thread);
 WasmInterpreterResult wasm_call_host(WasmInterpreterThread* thread,
                                      WasmInterpreterFunc* func);
+/* called by a host function, instead of producing results, to suspend the
+ * thread that called it, which is returned. The host function then returns
+ * WASM_OK, and whatever ran the thread gets WASM_INTERPRETER_SUSPENDED, with
+ * the thread's pc just after the call. Once the results are ready, possibly
+ * on another OS thread, they are passed to wasm_resume_host_call and the
+ * thread can be run again. A host function called from
+ * wasm_call_interpreter_export can't be resumed; see there. */
+WasmInterpreterThread* wasm_suspend_host_call(void);
+WasmInterpreterResult wasm_resume_host_call(
+    WasmInterpreterThread* thread,
+    const WasmInterpreterTypedValue* results,
+    uint32_t num_results);
+/* runs until the function that |call_stack_return_top| belongs to returns,
+ * a trap, or the thread's fuel runs out. wasm_step_interpreter runs a single
+ * instruction instead. */
 WasmInterpreterResult wasm_run_interpreter(WasmInterpreterThread* thread,
-                                           uint32_t num_instructions,
                                            uint32_t* call_stack_return_top);
+WasmInterpreterResult wasm_step_interpreter(WasmInterpreterThread* thread,
+                                            uint32_t* call_stack_return_top);
+/* returns the size of the instruction at |pc| in the istream, including its
+ * operands */
+uint32_t wasm_get_interpreter_instruction_size(const uint8_t* pc);
 void wasm_trace_pc(WasmInterpreterThread* thread, struct WasmStream* stream);
 void wasm_disassemble(WasmInterpreterEnvironment* env,
                       struct WasmStream* stream,
@@ -329,6 +724,27 @@ void wasm_disassemble_module(WasmInterpreterEnvironment* env,
 WasmInterpreterExport* wasm_get_interpreter_export_by_name(
     WasmInterpreterModule* module,
     const WasmStringSlice* name);
+WasmInterpreterResult wasm_get_interpreter_export_handle(
+    WasmInterpreterEnvironment* env,
+    WasmInterpreterModule* module,
+    const WasmStringSlice* name,
+    WasmInterpreterExportHandle* out_handle);
+/* calls the export |call_count| times. |args| holds |param_count| values for
+ * each call, one call after another, and the |result_count| results of each
+ * call are written to |results| the same way. The values must have the types
+ * of the export's signature; they aren't checked. The calls share the
+ * thread's fuel, unless the handle has a |fuel_per_call|. This stops at the first call that fails, after setting
+ * |*out_calls_done| to the number of calls that succeeded, and leaves the
+ * thread's stacks as it found them either way. A host call can't suspend the
+ * thread here: the call is abandoned, and WASM_INTERPRETER_SUSPENDED is
+ * returned with the thread no longer suspended. */
+WasmInterpreterResult wasm_call_interpreter_export(
+    WasmInterpreterThread* thread,
+    const WasmInterpreterExportHandle* handle,
+    const WasmInterpreterValue* args,
+    WasmInterpreterValue* results,
+    uint32_t call_count,
+    uint32_t* out_calls_done);
 WASM_EXTERN_C_END
 
 #endif /* WASM_INTERPRETER_H_ */
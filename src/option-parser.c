@@ -97,8 +97,9 @@ void wasm_parse_options(WasmOptionParser* parser,
         WasmOption* best_option = &parser->options[best_index];
         const char* option_argument = NULL;
         if (best_option->has_argument) {
-          if (arg[best_length] == '=') {
-            option_argument = &arg[best_length + 1];
+          const char* equals = strchr(arg, '=');
+          if (equals) {
+            option_argument = equals + 1;
           } else {
             if (i + 1 == argc || argv[i + 1][0] == '-') {
               error(parser, "option \"--%s\" requires argument",
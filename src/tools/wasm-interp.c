@@ -15,6 +15,7 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,12 +24,14 @@
 #include "binary-reader.h"
 #include "binary-reader-interpreter.h"
 #include "interpreter.h"
+#if WASM_INTERPRETER_SCHEDULER
+#include "interpreter-scheduler.h"
+#endif
 #include "literal.h"
 #include "option-parser.h"
 #include "stack-allocator.h"
 #include "stream.h"
 
-#define INSTRUCTION_QUANTUM 1000
 #define PROGRAM_NAME "wasm-interp"
 
 #define V(name, str) str,
@@ -39,11 +42,18 @@ static WasmBool s_verbose;
 static const char* s_infile;
 static WasmReadBinaryOptions s_read_binary_options =
     WASM_READ_BINARY_OPTIONS_DEFAULT;
+static WasmReadBinaryInterpreterOptions s_read_binary_interpreter_options =
+    WASM_READ_BINARY_INTERPRETER_OPTIONS_DEFAULT;
 static WasmInterpreterThreadOptions s_thread_options =
     WASM_INTERPRETER_THREAD_OPTIONS_DEFAULT;
 static WasmBool s_trace;
 static WasmBool s_spec;
 static WasmBool s_run_all_exports;
+static WasmBool s_fresh_instances;
+static WasmBool s_snapshot;
+static uint32_t s_repeat;
+static uint32_t s_workers;
+static WasmBool s_suspend_host_calls;
 static WasmBool s_use_libc_allocator;
 static WasmStream* s_stdout_stream;
 
@@ -70,6 +80,19 @@ enum {
   FLAG_SPEC,
   FLAG_RUN_ALL_EXPORTS,
   FLAG_USE_LIBC_ALLOCATOR,
+  FLAG_REGISTERS,
+  FLAG_HUGE_PAGES,
+  FLAG_FUEL,
+  FLAG_FRESH_INSTANCES,
+  FLAG_SNAPSHOT,
+  FLAG_REPEAT,
+  FLAG_WORKERS,
+  FLAG_SUSPEND_HOST_CALLS,
+  FLAG_LAZY,
+  FLAG_TRANSLATE_THREADS,
+  FLAG_CACHE_DIR,
+  FLAG_OPTIMIZE,
+  FLAG_QUICKEN,
   NUM_FLAGS
 };
 
@@ -109,9 +132,60 @@ static WasmOption s_options[] = {
      "run all the exported functions, in order. useful for testing"},
     {FLAG_USE_LIBC_ALLOCATOR, 0, "use-libc-allocator", NULL, NOPE,
      "use malloc, free, etc. instead of stack allocator"},
+    {FLAG_REGISTERS, 0, "registers", NULL, NOPE,
+     "translate to register instructions that operate on locals in place"},
+    {FLAG_HUGE_PAGES, 0, "huge-pages", NULL, NOPE,
+     "back linear memory with transparent huge pages, if supported"},
+    {FLAG_FUEL, 0, "fuel", "AMOUNT", YEP,
+     "fuel for each exported function call; calls and loop iterations use "
+     "fuel for the instructions they run"},
+    {FLAG_FRESH_INSTANCES, 0, "fresh-instances", NULL, NOPE,
+     "with --run-all-exports, run each function in a new instance of the "
+     "module, after its start function"},
+    {FLAG_SNAPSHOT, 0, "snapshot", NULL, NOPE,
+     "with --fresh-instances, start each instance from a copy-on-write "
+     "snapshot taken after the start function, instead of running it again"},
+    {FLAG_REPEAT, 0, "repeat", "COUNT", YEP,
+     "with --run-all-exports, call each function COUNT times in one batch "
+     "through a resolved export handle, and print the last call's results"},
+    {FLAG_WORKERS, 0, "workers", "COUNT", YEP,
+     "with --fresh-instances, run the functions at the same time as green "
+     "threads on COUNT OS threads, sharing them by fuel"},
+    {FLAG_SUSPEND_HOST_CALLS, 0, "suspend-host-calls", NULL, NOPE,
+     "suspend the calling thread in each host function, and resume it with "
+     "the results afterward"},
+    {FLAG_LAZY, 0, "lazy", NULL, NOPE,
+     "translate each function when it is first called, instead of when the "
+     "module is read"},
+    {FLAG_TRANSLATE_THREADS, 0, "translate-threads", "COUNT", YEP,
+     "translate the function bodies on COUNT OS threads"},
+    {FLAG_CACHE_DIR, 0, "cache-dir", "DIR", YEP,
+     "keep the translated code of each module in DIR, and reuse it when the "
+     "same module is read again"},
+    {FLAG_OPTIMIZE, 0, "optimize", NULL, NOPE,
+     "fold constants while translating each function, then rewrite it, "
+     "threading jumps, merging drop_keeps and removing unreachable code"},
+    {FLAG_QUICKEN, 0, "quicken", NULL, NOPE,
+     "cache the function that each call_indirect called last, and call it "
+     "again without a lookup while the table is unchanged"},
 };
 WASM_STATIC_ASSERT(NUM_FLAGS == WASM_ARRAY_SIZE(s_options));
 
+#define MAX_REPEAT 1000000
+/* the most OS threads that --workers or --translate-threads can ask for */
+#define MAX_THREADS 256
+
+/* parses |argument| as a decimal count from 1 to |max|, or returns 0 if it
+ * isn't one */
+static uint32_t parse_count(const char* argument, uint32_t max) {
+  char* end;
+  errno = 0;
+  unsigned long count = strtoul(argument, &end, 10);
+  if (*argument < '0' || *argument > '9' || *end || errno || count > max)
+    return 0;
+  return count;
+}
+
 static void on_option(struct WasmOptionParser* parser,
                       struct WasmOption* option,
                       const char* argument) {
@@ -153,6 +227,91 @@ static void on_option(struct WasmOptionParser* parser,
     case FLAG_USE_LIBC_ALLOCATOR:
       s_use_libc_allocator = WASM_TRUE;
       break;
+
+    case FLAG_REGISTERS:
+      s_read_binary_interpreter_options.use_registers = WASM_TRUE;
+      break;
+
+    case FLAG_HUGE_PAGES:
+      s_read_binary_interpreter_options.use_huge_pages = WASM_TRUE;
+      break;
+
+    case FLAG_FUEL: {
+      char* end;
+      errno = 0;
+      long long fuel = strtoll(argument, &end, 10);
+      if (*argument < '0' || *argument > '9' || *end || errno || fuel <= 0)
+        WASM_FATAL("--fuel must be a positive integer.\n");
+      s_thread_options.fuel = fuel;
+      break;
+    }
+
+    case FLAG_FRESH_INSTANCES:
+      s_fresh_instances = WASM_TRUE;
+      break;
+
+    case FLAG_SNAPSHOT:
+      s_snapshot = WASM_TRUE;
+      break;
+
+    case FLAG_REPEAT:
+      s_repeat = parse_count(argument, UINT32_MAX);
+      if (s_repeat == 0)
+        WASM_FATAL("--repeat must be a positive integer.\n");
+      /* the results of every call are kept */
+      if (s_repeat > MAX_REPEAT)
+        WASM_FATAL("--repeat can be at most %d.\n", MAX_REPEAT);
+      break;
+
+    case FLAG_WORKERS:
+#if WASM_INTERPRETER_SCHEDULER
+      s_workers = parse_count(argument, MAX_THREADS);
+      if (s_workers == 0) {
+        WASM_FATAL("--workers must be a positive integer, at most %d.\n",
+                   MAX_THREADS);
+      }
+      /* the stack allocator can't be shared by the workers */
+      s_use_libc_allocator = WASM_TRUE;
+#else
+      WASM_FATAL("--workers requires a build with pthreads.\n");
+#endif
+      break;
+
+    case FLAG_SUSPEND_HOST_CALLS:
+      s_suspend_host_calls = WASM_TRUE;
+      break;
+
+    case FLAG_LAZY:
+      s_read_binary_interpreter_options.lazy = WASM_TRUE;
+      break;
+
+    case FLAG_TRANSLATE_THREADS:
+#if WASM_INTERPRETER_SCHEDULER
+      s_read_binary_interpreter_options.translate_threads =
+          parse_count(argument, MAX_THREADS);
+      if (s_read_binary_interpreter_options.translate_threads == 0) {
+        WASM_FATAL(
+            "--translate-threads must be a positive integer, at most %d.\n",
+            MAX_THREADS);
+      }
+      /* the stack allocator can't be shared by the threads */
+      s_use_libc_allocator = WASM_TRUE;
+#else
+      WASM_FATAL("--translate-threads requires a build with pthreads.\n");
+#endif
+      break;
+
+    case FLAG_CACHE_DIR:
+      s_read_binary_interpreter_options.cache_dir = argument;
+      break;
+
+    case FLAG_OPTIMIZE:
+      s_read_binary_interpreter_options.optimize = WASM_TRUE;
+      break;
+
+    case FLAG_QUICKEN:
+      s_read_binary_interpreter_options.quicken = WASM_TRUE;
+      break;
   }
 }
 
@@ -179,6 +338,31 @@ static void parse_options(int argc, char** argv) {
   if (s_spec && s_run_all_exports)
     WASM_FATAL("--spec and --run-all-exports are incompatible.\n");
 
+  if (s_snapshot && !s_fresh_instances)
+    WASM_FATAL("--snapshot requires --fresh-instances.\n");
+
+  if (s_workers && !s_fresh_instances)
+    WASM_FATAL("--workers requires --fresh-instances.\n");
+
+  if (s_workers && s_repeat)
+    WASM_FATAL("--workers and --repeat are incompatible.\n");
+
+  /* the repeated calls can't be resumed after a host call suspends them */
+  if (s_suspend_host_calls && s_repeat)
+    WASM_FATAL("--suspend-host-calls and --repeat are incompatible.\n");
+
+  /* spec tests expect invalid function bodies to fail the read */
+  if (s_spec && s_read_binary_interpreter_options.lazy)
+    WASM_FATAL("--spec and --lazy are incompatible.\n");
+
+  /* lazy translation changes the environment the workers share */
+  if (s_workers > 1 && s_read_binary_interpreter_options.lazy)
+    WASM_FATAL("--lazy can't be used with more than one worker.\n");
+
+  /* so does filling in the call_indirect caches */
+  if (s_workers > 1 && s_read_binary_interpreter_options.quicken)
+    WASM_FATAL("--quicken can't be used with more than one worker.\n");
+
   if (!s_infile) {
     wasm_print_help(&parser, PROGRAM_NAME);
     WASM_FATAL("No filename given.\n");
@@ -284,17 +468,36 @@ static void print_call(WasmStringSlice module_name,
   }
 }
 
+/* with --suspend-host-calls, the results of the host call that suspended
+ * the thread, kept until it is resumed. Functions have at most one. */
+static uint32_t s_suspended_num_results;
+static WasmInterpreterTypedValue s_suspended_result;
+
+static WasmInterpreterResult resume_suspended_host_call(
+    WasmInterpreterThread* thread) {
+  return wasm_resume_host_call(thread, &s_suspended_result,
+                               s_suspended_num_results);
+}
+
 static WasmInterpreterResult run_defined_function(WasmInterpreterThread* thread,
                                                   uint32_t offset) {
   thread->pc = offset;
-  WasmInterpreterResult iresult = WASM_INTERPRETER_OK;
-  uint32_t quantum = s_trace ? 1 : INSTRUCTION_QUANTUM;
+  thread->fuel = s_thread_options.fuel;
+  WasmInterpreterResult iresult;
   uint32_t* call_stack_return_top = thread->call_stack_top;
-  while (iresult == WASM_INTERPRETER_OK) {
-    if (s_trace)
-      wasm_trace_pc(thread, s_stdout_stream);
-    iresult = wasm_run_interpreter(thread, quantum, call_stack_return_top);
-  }
+  do {
+    iresult = WASM_INTERPRETER_OK;
+    if (s_trace) {
+      while (iresult == WASM_INTERPRETER_OK) {
+        wasm_trace_pc(thread, s_stdout_stream);
+        iresult = wasm_step_interpreter(thread, call_stack_return_top);
+      }
+    } else {
+      iresult = wasm_run_interpreter(thread, call_stack_return_top);
+    }
+    if (iresult == WASM_INTERPRETER_SUSPENDED)
+      iresult = resume_suspended_host_call(thread);
+  } while (iresult == WASM_INTERPRETER_OK);
   if (iresult != WASM_INTERPRETER_RETURNED)
     return iresult;
   /* use OK instead of RETURNED for consistency */
@@ -358,9 +561,13 @@ static WasmInterpreterResult run_function(
 
   WasmInterpreterResult iresult = push_args(thread, sig, args);
   if (iresult == WASM_INTERPRETER_OK) {
-    iresult = func->is_host
-                  ? wasm_call_host(thread, func)
-                  : run_defined_function(thread, func->defined.offset);
+    if (func->is_host) {
+      iresult = wasm_call_host(thread, func);
+      if (iresult == WASM_INTERPRETER_SUSPENDED)
+        iresult = resume_suspended_host_call(thread);
+    } else {
+      iresult = run_defined_function(thread, func->defined.offset);
+    }
     if (iresult == WASM_INTERPRETER_OK)
       copy_results(allocator, thread, sig, out_results);
   }
@@ -405,6 +612,51 @@ static WasmInterpreterResult run_export(
   return run_function(allocator, thread, export->index, args, out_results);
 }
 
+/* calls |export| s_repeat times with wasm_call_interpreter_export, and copies
+ * the results of the last call to |out_results|. */
+static WasmInterpreterResult run_export_repeatedly(
+    WasmAllocator* allocator,
+    WasmInterpreterThread* thread,
+    WasmInterpreterModule* module,
+    const WasmInterpreterExport* export,
+    WasmInterpreterTypedValueVector* out_results) {
+  WasmInterpreterExportHandle handle;
+  WasmInterpreterResult iresult = wasm_get_interpreter_export_handle(
+      thread->env, module, &export->name, &handle);
+  if (iresult != WASM_INTERPRETER_OK)
+    return iresult;
+  /* --run-all-exports doesn't pass any arguments */
+  if (handle.param_count != 0)
+    return WASM_INTERPRETER_ARGUMENT_TYPE_MISMATCH;
+
+  size_t results_size =
+      (size_t)s_repeat * handle.result_count * sizeof(WasmInterpreterValue);
+  WasmInterpreterValue* results =
+      results_size ? wasm_alloc(allocator, results_size, WASM_DEFAULT_ALIGN)
+                   : NULL;
+  /* like run_export, each call gets its own fuel */
+  handle.fuel_per_call = s_thread_options.fuel;
+  iresult = wasm_call_interpreter_export(thread, &handle, NULL, results,
+                                         s_repeat, NULL);
+  if (iresult == WASM_INTERPRETER_OK) {
+    WasmInterpreterFunc* func = &thread->env->funcs.data[handle.func_index];
+    WasmInterpreterFuncSignature* sig =
+        &thread->env->sigs.data[func->sig_index];
+    out_results->size = 0;
+    wasm_resize_interpreter_typed_value_vector(allocator, out_results,
+                                               handle.result_count);
+    uint32_t i;
+    for (i = 0; i < handle.result_count; ++i) {
+      out_results->data[i].type = sig->result_types.data[i];
+      out_results->data[i].value =
+          results[(s_repeat - 1) * handle.result_count + i];
+    }
+  }
+  if (results)
+    wasm_free(allocator, results);
+  return iresult;
+}
+
 static WasmInterpreterResult run_export_by_name(
     WasmAllocator* allocator,
     WasmInterpreterThread* thread,
@@ -435,8 +687,9 @@ static WasmInterpreterResult get_global_export_by_name(
   if (export->kind != WASM_EXTERNAL_KIND_GLOBAL)
     return WASM_INTERPRETER_EXPORT_KIND_MISMATCH;
 
-  assert(export->index < thread->env->globals.size);
-  WasmInterpreterGlobal* global = &thread->env->globals.data[export->index];
+  assert(export->index < thread->instance->globals.size);
+  WasmInterpreterGlobal* global =
+      &thread->instance->globals.data[export->index];
 
   /* Don't clear out the vector, in case it is being reused. Just reset the
    * size to zero. */
@@ -446,10 +699,138 @@ static WasmInterpreterResult get_global_export_by_name(
   return WASM_INTERPRETER_OK;
 }
 
+static WasmResult init_fresh_instance(WasmAllocator* allocator,
+                                      WasmInterpreterEnvironment* env,
+                                      const WasmInterpreterSnapshot* snapshot,
+                                      WasmInterpreterInstance* out_instance) {
+  WasmResult result =
+      snapshot ? wasm_init_interpreter_instance_from_snapshot(
+                     allocator, env, snapshot, out_instance)
+               : wasm_init_interpreter_instance(allocator, env, out_instance);
+  if (WASM_FAILED(result))
+    fprintf(stderr, "error: unable to initialize instance\n");
+  return result;
+}
+
+#if WASM_INTERPRETER_SCHEDULER
+typedef struct ExportTask {
+  WasmInterpreterTask task;
+  WasmInterpreterThread thread;
+  WasmInterpreterInstance instance;
+  WasmBool has_instance;
+  WasmBool scheduled;
+  WasmInterpreterResult result;
+  WasmInterpreterTypedValueVector results;
+} ExportTask;
+
+/* set while run_all_exports_on_scheduler runs the scheduler */
+static WasmInterpreterScheduler* s_scheduler;
+
+/* like run_all_exports with --fresh-instances, but the functions run at the
+ * same time on s_workers OS threads, each with its own interpreter thread.
+ * Start functions, host functions and functions that need arguments run
+ * beforehand, one at a time, and the calls are printed in order at the end. */
+static void run_all_exports_on_scheduler(
+    WasmAllocator* allocator,
+    WasmInterpreterModule* module,
+    WasmInterpreterEnvironment* env,
+    const WasmInterpreterSnapshot* snapshot,
+    RunVerbosity verbose) {
+  WasmInterpreterSchedulerOptions options =
+      WASM_INTERPRETER_SCHEDULER_OPTIONS_DEFAULT;
+  options.worker_count = s_workers;
+  WasmInterpreterScheduler scheduler;
+  if (WASM_FAILED(
+          wasm_init_interpreter_scheduler(allocator, &scheduler, &options))) {
+    fprintf(stderr, "error: unable to initialize scheduler\n");
+    return;
+  }
+
+  WasmInterpreterTypedValueVector args;
+  WASM_ZERO_MEMORY(args);
+  size_t export_count = module->exports.size;
+  ExportTask* tasks = wasm_alloc_zero(
+      allocator, export_count * sizeof(ExportTask), WASM_DEFAULT_ALIGN);
+  size_t i;
+  for (i = 0; i < export_count; ++i) {
+    WasmInterpreterExport* export = &module->exports.data[i];
+    ExportTask* task = &tasks[i];
+    wasm_init_interpreter_thread(allocator, env, &task->thread,
+                                 &s_thread_options);
+    if (WASM_FAILED(init_fresh_instance(allocator, env, snapshot,
+                                        &task->instance)))
+      continue;
+    task->has_instance = WASM_TRUE;
+    task->thread.instance = &task->instance;
+    task->result = WASM_INTERPRETER_OK;
+    if (!snapshot)
+      task->result = run_start_function(allocator, &task->thread, module);
+    if (task->result != WASM_INTERPRETER_OK)
+      continue;
+
+    assert(export->kind == WASM_EXTERNAL_KIND_FUNC);
+    WasmInterpreterFunc* func = &env->funcs.data[export->index];
+    WasmInterpreterFuncSignature* sig = &env->sigs.data[func->sig_index];
+    if (func->is_host || sig->param_types.size != 0) {
+      task->result = run_export(allocator, &task->thread, export, &args,
+                                &task->results);
+      continue;
+    }
+
+    task->thread.pc = func->defined.offset;
+    task->task.thread = &task->thread;
+    task->task.call_stack_return_top = task->thread.call_stack_top;
+    task->task.fuel = s_thread_options.fuel;
+    task->scheduled = WASM_TRUE;
+    wasm_schedule_interpreter_task(&scheduler, &task->task);
+  }
+
+  s_scheduler = &scheduler;
+  wasm_run_interpreter_scheduler(&scheduler);
+  s_scheduler = NULL;
+
+  for (i = 0; i < export_count; ++i) {
+    WasmInterpreterExport* export = &module->exports.data[i];
+    ExportTask* task = &tasks[i];
+    if (task->scheduled) {
+      task->result = task->task.result;
+      /* use OK instead of RETURNED for consistency */
+      if (task->result == WASM_INTERPRETER_RETURNED) {
+        WasmInterpreterFunc* func = &env->funcs.data[export->index];
+        copy_results(allocator, &task->thread,
+                     &env->sigs.data[func->sig_index], &task->results);
+        task->result = WASM_INTERPRETER_OK;
+      }
+    }
+    if (task->has_instance && verbose) {
+      print_call(wasm_empty_string_slice(), export->name, &args,
+                 &task->results, task->result);
+    }
+    if (task->has_instance)
+      wasm_destroy_interpreter_instance(allocator, &task->instance);
+    wasm_destroy_interpreter_typed_value_vector(allocator, &task->results);
+    wasm_destroy_interpreter_thread(allocator, &task->thread);
+  }
+  wasm_free(allocator, tasks);
+  wasm_destroy_interpreter_typed_value_vector(allocator, &args);
+  wasm_destroy_interpreter_scheduler(&scheduler);
+}
+#endif
+
+/* with --fresh-instances, each export runs in a new instance, started from
+ * |snapshot| if it is non-NULL. */
 static void run_all_exports(WasmAllocator* allocator,
                             WasmInterpreterModule* module,
                             WasmInterpreterThread* thread,
+                            const WasmInterpreterSnapshot* snapshot,
                             RunVerbosity verbose) {
+#if WASM_INTERPRETER_SCHEDULER
+  if (s_workers) {
+    run_all_exports_on_scheduler(allocator, module, thread->env, snapshot,
+                                 verbose);
+    return;
+  }
+#endif
   WasmInterpreterTypedValueVector args;
   WasmInterpreterTypedValueVector results;
   WASM_ZERO_MEMORY(args);
@@ -457,12 +838,30 @@ static void run_all_exports(WasmAllocator* allocator,
   uint32_t i;
   for (i = 0; i < module->exports.size; ++i) {
     WasmInterpreterExport* export = &module->exports.data[i];
-    WasmInterpreterResult iresult =
-        run_export(allocator, thread, export, &args, &results);
+    WasmInterpreterInstance instance;
+    WasmInterpreterResult iresult = WASM_INTERPRETER_OK;
+    if (s_fresh_instances) {
+      if (WASM_FAILED(init_fresh_instance(allocator, thread->env, snapshot,
+                                          &instance)))
+        continue;
+      thread->instance = &instance;
+      if (!snapshot)
+        iresult = run_start_function(allocator, thread, module);
+    }
+    if (iresult == WASM_INTERPRETER_OK) {
+      iresult = s_repeat ? run_export_repeatedly(allocator, thread, module,
+                                                 export, &results)
+                         : run_export(allocator, thread, export, &args,
+                                      &results);
+    }
     if (verbose) {
       print_call(wasm_empty_string_slice(), export->name, &args, &results,
                  iresult);
     }
+    if (s_fresh_instances) {
+      thread->instance = &thread->env->instance;
+      wasm_destroy_interpreter_instance(allocator, &instance);
+    }
   }
   wasm_destroy_interpreter_typed_value_vector(allocator, &args);
   wasm_destroy_interpreter_typed_value_vector(allocator, &results);
@@ -484,6 +883,7 @@ static WasmResult read_module(WasmAllocator* allocator,
     WasmAllocator* memory_allocator = &g_wasm_libc_allocator;
     result = wasm_read_binary_interpreter(allocator, memory_allocator, env,
                                           data, size, &s_read_binary_options,
+                                          &s_read_binary_interpreter_options,
                                           error_handler, out_module);
 
     if (WASM_SUCCEEDED(result)) {
@@ -495,6 +895,30 @@ static WasmResult read_module(WasmAllocator* allocator,
   return result;
 }
 
+/* with --suspend-host-calls, host functions suspend the calling thread
+ * rather than returning |results|. A thread run by the scheduler is resumed
+ * right away, before its worker has seen it suspend; otherwise the results
+ * are kept until the thread is resumed after it stops. */
+static void suspend_host_call(const WasmInterpreterTypedValue* results,
+                              uint32_t num_results) {
+  WasmInterpreterThread* thread = wasm_suspend_host_call();
+#if WASM_INTERPRETER_SCHEDULER
+  if (s_scheduler) {
+    ExportTask* task =
+        (ExportTask*)((char*)thread - offsetof(ExportTask, thread));
+    wasm_resume_interpreter_task(s_scheduler, &task->task, results,
+                                 num_results);
+    return;
+  }
+#else
+  WASM_USE(thread);
+#endif
+  assert(num_results <= 1);
+  s_suspended_num_results = num_results;
+  if (num_results)
+    s_suspended_result = results[0];
+}
+
 static WasmResult default_host_callback(const WasmInterpreterFunc* func,
                                         const WasmInterpreterFuncSignature* sig,
                                         uint32_t num_args,
@@ -518,6 +942,8 @@ static WasmResult default_host_callback(const WasmInterpreterFunc* func,
   printf("called host ");
   print_call(func->host.module_name, func->host.field_name, &vec_args,
              &vec_results, WASM_INTERPRETER_OK);
+  if (s_suspend_host_calls)
+    suspend_host_call(out_results, num_results);
   return WASM_OK;
 }
 
@@ -532,13 +958,28 @@ static void WASM_PRINTF_FORMAT(2, 3)
   callback.print_error(buffer, callback.user_data);
 }
 
+/* spectest.print(i32), called without marshalling its argument */
+static WasmResult spectest_print_i32(void* user_data, uint32_t value) {
+  WasmInterpreterTypedValue arg;
+  arg.type = WASM_TYPE_I32;
+  arg.value.i32 = value;
+  printf("called host spectest.print(");
+  print_typed_value(&arg);
+  printf(") =>\n");
+  if (s_suspend_host_calls)
+    suspend_host_call(NULL, 0);
+  return WASM_OK;
+}
+
 static WasmResult spectest_import_func(WasmInterpreterImport* import,
                                        WasmInterpreterFunc* func,
                                        WasmInterpreterFuncSignature* sig,
                                        WasmPrintErrorCallback callback,
                                        void* user_data) {
   if (wasm_string_slice_eq_cstr(&import->field_name, "print")) {
-    func->host.callback = default_host_callback;
+    if (WASM_FAILED(
+            wasm_set_host_func_vi(func, sig, spectest_print_i32, NULL)))
+      func->host.callback = default_host_callback;
     return WASM_OK;
   } else {
     print_error(callback, "unknown host function import " PRIimport,
@@ -571,9 +1012,11 @@ static WasmResult spectest_import_memory(WasmInterpreterImport* import,
     memory->page_limits.has_max = WASM_TRUE;
     memory->page_limits.initial = 1;
     memory->page_limits.max = 2;
-    memory->byte_size = memory->page_limits.initial * WASM_MAX_PAGES;
-    memory->data = wasm_alloc_zero(memory->allocator, memory->byte_size,
-                                   WASM_DEFAULT_ALIGN);
+    if (WASM_FAILED(wasm_alloc_interpreter_memory(memory))) {
+      print_error(callback, "unable to allocate memory for " PRIimport,
+                  PRINTF_IMPORT_ARG(*import));
+      return WASM_ERROR;
+    }
     return WASM_OK;
   } else {
     print_error(callback, "unknown host memory import " PRIimport,
@@ -648,8 +1091,20 @@ static WasmResult read_and_run_module(WasmAllocator* allocator,
     WasmInterpreterResult iresult =
         run_start_function(allocator, &thread, module);
     if (iresult == WASM_INTERPRETER_OK) {
-      if (s_run_all_exports)
-        run_all_exports(allocator, module, &thread, RUN_VERBOSE);
+      if (s_run_all_exports) {
+        WasmInterpreterSnapshot snapshot;
+        WasmBool has_snapshot = WASM_FALSE;
+        if (s_snapshot) {
+          has_snapshot = WASM_SUCCEEDED(wasm_snapshot_interpreter_instance(
+              allocator, &env, &env.instance, &snapshot));
+          if (!has_snapshot)
+            fprintf(stderr, "error: unable to snapshot instance\n");
+        }
+        run_all_exports(allocator, module, &thread,
+                        has_snapshot ? &snapshot : NULL, RUN_VERBOSE);
+        if (has_snapshot)
+          wasm_destroy_interpreter_snapshot(allocator, &snapshot);
+      }
     } else {
       print_interpreter_result("error running start function", iresult);
     }
@@ -48,6 +48,21 @@ def main(args):
   parser.add_argument('--run-all-exports', action='store_true')
   parser.add_argument('--spec', action='store_true')
   parser.add_argument('--use-libc-allocator', action='store_true')
+  parser.add_argument('--registers', action='store_true')
+  parser.add_argument('--huge-pages', action='store_true')
+  parser.add_argument('--fuel')
+  parser.add_argument('--fresh-instances', action='store_true')
+  parser.add_argument('--snapshot', action='store_true')
+  parser.add_argument('--repeat')
+  parser.add_argument('--workers')
+  parser.add_argument('--suspend-host-calls', action='store_true')
+  parser.add_argument('--lazy', action='store_true')
+  parser.add_argument('--translate-threads')
+  parser.add_argument('--optimize', action='store_true')
+  parser.add_argument('--quicken', action='store_true')
+  parser.add_argument('--istream-cache', action='store_true',
+                      help='run wasm-interp a second time, reading the '
+                      'translated code that the first run cached.')
   parser.add_argument('file', help='test file.')
   options = parser.parse_args(args)
 
@@ -71,7 +86,19 @@ def main(args):
     '--run-all-exports': options.run_all_exports,
     '--spec': options.spec,
     '--trace': options.verbose,
-    '--use-libc-allocator': options.use_libc_allocator
+    '--use-libc-allocator': options.use_libc_allocator,
+    '--registers': options.registers,
+    '--huge-pages': options.huge_pages,
+    '--fuel': options.fuel,
+    '--fresh-instances': options.fresh_instances,
+    '--snapshot': options.snapshot,
+    '--repeat': options.repeat,
+    '--workers': options.workers,
+    '--suspend-host-calls': options.suspend_host_calls,
+    '--lazy': options.lazy,
+    '--translate-threads': options.translate_threads,
+    '--optimize': options.optimize,
+    '--quicken': options.quicken
   })
 
   wast2wasm.verbose = options.print_cmd
@@ -88,6 +115,9 @@ def main(args):
       wasm_files = [out_file]
     for wasm_file in wasm_files:
       wasmdump.RunWithArgs(wasm_file)
+    if options.istream_cache:
+      wasm_interp.AppendArg('--cache-dir=%s' % out_dir)
+      wasm_interp.RunWithArgsForStdout(out_file)
     wasm_interp.RunWithArgs(out_file)
 
   return 0